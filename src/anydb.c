@@ -62,25 +62,10 @@
 #define NO_MATCH_SCORE			0x00
 
 /**
- * helper for searching items
+ * helper for searching items: all its fields are indexes, including
+ * the permission, so matching is only comparing integers
  */
-union searchkey {
-	struct {
-		/** client id */
-		anydb_idx_t idxcli;
-
-		/** session id */
-		anydb_idx_t idxses;
-
-		/** user id */
-		anydb_idx_t idxusr;
-
-		/** permission string */
-		const char *strperm;
-	};
-	anydb_key_t key;
-};
-typedef union searchkey searchkey_t;
+typedef anydb_key_t searchkey_t;
 
 /******************************************************************************/
 /******************************************************************************/
@@ -174,6 +159,39 @@ idx(
 	return db->itf.index(db->clodb, idx, name, create);
 }
 
+/**
+ * Search the index of the permission 'name' and create it if 'create'
+ * Permissions are compared ignoring case.
+ * @param db the anydb database to query
+ * @param idx where to store the result if needed
+ * @param name permission to search and/or create
+ * @param create if not nul, the permission is created if it doesn't exist
+ * @return 0 in case of success of -errno
+ */
+static
+int
+idx_perm(
+	anydb_t *db,
+	anydb_idx_t *idx,
+	const char *name,
+	bool create
+) {
+	/* handle special names */
+	if (is_any(name)) {
+		/* no name, empty name or single char for ANY */
+		*idx = AnyIdx_Any;
+		return 0;
+	}
+	if (!name[1] && name[0] == Data_Wide_Char) {
+		/* Single char for WIDE */
+		*idx = AnyIdx_Wide;
+		return 0;
+	}
+
+	/* other case: ask the database backend */
+	return db->itf.index_permission(db->clodb, idx, name, create);
+}
+
 /**
  * Search the index of 'name' and create it if 'create'
  * Return the index for WIDE if name matches ANY or WIDE
@@ -228,15 +246,127 @@ idx_or_none_but_any(
 /******************************************************************************/
 /******************************************************************************/
 
+/* structure for dropping expired items */
+struct expire_s
+{
+	time_t now;           /* the current time */
+	time_t next;          /* next expiration or -1 if none */
+};
+
+/**
+ * Get the time of expiration of the value
+ * @param expire the expiration of the value
+ * @return the time of expiration or 0 if never
+ */
+static
+time_t
+expiration(
+	time_t expire
+) {
+	return expire < 0 ? -(expire + 1) : expire;
+}
+
+/**
+ * Check if the value is expired
+ * @param expire the expiration of the value
+ * @param now the current time
+ * @return true if the value expired or false if not or if it never expires
+ */
 static
 bool
-expired(
+is_expired(
 	time_t expire,
 	time_t now
 ) {
-	if (expire < 0)
-		expire = -(expire + 1);
-	return expire && expire <= now;
+	expire = expiration(expire);
+	return expire != 0 && expire <= now;
+}
+
+/* callback for dropping expired items and computing the next expiration */
+static
+anydb_action_t
+expire_cb(
+	void *closure,
+	const anydb_key_t *key,
+	anydb_value_t *value
+) {
+	struct expire_s *s = closure;
+	time_t expire;
+
+	if (is_expired(value->expire, s->now))
+		return Anydb_Action_Remove_And_Continue;
+	expire = expiration(value->expire);
+	if (expire && (s->next < 0 || expire < s->next))
+		s->next = expire;
+	return Anydb_Action_Continue;
+}
+
+/**
+ * Drop the expired items of the database if the time of the next
+ * expiration is reached or unknown. Doing it before any operation
+ * ensures that the operations never see expired items.
+ * @param db the database
+ * @param now the current time
+ */
+static
+void
+drop_expired(
+	anydb_t *db,
+	time_t now
+) {
+	struct expire_s s;
+
+	if (db->next_expire >= 0 && db->next_expire <= now) {
+		s.now = now;
+		s.next = -1;
+		db->itf.apply(db->clodb, expire_cb, &s);
+		db->next_expire = s.next;
+	}
+}
+
+/**
+ * Record in the database the expiration of an added or updated item
+ * @param db the database
+ * @param expire the expiration of the item
+ */
+static
+void
+add_expire(
+	anydb_t *db,
+	time_t expire
+) {
+	expire = expiration(expire);
+	if (expire && (db->next_expire < 0 || (db->next_expire > 0 && expire < db->next_expire)))
+		db->next_expire = expire;
+}
+
+/******************************************************************************/
+/******************************************************************************/
+/*** LOOKUP                                                                 ***/
+/******************************************************************************/
+/******************************************************************************/
+
+/**
+ * Apply 'oper' to the items of 'db' that can match 'skey'.
+ * Use the lookup method of the backend if it exists or otherwise
+ * iterate over all items.
+ * @param db the database
+ * @param skey the search key
+ * @param oper the operator to apply
+ * @param closure closure of the operator
+ */
+static
+void
+lookup(
+	anydb_t *db,
+	const searchkey_t *skey,
+	anydb_applycb_t *oper,
+	void *closure
+) {
+	if (db->itf.lookup)
+		db->itf.lookup(db->clodb, skey, oper, closure);
+	else
+		db->itf.apply(db->clodb, oper, closure);
 }
 
 /******************************************************************************/
@@ -252,11 +382,11 @@ searchkey_prepare_match(anydb_t *db,
 	searchkey_t *skey,
 	bool create
 ) {
-	if (idx(db, &skey->idxcli, key->client, create)
-	 || idx(db, &skey->idxses, key->session, create)
-	 || idx(db, &skey->idxusr, key->user, create))
+	if (idx(db, &skey->client, key->client, create)
+	 || idx(db, &skey->session, key->session, create)
+	 || idx(db, &skey->user, key->user, create)
+	 || idx_perm(db, &skey->permission, key->permission, create))
 		return false; /* one of the idx doesn't exist */
-	skey->strperm = is_any(key->permission) ? NULL : key->permission;
 
 	return true;
 }
@@ -264,14 +394,13 @@ searchkey_prepare_match(anydb_t *db,
 static
 bool
 searchkey_match(
-	anydb_t *db,
 	const anydb_key_t *key,
 	const searchkey_t *skey
 ) {
-	return (skey->idxcli == AnyIdx_Any || skey->idxcli == key->client)
-	    && (skey->idxses == AnyIdx_Any || skey->idxses == key->session)
-	    && (skey->idxusr == AnyIdx_Any || skey->idxusr == key->user)
-	    && (!skey->strperm || !strcasecmp(skey->strperm, string(db, key->permission)));
+	return (skey->client == AnyIdx_Any || skey->client == key->client)
+	    && (skey->session == AnyIdx_Any || skey->session == key->session)
+	    && (skey->user == AnyIdx_Any || skey->user == key->user)
+	    && (skey->permission == AnyIdx_Any || skey->permission == key->permission);
 }
 
 static
@@ -284,13 +413,13 @@ searchkey_prepare_is(
 ) {
 	int rc;
 
-	rc = idx_but_any(db, &skey->idxcli, key->client, create);
+	rc = idx_but_any(db, &skey->client, key->client, create);
 	if (!rc) {
-		rc = idx_but_any(db, &skey->idxses, key->session, create);
+		rc = idx_but_any(db, &skey->session, key->session, create);
 		if (!rc) {
-			rc = idx_but_any(db, &skey->idxusr, key->user, create);
+			rc = idx_but_any(db, &skey->user, key->user, create);
 			if (!rc)
-				skey->strperm = key->permission;
+				rc = idx_perm(db, &skey->permission, key->permission, create);
 		}
 	}
 	return rc;
@@ -299,14 +428,13 @@ searchkey_prepare_is(
 static
 bool
 searchkey_is(
-	anydb_t *db,
 	const anydb_key_t *key,
 	const searchkey_t *skey
 ) {
-	return skey->idxcli == key->client
-	    && skey->idxses == key->session
-	    && skey->idxusr == key->user
-	    && !strcasecmp(skey->strperm, string(db, key->permission));
+	return skey->client == key->client
+	    && skey->session == key->session
+	    && skey->user == key->user
+	    && skey->permission == key->permission;
 }
 
 static
@@ -317,26 +445,25 @@ searchkey_prepare_test(
 	searchkey_t *skey,
 	bool create
 ) {
-	skey->idxcli = idx_or_none_but_any(db, key->client, create);
-	skey->idxses = idx_or_none_but_any(db, key->session, create);
-	skey->idxusr = idx_or_none_but_any(db, key->user, create);
-	skey->strperm = key->permission;
+	skey->client = idx_or_none_but_any(db, key->client, create);
+	skey->session = idx_or_none_but_any(db, key->session, create);
+	skey->user = idx_or_none_but_any(db, key->user, create);
+	if (idx_perm(db, &skey->permission, key->permission, false))
+		skey->permission = AnyIdx_None;
 }
 
 static
 unsigned
 searchkey_test(
-	anydb_t *db,
 	const anydb_key_t *key,
 	const searchkey_t *skey
 ) {
 	unsigned sc;
 
-	if ((key->client  != AnyIdx_Wide && skey->idxcli != key->client)
-	 || (key->session != AnyIdx_Wide && skey->idxses != key->session)
-	 || (key->user    != AnyIdx_Wide && skey->idxusr != key->user)
-	 || (key->permission != AnyIdx_Wide
-	        && strcasecmp(skey->strperm, string(db, key->permission)))) {
+	if ((key->client     != AnyIdx_Wide && skey->client     != key->client)
+	 || (key->session    != AnyIdx_Wide && skey->session    != key->session)
+	 || (key->user       != AnyIdx_Wide && skey->user       != key->user)
+	 || (key->permission != AnyIdx_Wide && skey->permission != key->permission)) {
 		sc = NO_MATCH_SCORE;
 	} else {
 		sc = SOME_MATCH_SCORE;
@@ -364,6 +491,9 @@ anydb_transaction(
 	anydb_t *db,
 	anydb_transaction_t oper
 ) {
+	/* cancelling can restore items expiring earlier */
+	if (oper == Anydb_Transaction_Cancel)
+		db->next_expire = 0;
 	if (db->itf.transaction)
 		return db->itf.transaction(db->clodb, oper);
 	return -ENOTSUP;
@@ -378,7 +508,6 @@ anydb_transaction(
 struct for_all_s
 {
 	anydb_t *db;          /* targeted database */
-	time_t now;           /* also drop expired items */
 	searchkey_t skey;
 	void *closure;
 	void (*callback)(
@@ -398,11 +527,7 @@ for_all_cb(
 	data_key_t k;
 	data_value_t v;
 
-	/* drop expired items */
-	if (expired(value->expire, s->now))
-		return Anydb_Action_Remove_And_Continue;
-
-	if (searchkey_match(s->db, key, &s->skey)) {
+	if (searchkey_match(key, &s->skey)) {
 		k.client = string(s->db, key->client);
 		k.session = string(s->db, key->session);
 		k.user = string(s->db, key->user);
@@ -427,13 +552,13 @@ anydb_for_all(
 ) {
 	struct for_all_s s;
 
+	drop_expired(db, time(NULL));
 	if (!searchkey_prepare_match(db, key, &s.skey, false))
 		return; /* nothing to do! because one of the idx doesn't exist */
 
 	s.db = db;
 	s.closure = closure;
 	s.callback = callback;
-	s.now = time(NULL);
 	db->itf.apply(db->clodb, for_all_cb, &s);
 }
 
@@ -447,7 +572,6 @@ anydb_for_all(
 struct drop_s
 {
 	anydb_t *db;          /* targeted database */
-	time_t now;           /* also drop expired items */
 	searchkey_t skey;     /* the search key */
 };
 
@@ -461,18 +585,32 @@ drop_cb(
 ) {
 	struct drop_s *s = closure;
 
-	/* drop expired items */
-	if (expired(value->expire, s->now))
-		return Anydb_Action_Remove_And_Continue;
-
 	/* remove if matches the key */
-	if (searchkey_match(s->db, key, &s->skey))
+	if (searchkey_match(key, &s->skey))
 		return Anydb_Action_Remove_And_Continue;
 
 	/* continue to next */
 	return Anydb_Action_Continue;
 }
 
+/* callback for dropping the item of the key */
+static
+anydb_action_t
+drop_is_cb(
+	void *closure,
+	const anydb_key_t *key,
+	anydb_value_t *value
+) {
+	struct drop_s *s = closure;
+
+	/* remove if it is the key, it is unique */
+	if (searchkey_is(key, &s->skey))
+		return Anydb_Action_Remove_And_Stop;
+
+	/* continue to next */
+	return Anydb_Action_Continue;
+}
+
 /* see anydb.h */
 void
 anydb_drop(
@@ -481,12 +619,73 @@ anydb_drop(
 ) {
 	struct drop_s s;
 
+	drop_expired(db, time(NULL));
 	if (!searchkey_prepare_match(db, key, &s.skey, false))
 		return; /* nothing to do! because one of the idx doesn't exist */
 
 	s.db = db;
-	s.now = time(NULL);
-	db->itf.apply(db->clodb, drop_cb, &s);
+	if (s.skey.client != AnyIdx_Any
+	 && s.skey.session != AnyIdx_Any
+	 && s.skey.user != AnyIdx_Any
+	 && s.skey.permission != AnyIdx_Any)
+		lookup(db, &s.skey, drop_is_cb, &s); /* no ANY, at most one item */
+	else
+		db->itf.apply(db->clodb, drop_cb, &s);
+}
+
+/* structure for dropping items of many keys */
+struct drop_batch_s
+{
+	unsigned count;       /* count of search keys */
+	searchkey_t *skeys;   /* the search keys */
+};
+
+/* callback for dropping items of many keys */
+static
+anydb_action_t
+drop_batch_cb(
+	void *closure,
+	const anydb_key_t *key,
+	anydb_value_t *value
+) {
+	struct drop_batch_s *s = closure;
+	unsigned i;
+
+	/* remove if matches one of the keys */
+	for (i = 0 ; i < s->count ; i++)
+		if (searchkey_match(key, &s->skeys[i]))
+			return Anydb_Action_Remove_And_Continue;
+
+	/* continue to next */
+	return Anydb_Action_Continue;
+}
+
+/* see anydb.h */
+int
+anydb_drop_batch(
+	anydb_t *db,
+	const data_key_t *keys,
+	unsigned count
+) {
+	struct drop_batch_s s;
+	unsigned i;
+
+	drop_expired(db, time(NULL));
+	s.skeys = malloc(count * sizeof *s.skeys);
+	if (!s.skeys)
+		return -ENOMEM;
+
+	/* the keys having an unknown idx match nothing */
+	s.count = 0;
+	for (i = 0 ; i < count ; i++)
+		if (searchkey_prepare_match(db, &keys[i], &s.skeys[s.count], false))
+			s.count++;
+
+	/* one pass for all the keys */
+	if (s.count)
+		db->itf.apply(db->clodb, drop_batch_cb, &s);
+	free(s.skeys);
+	return 0;
 }
 
 /******************************************************************************/
@@ -499,7 +698,6 @@ anydb_drop(
 struct set_s
 {
 	anydb_t *db;          /* targeted database */
-	time_t now;           /* also drop expired items */
 	searchkey_t skey;     /* searching key */
 	anydb_value_t value;  /* value to set */
 };
@@ -514,11 +712,7 @@ set_cb(
 ) {
 	struct set_s *s = closure;
 
-	/* drop expired items */
-	if (expired(value->expire, s->now))
-		return Anydb_Action_Remove_And_Continue;
-
-	if (searchkey_is(s->db, key, &s->skey)) {
+	if (searchkey_is(key, &s->skey)) {
 		/* indicates that is found */
 		s->db = NULL;
 
@@ -546,6 +740,7 @@ anydb_set(
 	int rc;
 	struct set_s s;
 
+	drop_expired(db, time(NULL));
 	rc = searchkey_prepare_is(db, key, &s.skey, true);
 	if (rc)
 		goto error;
@@ -556,14 +751,13 @@ anydb_set(
 
 	s.db = db;
 	s.value.expire = value->expire;
-	s.now = time(NULL);
-	db->itf.apply(db->clodb, set_cb, &s);
+	lookup(db, &s.skey, set_cb, &s);
 	if (s.db) {
 		/* no item to alter so must be added */
-		rc = idx(db, &s.skey.key.permission, key->permission, true);
-		if (!rc)
-			rc = db->itf.add(db->clodb, &s.skey.key, &s.value);
+		rc = db->itf.add(db->clodb, &s.skey, &s.value);
 	}
+	if (rc == 0)
+		add_expire(db, value->expire);
 error:
 	return rc;
 }
@@ -578,7 +772,8 @@ error:
 struct test_s
 {
 	anydb_t *db;          /* targeted database */
-	time_t now;
+	bool ordered;         /* items come from the most specific */
+	time_t now;           /* the current time */
 	unsigned score;
 	searchkey_t skey;
 	anydb_value_t value;
@@ -595,14 +790,16 @@ test_cb(
 	struct test_s *s = closure;
 	unsigned sc;
 
-	/* drop expired items */
-	if (expired(value->expire, s->now))
-		return Anydb_Action_Remove_And_Continue;
-
-	sc = searchkey_test(s->db, key, &s->skey);
+	sc = searchkey_test(key, &s->skey);
 	if (sc > s->score) {
+		/* expired items are skipped, not dropped */
+		if (is_expired(value->expire, s->now))
+			return Anydb_Action_Continue;
 		s->score = sc;
 		s->value = *value;
+		/* when ordered, the first matching item has the best score */
+		if (s->ordered)
+			return Anydb_Action_Stop;
 	}
 	return Anydb_Action_Continue;
 }
@@ -616,12 +813,14 @@ anydb_test(
 ) {
 	struct test_s s;
 
-	searchkey_prepare_test(db, key, &s.skey, true);
+	/* don't drop expired items: testing doesn't modify the database */
+	searchkey_prepare_test(db, key, &s.skey, false);
 
 	s.db = db;
+	s.ordered = db->itf.lookup != NULL;
 	s.now = time(NULL);
 	s.score = 0;
-	db->itf.apply(db->clodb, test_cb, &s);
+	lookup(db, &s.skey, test_cb, &s);
 	if (s.score) {
 		value->value = string(db, s.value.value);
 		value->expire = s.value.expire;
@@ -640,7 +839,6 @@ anydb_test(
 struct empty_s
 {
 	bool empty;
-	time_t now;
 };
 
 /* callback for computing if empty */
@@ -653,10 +851,6 @@ is_empty_cb(
 ) {
 	struct empty_s *s = closure;
 
-	/* drop expired items */
-	if (expired(value->expire, s->now))
-		return Anydb_Action_Remove_And_Continue;
-
 	s->empty = false;
 	return Anydb_Action_Stop;
 }
@@ -668,8 +862,8 @@ anydb_is_empty(
 ) {
 	struct empty_s s;
 
+	drop_expired(db, time(NULL));
 	s.empty = true;
-	s.now = time(NULL);
 	db->itf.apply(db->clodb, is_empty_cb, &s);
 	return s.empty;
 }
@@ -680,30 +874,24 @@ anydb_is_empty(
 /******************************************************************************/
 /******************************************************************************/
 
-/* cleanup callback */
-static
-anydb_action_t
-cleanup_cb(
-	void *closure,
-	const anydb_key_t *key,
-	anydb_value_t *value
-) {
-	return expired(value->expire, *(time_t*)closure)
-		? Anydb_Action_Remove_And_Continue : Anydb_Action_Continue;
-}
-
 /* see anydb.h */
 void
 anydb_cleanup(
 	anydb_t *db
 ) {
-	time_t t;
-
-	t = time(NULL);
-	db->itf.apply(db->clodb, cleanup_cb, &t);
+	drop_expired(db, time(NULL));
 	db->itf.gc(db->clodb);
 }
 
+/* see anydb.h */
+time_t
+anydb_expire(
+	anydb_t *db
+) {
+	drop_expired(db, time(NULL));
+	return db->next_expire > 0 ? db->next_expire : 0;
+}
+
 /******************************************************************************/
 /******************************************************************************/
 /*** SYNCHRONIZE                                                            ***/
@@ -718,6 +906,93 @@ anydb_sync(
 	return db->itf.sync ? db->itf.sync(db->clodb) : 0;
 }
 
+/* see anydb.h */
+bool
+anydb_has_flush(
+	anydb_t *db
+) {
+	return db->itf.flush != NULL;
+}
+
+/* see anydb.h */
+int
+anydb_flush(
+	anydb_t *db
+) {
+	return db->itf.flush ? db->itf.flush(db->clodb) : 0;
+}
+
+/******************************************************************************/
+/******************************************************************************/
+/*** COPY                                                                   ***/
+/******************************************************************************/
+/******************************************************************************/
+
+/* structure for copying items */
+struct copy_s
+{
+	anydb_t *from;        /* copied database */
+	anydb_t *to;          /* receiving database */
+	time_t now;           /* the current time */
+	int rc;               /* the status */
+};
+
+/* callback for copying items */
+static
+anydb_action_t
+copy_cb(
+	void *closure,
+	const anydb_key_t *key,
+	anydb_value_t *value
+) {
+	struct copy_s *s = closure;
+	anydb_key_t k;
+	anydb_value_t v;
+	int rc;
+
+	/* expired items are not copied */
+	if (is_expired(value->expire, s->now))
+		return Anydb_Action_Continue;
+
+	/* translate the indexes */
+	rc = idx(s->to, &k.client, string(s->from, key->client), true);
+	if (!rc)
+		rc = idx(s->to, &k.session, string(s->from, key->session), true);
+	if (!rc)
+		rc = idx(s->to, &k.user, string(s->from, key->user), true);
+	if (!rc)
+		rc = idx_perm(s->to, &k.permission, string(s->from, key->permission), true);
+	if (!rc)
+		rc = idx(s->to, &v.value, string(s->from, value->value), true);
+
+	/* add the item */
+	if (!rc) {
+		v.expire = value->expire;
+		rc = s->to->itf.add(s->to->clodb, &k, &v);
+	}
+	if (!rc)
+		return Anydb_Action_Continue;
+	s->rc = rc;
+	return Anydb_Action_Stop;
+}
+
+/* see anydb.h */
+int
+anydb_copy(
+	anydb_t *to,
+	anydb_t *from
+) {
+	struct copy_s s;
+
+	/* don't drop expired items: copying doesn't modify the database */
+	s.from = from;
+	s.to = to;
+	s.now = time(NULL);
+	s.rc = 0;
+	from->itf.apply(from->clodb, copy_cb, &s);
+	return s.rc;
+}
+
 /******************************************************************************/
 /******************************************************************************/
 /*** DESTROY                                                                ***/
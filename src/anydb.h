@@ -160,6 +160,18 @@ struct anydb_itf
 	 */
 	int (*index)(void *clodb, anydb_idx_t *idx, const char *name, bool create);
 
+	/**
+	 * Get the index of the permission 'name' in 'idx'. Permissions are
+	 * compared ignoring case, so all the permissions that only differ
+	 * by case have the same index. If the permission is found then its
+	 * index is returned. If the permission is not found, the database
+	 * backend has to create it if 'create' is not zero.
+	 * 'clodb' is the database's closure.
+	 * Returns 0 in case of success (*idx filled with the index)
+	 * or return a negative error code in -errno like form.
+	 */
+	int (*index_permission)(void *clodb, anydb_idx_t *idx, const char *name, bool create);
+
 	/**
 	 * Get the string for the index 'idx'. idx MUST be valid.
 	 * 'clodb' is the database's closure.
@@ -183,6 +195,18 @@ struct anydb_itf
 	 */
 	void (*apply)(void *clodb, anydb_applycb_t *oper, void *closure);
 
+	/**
+	 * Optional method for iterating only over the database items that
+	 * can match the searched 'key' and apply the operator 'oper' as
+	 * 'apply' does. The iterated items are the items whose fields are
+	 * either equal to the ones of 'key' or WIDE, from the most specific
+	 * to the least specific: less WIDE fields first and, for a same
+	 * count, WIDE permission, client, user and session in that order.
+	 * When not set, 'apply' is used instead.
+	 * 'clodb' is the database's closure.
+	 */
+	void (*lookup)(void *clodb, const anydb_key_t *key, anydb_applycb_t *oper, void *closure);
+
 	/**
 	 * Add the item of 'key' and 'value'.
 	 * 'clodb' is the database's closure.
@@ -205,6 +229,15 @@ struct anydb_itf
 	 */
 	int (*sync)(void *clodb);
 
+	/**
+	 * Flush to the disk the synchronized changes of the database, making
+	 * them durable. Optional: when not set, synchronizing is durable.
+	 * 'clodb' is the database's closure.
+	 * Returns 0 in case of success or return a negative error code
+	 * in -errno like form.
+	 */
+	int (*flush)(void *clodb);
+
 	/**
 	 * Destroys the database
 	 * 'clodb' is the database's closure.
@@ -223,6 +256,9 @@ struct anydb
 
 	/** the implementation methods */
 	anydb_itf_t itf;
+
+	/** time of the next expiration of an item, 0 if unknown, -1 if none */
+	time_t next_expire;
 };
 typedef struct anydb anydb_t;
 
@@ -270,6 +306,21 @@ anydb_drop(
 	const data_key_t *key
 );
 
+/**
+ * Drop any rule that matches one of the keys, in one pass
+ * @param db database to modify
+ * @param keys the keys that select items to be dropped
+ * @param count count of keys
+ * @return 0 on success or a negative error code
+ */
+extern
+int
+anydb_drop_batch(
+	anydb_t *db,
+	const data_key_t *keys,
+	unsigned count
+);
+
 /**
  * Set the rule described by key and value
  * @param db the database to set
@@ -287,6 +338,8 @@ anydb_set(
 
 /**
  * Test a rule and return its score and the value
+ * Testing doesn't modify the database, so it can be done by many
+ * threads at once if no other operation is running.
  * @param db the database
  * @param key key to be matched by rules
  * @param value value found for the key, filled only if a key matched
@@ -311,6 +364,17 @@ anydb_cleanup(
 	anydb_t *db
 );
 
+/**
+ * Drop the expired rules and get the time of the next expiration
+ * @param db the database to clean
+ * @return the time of the next expiration of a rule or 0 if none
+ */
+extern
+time_t
+anydb_expire(
+	anydb_t *db
+);
+
 /**
  * Is the database empty?
  * @param db the database to test
@@ -333,6 +397,45 @@ anydb_sync(
 	anydb_t *db
 );
 
+/**
+ * Tells if the synchronization of the database requires a flush for
+ * being durable
+ * @param db the database
+ * @return true if flushing is required
+ */
+extern
+bool
+anydb_has_flush(
+	anydb_t *db
+);
+
+/**
+ * Flush the synchronized changes of the database to make them durable
+ * @param db the database to flush
+ * @return 0 on success or a negative -errno like code
+ */
+extern
+int
+anydb_flush(
+	anydb_t *db
+);
+
+/**
+ * Copy the items of a database to an other database. The items of 'from'
+ * are added to the items of 'to' that must not contain the same keys.
+ * Copying doesn't modify the copied database, so it can be done by many
+ * threads at once if no other operation is running.
+ * @param to the database receiving the copy
+ * @param from the database to copy
+ * @return 0 on success or a negative -errno like code
+ */
+extern
+int
+anydb_copy(
+	anydb_t *to,
+	anydb_t *from
+);
+
 /**
  * Destroy the database
  * @param db the database to destroy
@@ -32,144 +32,258 @@
 #include "cynagora.h"
 #include "cache.h"
 
+/** index meaning no item */
+#define NONE              UINT32_MAX
+
+/** expected mean size in bytes of an item, its node and its strings */
+#define ITEM_MEAN_SIZE    96
+
+/** minimal count of nodes */
+#define MIN_NODES         4
+
+/** size of the header of blocks of strings: index of node and length */
+#define BLOCK_HEAD_SIZE   6
+
 /**
- * A cache item header
+ * A cache item node
  *
- * Each item is followed by values in that given order:
+ * The strings of the key of the item are in a block of the arena that
+ * contains, in that given order:
+ *  - the index of the node, NONE if the block is dropped (4 bytes)
+ *  - the length of the strings (2 bytes)
  *  - client: zero  terminated string
  *  - session: zero  terminated string
  *  - user: zero  terminated string
  *  - permission: zero  terminated string
- *  -
  */
-struct item
+struct node
 {
+	/** hash of the key */
+	uint32_t hash;
+
+	/** next node of the bucket or of the free list */
+	uint32_t next;
+
+	/** more recently used node */
+	uint32_t prev;
+
+	/** less recently used node */
+	uint32_t succ;
+
 	/** expiration */
 	time_t expire;
 
-	/** length of the cache entry including this header */
-	uint16_t length;
+	/** offset of the block of strings in the arena */
+	uint32_t offset;
 
-	/** hit indicator */
-	uint8_t hit;
+	/** length of the strings */
+	uint16_t length;
 
 	/** value to store */
 	int8_t value;
-
-	/** fake ending character */
-	char strings[];
 };
-typedef struct item item_t;
+typedef struct node node_t;
 
 /**
- * The cache structure is a blob of memory ('content')
- * of 'count' bytes of only 'used' bytes.
- * That blob contains at sequence of records of variable length
+ * The cache structure is a blob of memory ('content') holding
+ * the slab of 'nnodes' nodes, the 'nbuckets' heads of hashed
+ * lists of nodes and the arena of 'asize' bytes for the strings.
  */
 struct cache
 {
 	/** used for clearing */
 	uint32_t cacheid;
 
-	/** count of bytes used */
-	uint32_t used;
+	/** count of nodes */
+	uint32_t nnodes;
+
+	/** count of buckets, a power of 2 */
+	uint32_t nbuckets;
+
+	/** count of bytes of the arena */
+	uint32_t asize;
+
+	/** count of nodes used at least once since last clear */
+	uint32_t fresh;
+
+	/** head of the list of free nodes */
+	uint32_t free;
 
-	/** count of bytes allocated */
+	/** count of items */
 	uint32_t count;
 
+	/** most recently used node */
+	uint32_t mru;
+
+	/** least recently used node */
+	uint32_t lru;
+
+	/** count of bytes used in the arena */
+	uint32_t top;
+
+	/** count of bytes of dropped blocks in the arena */
+	uint32_t garbage;
+
+	/** the nodes */
+	node_t *nodes;
+
+	/** the buckets */
+	uint32_t *buckets;
+
+	/** the arena */
+	char *arena;
+
 	/** content of the cache */
-	uint8_t content[];
+	alignas(node_t) char content[];
 };
 
 /**
- * return the item at a given position
+ * Compute the hash of the key, the permission being case independant
+ * @param key the key
+ * @return the hash
+ */
+static
+uint32_t
+hashkey(
+	const cynagora_key_t *key
+) {
+	const unsigned char *s;
+	uint32_t h = 2166136261u;
+
+	for (s = (const unsigned char*)key->client ; *s ; s++)
+		h = (h ^ *s) * 16777619u;
+	h = (h ^ 1) * 16777619u;
+	for (s = (const unsigned char*)key->session ; *s ; s++)
+		h = (h ^ *s) * 16777619u;
+	h = (h ^ 2) * 16777619u;
+	for (s = (const unsigned char*)key->user ; *s ; s++)
+		h = (h ^ *s) * 16777619u;
+	h = (h ^ 3) * 16777619u;
+	for (s = (const unsigned char*)key->permission ; *s ; s++)
+		h = (h ^ (unsigned)toupper(*s)) * 16777619u;
+	return h ^ (h >> 16);
+}
+
+/**
+ * return the strings of the node at index
  * @param cache the cache
- * @param pos the position of the item
- * @return the item
+ * @param index index of the node
+ * @return the strings of the node
  */
 static
 inline
-item_t *
-itemat(
+char *
+stringsof(
 	cache_t *cache,
-	uint32_t pos
+	uint32_t index
 ) {
-	return (item_t*)(&cache->content[pos]);
+	return &cache->arena[cache->nodes[index].offset + BLOCK_HEAD_SIZE];
 }
 
 /**
- * Removes the item at position pos
+ * Remove the node of index from the list of the most recently used
  * @param cache the cache
- * @param pos the position of the item to remove
+ * @param index index of the node
  */
 static
 void
-drop_at(
+lru_unlink(
 	cache_t *cache,
-	uint32_t pos
+	uint32_t index
 ) {
-	uint32_t e, l;
-
-	l = itemat(cache, pos)->length;
-	e = pos + l;
-	cache->used -= l;
-	if (cache->used > pos)
-		memmove(&cache->content[pos], &cache->content[e], cache->used - pos);
+	node_t *node = &cache->nodes[index];
+
+	if (node->prev == NONE)
+		cache->mru = node->succ;
+	else
+		cache->nodes[node->prev].succ = node->succ;
+	if (node->succ == NONE)
+		cache->lru = node->prev;
+	else
+		cache->nodes[node->succ].prev = node->prev;
 }
 
 /**
- * Removes the oldest hit target
+ * Add the node of index as the most recently used
  * @param cache the cache
+ * @param index index of the node
  */
 static
 void
-drop_lre(
-	cache_t *cache
+lru_push(
+	cache_t *cache,
+	uint32_t index
 ) {
-	uint32_t found = 0, iter = 0;
-	uint8_t hmin = 255, hit;
-	item_t *item;
-
-	while (iter < cache->used) {
-		item = itemat(cache, iter);
-		hit = item->hit;
-		if (hit <= hmin) {
-			found = iter;
-			hmin = hit;
-		}
-		iter += item->length;
-	}
-	if (found < cache->used)
-		drop_at(cache, found);
+	node_t *node = &cache->nodes[index];
+
+	node->prev = NONE;
+	node->succ = cache->mru;
+	if (cache->mru == NONE)
+		cache->lru = index;
+	else
+		cache->nodes[cache->mru].prev = index;
+	cache->mru = index;
 }
 
 /**
- * tells the target is used
+ * Removes the item of index
  * @param cache the cache
- * @param target the target to hit
+ * @param index index of the node of the item to remove
  */
 static
 void
-hit(
+drop(
 	cache_t *cache,
-	item_t *target
+	uint32_t index
 ) {
-	uint32_t iter = 0;
-	uint8_t hit;
-	item_t *item;
-
-	while (iter < cache->used) {
-		item = itemat(cache, iter);
-		if (item == target)
-			hit = 255;
-		else {
-			hit = item->hit;
-			if (hit)
-				hit--;
+	static const uint32_t none = NONE;
+	node_t *node = &cache->nodes[index];
+	uint32_t *ref;
+
+	/* unlink from its bucket */
+	ref = &cache->buckets[node->hash & (cache->nbuckets - 1)];
+	while (*ref != index)
+		ref = &cache->nodes[*ref].next;
+	*ref = node->next;
+
+	/* unlink from recently used */
+	lru_unlink(cache, index);
+
+	/* release its strings and its node */
+	memcpy(&cache->arena[node->offset], &none, sizeof none);
+	cache->garbage += BLOCK_HEAD_SIZE + (uint32_t)node->length;
+	node->next = cache->free;
+	cache->free = index;
+	cache->count--;
+}
+
+/**
+ * Compact the arena by removing the blocks of dropped items
+ * @param cache the cache
+ */
+static
+void
+compact(
+	cache_t *cache
+) {
+	uint32_t pos, dst, index, size;
+	uint16_t length;
+
+	pos = dst = 0;
+	while (pos < cache->top) {
+		memcpy(&index, &cache->arena[pos], sizeof index);
+		memcpy(&length, &cache->arena[pos + sizeof index], sizeof length);
+		size = BLOCK_HEAD_SIZE + (uint32_t)length;
+		if (index != NONE) {
+			if (dst != pos)
+				memmove(&cache->arena[dst], &cache->arena[pos], size);
+			cache->nodes[index].offset = dst;
+			dst += size;
 		}
-		item->hit = hit;
-		iter += item->length;
+		pos += size;
 	}
+	cache->top = dst;
+	cache->garbage = 0;
 }
 
 /**
@@ -241,35 +355,53 @@ match(
 }
 
 /**
- * Search the item matching key and return it. Also remove expired entries
+ * Search the item matching key and return its index. Also remove it
+ * if it is expired.
  * @param cache the cache
  * @param key the key to search
- * @return the found item or NULL if not found
+ * @param hash the hash of the key
+ * @return the index of the found item or NONE if not found
  */
 static
-item_t*
+uint32_t
 search(
 	cache_t *cache,
-	const cynagora_key_t *key
+	const cynagora_key_t *key,
+	uint32_t hash
 ) {
-	time_t now;
-	item_t *item, *found;
-	uint32_t iter;
-
-	found = NULL;
-	now = time(NULL);
-	iter = 0;
-	while (iter < cache->used) {
-		item = itemat(cache, iter);
-		if (item->expire && item->expire < now)
-			drop_at(cache, iter);
-		else {
-			if (match(item->strings, key))
-				found = item;
-			iter += item->length;
+	uint32_t index;
+	node_t *node;
+
+	index = cache->buckets[hash & (cache->nbuckets - 1)];
+	while (index != NONE) {
+		node = &cache->nodes[index];
+		if (node->hash == hash && match(stringsof(cache, index), key)) {
+			if (node->expire && node->expire < time(NULL)) {
+				drop(cache, index);
+				index = NONE;
+			}
+			break;
 		}
+		index = node->next;
 	}
-	return found;
+	return index;
+}
+
+/**
+ * Reset the cache to its empty state
+ * @param cache the cache
+ */
+static
+void
+reset(
+	cache_t *cache
+) {
+	cache->fresh = 0;
+	cache->free = NONE;
+	cache->count = 0;
+	cache->mru = cache->lru = NONE;
+	cache->top = cache->garbage = 0;
+	memset(cache->buckets, 0xff, cache->nbuckets * sizeof *cache->buckets);
 }
 
 /* see cache.h */
@@ -280,37 +412,68 @@ cache_put(cache_t *cache,
 	time_t expire,
 	bool absolute
 ) {
-	uint16_t length;
-	item_t *item;
-	size_t size;
+	uint32_t index, hash, size;
+	node_t *node;
+	size_t length;
+	uint16_t len;
+	char *strings;
 
 	if (cache == NULL || value < -128 || value > 127 || expire < 0)
 		return -EINVAL;
 
-	item = search(cache, key);
-	if (item == NULL) {
+	hash = hashkey(key);
+	index = search(cache, key, hash);
+	if (index != NONE)
+		lru_unlink(cache, index);
+	else {
 		/* create an item */
-		size = sizeof *item
-			+ strlen(key->client)
+		length = strlen(key->client)
 			+ strlen(key->session)
 			+ strlen(key->user)
-			+ strlen(key->permission);
-		size = (size + alignof(item_t) - 1) & ~(alignof(item_t) - 1);
-		if (size > 65535)
+			+ strlen(key->permission)
+			+ 4;
+		if (length > 65535)
 			return -EINVAL;
-		length = (uint16_t)size;
-		if (length > cache->count)
+		size = BLOCK_HEAD_SIZE + (uint32_t)length;
+		if (size > cache->asize)
 			return -ENOMEM;
-		while(cache->used + length > cache->count)
-			drop_lre(cache);
-		item = itemat(cache, cache->used);
-		item->length = length;
-		stpcpy(1 + stpcpy(1 + stpcpy(1 + stpcpy(item->strings, key->client), key->session), key->user), key->permission);
-		cache->used += (uint32_t)size;
+
+		/* get a node, dropping the least recently used if needed */
+		if (cache->free == NONE && cache->fresh < cache->nnodes)
+			index = cache->fresh++;
+		else {
+			if (cache->free == NONE)
+				drop(cache, cache->lru);
+			index = cache->free;
+			cache->free = cache->nodes[index].next;
+		}
+
+		/* get room for strings, dropping the least recently used if needed */
+		while (cache->top + size > cache->asize) {
+			if (cache->top + size - cache->garbage <= cache->asize)
+				compact(cache);
+			else
+				drop(cache, cache->lru);
+		}
+
+		/* init the item */
+		node = &cache->nodes[index];
+		node->hash = hash;
+		node->offset = cache->top;
+		node->length = len = (uint16_t)length;
+		memcpy(&cache->arena[cache->top], &index, sizeof index);
+		memcpy(&cache->arena[cache->top + sizeof index], &len, sizeof len);
+		strings = &cache->arena[cache->top + BLOCK_HEAD_SIZE];
+		stpcpy(1 + stpcpy(1 + stpcpy(1 + stpcpy(strings, key->client), key->session), key->user), key->permission);
+		cache->top += size;
+		node->next = cache->buckets[hash & (cache->nbuckets - 1)];
+		cache->buckets[hash & (cache->nbuckets - 1)] = index;
+		cache->count++;
 	}
-	item->expire = !expire ? 0 : absolute ? expire : expire + time(NULL);
-	item->hit = 255;
-	item->value = (int8_t)value;
+	node = &cache->nodes[index];
+	node->expire = !expire ? 0 : absolute ? expire : expire + time(NULL);
+	node->value = (int8_t)value;
+	lru_push(cache, index);
 	return 0;
 }
 
@@ -320,13 +483,14 @@ cache_search(
 	cache_t *cache,
 	const cynagora_key_t *key
 ) {
-	item_t *item;
+	uint32_t index;
 
 	if (cache) {
-		item = search(cache, key);
-		if (item) {
-			hit(cache, item);
-			return (int)item->value;
+		index = search(cache, key, hashkey(key));
+		if (index != NONE) {
+			lru_unlink(cache, index);
+			lru_push(cache, index);
+			return (int)cache->nodes[index].value;
 		}
 	}
 	return -ENOENT;
@@ -340,7 +504,7 @@ cache_clear(
 ) {
 	if (cache && (cache->cacheid != cacheid || !cacheid)) {
 		cache->cacheid = cacheid;
-		cache->used = 0;
+		reset(cache);
 	}
 }
 
@@ -351,28 +515,51 @@ cache_resize(
 	uint32_t newsize
 ) {
 	cache_t *oldcache = *cache, *newcache;
+	uint32_t nnodes, nbuckets, index;
+	size_t size;
+	cynagora_key_t key;
+	node_t *node;
 
 	if (newsize == 0) {
 		/* erase all */
 		free(oldcache);
 		newcache = NULL;
 	} else {
-		/* coerce cache values if downsizing */
-		if (oldcache) {
-			while (oldcache->used > newsize)
-				drop_lre(oldcache);
-		}
-
-		/* reallocate the cache */
-		newcache = realloc(oldcache, newsize + sizeof *oldcache);
+		/* compute the layout */
+		nnodes = newsize / ITEM_MEAN_SIZE;
+		if (nnodes < MIN_NODES)
+			nnodes = MIN_NODES;
+		nbuckets = MIN_NODES;
+		while (nbuckets < nnodes)
+			nbuckets <<= 1;
+		size = nnodes * sizeof(node_t) + nbuckets * sizeof(uint32_t);
+
+		/* allocate the new cache */
+		newcache = malloc(sizeof *newcache + (newsize > size ? newsize : size));
 		if (newcache == NULL)
 			return -ENOMEM;
-
-		/* init */
-		newcache->count = newsize;
-		if (!oldcache) {
+		newcache->nnodes = nnodes;
+		newcache->nbuckets = nbuckets;
+		newcache->asize = newsize > size ? newsize - (uint32_t)size : 0;
+		newcache->nodes = (node_t*)newcache->content;
+		newcache->buckets = (uint32_t*)&newcache->nodes[nnodes];
+		newcache->arena = (char*)&newcache->buckets[nbuckets];
+		reset(newcache);
+
+		/* transfer the items, the least recently used first */
+		if (!oldcache)
 			newcache->cacheid = 0;
-			newcache->used = 0;
+		else {
+			newcache->cacheid = oldcache->cacheid;
+			for (index = oldcache->lru ; index != NONE ; index = node->prev) {
+				node = &oldcache->nodes[index];
+				key.client = stringsof(oldcache, index);
+				key.session = &key.client[1 + strlen(key.client)];
+				key.user = &key.session[1 + strlen(key.session)];
+				key.permission = &key.user[1 + strlen(key.user)];
+				cache_put(newcache, &key, node->value, node->expire, true);
+			}
+			free(oldcache);
 		}
 	}
 	/* update cache */
@@ -399,25 +586,26 @@ cache_iterate(
 ) {
 	cynagora_key_t key;
 	time_t now, rem;
-	item_t *item;
-	uint32_t iter;
-	int action;
+	node_t *node;
+	uint32_t index, next;
+	int action, hit;
 
 	now = time(NULL);
-	iter = 0;
-	while (iter < cache->used) {
-		item = itemat(cache, iter);
-		key.client = item->strings;
+	hit = 255;
+	for (index = cache->mru ; index != NONE ; index = next) {
+		node = &cache->nodes[index];
+		next = node->succ;
+		key.client = stringsof(cache, index);
 		key.session = &key.client[1 + strlen(key.client)];
 		key.user = &key.session[1 + strlen(key.session)];
 		key.permission = &key.user[1 + strlen(key.user)];
-		rem = item->expire ? item->expire - now : -1;
-		action = callback(closure, &key, item->value, rem, item->hit);
-		if ((item->expire && item->expire < now) || (action & CACHE_ITER_DROP))
-			drop_at(cache, iter);
-		else
-			iter += item->length;
+		rem = node->expire ? node->expire - now : -1;
+		action = callback(closure, &key, node->value, rem, hit);
+		if ((node->expire && node->expire < now) || (action & CACHE_ITER_DROP))
+			drop(cache, index);
 		if (action & CACHE_ITER_STOP)
 			break;
+		if (hit)
+			hit--;
 	}
 }
@@ -29,6 +29,7 @@ const char
 	_agent_[] = "agent",
 	_ask_[] = "ask",
 	_check_[] = "check",
+	_checkm_[] = "checkm",
 	_clearall_[] = "clearall",
 	_clear_[] = "clear",
 	_commit_[] = "commit",
@@ -47,6 +48,8 @@ const char
 	_reply_[] = "reply",
 	_rollback_[] = "rollback",
 	_set_[] = "set",
+	_shared_[] = "shared",
+	_stats_[] = "stats",
 	_sub_[] = "sub",
 	_test_[] = "test",
 	_yes_[] = "yes";
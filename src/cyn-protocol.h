@@ -21,12 +21,16 @@
 /******************************************************************************/
 /******************************************************************************/
 
+/* maximal count of permissions of the message checkm */
+#define CHECKM_MAX_PERMISSIONS 15
+
 /* predefined protocol strings */
 extern const char
 	_ack_[],
 	_agent_[],
 	_ask_[],
 	_check_[],
+	_checkm_[],
 	_clearall_[],
 	_clear_[],
 	_commit_[],
@@ -45,6 +49,8 @@ extern const char
 	_reply_[],
 	_rollback_[],
 	_set_[],
+	_shared_[],
+	_stats_[],
 	_sub_[],
 	_test_[],
 	_yes_[];
@@ -30,9 +30,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <poll.h>
 #include <limits.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -46,18 +49,71 @@
 #include "pollitem.h"
 #include "expire.h"
 #include "idgen.h"
+#include "shcache.h"
 
 typedef struct client client_t;
 typedef struct agent agent_t;
 typedef struct ask ask_t;
 typedef struct check check_t;
+typedef struct batch batch_t;
+typedef struct forward forward_t;
+typedef struct worker worker_t;
+typedef struct reply reply_t;
 
 #define MAX_PUTX_ITEMS 15
 
+/** delay in milliseconds for grouping the flushes of commits */
+#define GROUP_COMMIT_DELAY 3
+
 /** should log? */
 bool
 cyn_server_log = 0;
 
+/** count of threads serving check clients */
+unsigned
+cyn_server_workers = 0;
+
+/** size of queued replies above which requests of a client aren't read */
+size_t
+cyn_server_high_water = 65536;
+
+/** should share a cache with the check clients? */
+bool
+cyn_server_shared_cache = 0;
+
+/** the cache shared with the check clients or NULL */
+static
+shcache_t *shcache = NULL;
+
+/** clients waiting flush of their commits */
+static
+client_t *committers = NULL;
+
+/** monotonic time in milliseconds when the waiting commits are flushed */
+static
+int64_t committers_deadline;
+
+/** destroyed clients, freed after the dispatch of the events */
+static
+client_t *zombies = NULL;
+
+/** clients whose output is flushed after the dispatch of the events */
+static
+client_t *flushes = NULL;
+
+/** statistics of the dispatch of events, updated atomically by all threads */
+static
+struct {
+	/** count of waits having events */
+	unsigned long waits;
+
+	/** count of dispatched events */
+	unsigned long events;
+
+	/** greatest count of events dispatched by one wait */
+	int max_batch;
+} stats;
+
 /** local enumeration of socket/client kind */
 typedef enum server_type {
 	server_Check,
@@ -92,9 +148,51 @@ struct client
 	/** indicate if some caching were made by the client */
 	unsigned caching: 1;
 
+	/** indicate if the client was given the shared cache */
+	unsigned sharing: 1;
+
+	/** enter/leave status, record if commit is waiting to be flushed */
+	unsigned committing: 1;
+
+	/** is the output to be flushed at end of the iteration */
+	unsigned flushing: 1;
+
+	/** are requests not read because of too much queued replies */
+	unsigned throttled: 1;
+
 	/** polling callback */
 	pollitem_t pollitem;
 
+	/** the pollfd polling the client */
+	int pollfd;
+
+	/** the events currently polled */
+	uint32_t events;
+
+	/** replies waiting room in the output buffer */
+	reply_t *outq;
+
+	/** tail of the list of waiting replies */
+	reply_t **outq_tail;
+
+	/** size of the waiting replies */
+	size_t outq_size;
+
+	/** the worker serving the client or NULL when served by main thread */
+	worker_t *worker;
+
+	/** next client of the same worker */
+	client_t *next_client;
+
+	/** next client waiting flush of its commit */
+	client_t *next_committer;
+
+	/** next destroyed client waiting to be freed */
+	client_t *next_zombie;
+
+	/** next client whose output is to be flushed */
+	client_t *next_flush;
+
 	/** list of pending ask */
 	ask_t *asks;
 
@@ -130,10 +228,125 @@ struct check
 	/** is check? otherwise it is test */
 	bool ischeck;
 
+	/** the batch of the check if any */
+	batch_t *batch;
+
+	/** index of the check in its batch */
+	unsigned index;
+
 	/** id */
 	char id[];
 };
 
+/** structure for pending batches of checks (checkm) */
+struct batch
+{
+	/** the check of the batch, recorded in the client */
+	check_t *check;
+
+	/** count of checks */
+	unsigned count;
+
+	/** count of pending checks, plus one while initiating */
+	unsigned pending;
+
+	/** results of the checks */
+	char results[][40];
+};
+
+/** structure for replies waiting room in the output buffer */
+struct reply
+{
+	/** next waiting reply */
+	reply_t *next;
+
+	/** size of the fields */
+	size_t size;
+
+	/** count of fields */
+	unsigned count;
+
+	/** the fields, their strings follow */
+	const char *fields[];
+};
+
+/** structure for checks requiring agents, forwarded to the main thread */
+struct forward
+{
+	/** next forwarded check */
+	forward_t *next;
+
+	/** the forwarded check */
+	check_t *check;
+
+	/** the worker that forwarded the check, NULL when stopped */
+	worker_t *worker;
+
+	/** next check pending in the main thread */
+	forward_t *next_pending;
+
+	/** pointer referencing the check in the list of pending checks */
+	forward_t **prv_pending;
+
+	/** the key of the check, its strings are in text */
+	data_key_t key;
+
+	/** the resulting value, allocated, NULL on error */
+	char *value;
+
+	/** the resulting expiration */
+	time_t expire;
+
+	/** strings of the key */
+	char text[];
+};
+
+/** structure for threads serving check clients */
+struct worker
+{
+	/** the server */
+	cyn_server_t *server;
+
+	/** the thread */
+	pthread_t thread;
+
+	/** the pollfd of the worker */
+	int pollfd;
+
+	/** the check socket as polled by the worker */
+	pollitem_t check;
+
+	/** event for waking up the worker */
+	pollitem_t wakeup;
+
+	/** clients served by the worker */
+	client_t *clients;
+
+	/** destroyed clients of the worker */
+	client_t *zombies;
+
+	/** clients of the worker whose output is to be flushed */
+	client_t *flushes;
+
+	/** changeid known by the clients of the worker */
+	uint32_t changeid;
+
+	/** is stopped? */
+	bool stopped;
+
+	/** mutex protecting the fields below, set by the main thread */
+	pthread_mutex_t mutex;
+
+	/** checks resolved by the main thread */
+	forward_t *resolved;
+
+	/** current changeid */
+	uint32_t next_changeid;
+
+	/** stop request */
+	bool stopping;
+};
+
 /** structure for servers */
 struct cyn_server
 {
@@ -151,6 +364,30 @@ struct cyn_server
 
 	/** the check socket */
 	pollitem_t check;
+
+	/** the timer of expiration of rules */
+	pollitem_t expire;
+
+	/** time of the next expiration armed in the timer, 0 if none */
+	time_t expire_armed;
+
+	/** event for checks forwarded by the workers */
+	pollitem_t forward;
+
+	/** count of workers */
+	unsigned nworkers;
+
+	/** the workers */
+	worker_t *workers;
+
+	/** mutex protecting forwards */
+	pthread_mutex_t mutex;
+
+	/** checks forwarded by the workers */
+	forward_t *forwards;
+
+	/** forwarded checks pending in the main thread */
+	forward_t *pending;
 };
 
 /**
@@ -199,7 +436,120 @@ ckarg(
 }
 
 /**
- * Flush the write buffer
+ * Update the events polled for the client: input is polled if requests
+ * can be processed and output is polled if replies are waiting.
+ * The client is throttled when the size of the waiting replies exceeds
+ * the high water mark and until it falls under its half.
+ * @param cli the client
+ */
+static
+void
+update_events(
+	client_t *cli
+) {
+	uint32_t events;
+
+	if (cli->throttled)
+		cli->throttled = cli->outq_size > cyn_server_high_water / 2;
+	else
+		cli->throttled = cli->outq_size > cyn_server_high_water;
+
+	events = cli->committing || cli->throttled ? 0 : EPOLLIN;
+	if (cli->outq || prot_should_write(cli->prot))
+		events |= EPOLLOUT;
+	if (events != cli->events) {
+		cli->events = events;
+		pollitem_mod(&cli->pollitem, events, cli->pollfd);
+	}
+}
+
+/**
+ * Queue a reply that doesn't fit in the output buffer
+ * @param cli the client
+ * @param count count of fields
+ * @param fields the fields of the reply
+ * @return 0 on success or -ENOMEM
+ */
+static
+int
+queue_reply(
+	client_t *cli,
+	unsigned count,
+	const char *fields[]
+) {
+	reply_t *reply;
+	size_t size;
+	unsigned i;
+	char *ptr;
+
+	size = 0;
+	for (i = 0 ; i < count ; i++)
+		size += 1 + strlen(fields[i]);
+	reply = malloc(sizeof *reply + count * sizeof *fields + size);
+	if (!reply)
+		return -ENOMEM;
+	reply->next = NULL;
+	reply->size = size;
+	reply->count = count;
+	ptr = (char*)&reply->fields[count];
+	for (i = 0 ; i < count ; i++) {
+		reply->fields[i] = ptr;
+		ptr = stpcpy(ptr, fields[i]) + 1;
+	}
+	*cli->outq_tail = reply;
+	cli->outq_tail = &reply->next;
+	cli->outq_size += size;
+	return 0;
+}
+
+/**
+ * Disconnect the client because its reply of 'count' 'fields' can't
+ * be sent, so that it doesn't wait for it forever
+ * @param cli the client
+ * @param count count of fields of the reply
+ * @param fields the fields of the reply
+ */
+static
+void
+unsendable(
+	client_t *cli,
+	unsigned count,
+	const char *fields[]
+) {
+	fprintf(stderr, "can't send reply %s to client %p, disconnecting it\n",
+			count ? fields[0] : "", cli);
+	shutdown(cli->pollitem.fd, SHUT_RDWR);
+}
+
+/**
+ * Move the waiting replies to the output buffer while it has room
+ * @param cli the client
+ */
+static
+void
+unqueue_replies(
+	client_t *cli
+) {
+	reply_t *reply;
+
+	while ((reply = cli->outq) != NULL) {
+		if (prot_put(cli->prot, reply->count, reply->fields) < 0) {
+			if (prot_should_write(cli->prot))
+				break;
+			/* the reply is too big for an empty buffer */
+			unsendable(cli, reply->count, reply->fields);
+		}
+		cli->outq = reply->next;
+		cli->outq_size -= reply->size;
+		free(reply);
+	}
+	if (!cli->outq)
+		cli->outq_tail = &cli->outq;
+}
+
+/**
+ * Flush the write buffer without blocking, the remaining
+ * output is flushed when the client is ready
  */
 static
 int
@@ -207,26 +557,75 @@ flushw(
 	client_t *cli
 ) {
 	int rc;
-	struct pollfd pfd;
 
 	for(;;) {
+		unqueue_replies(cli);
 		rc = prot_should_write(cli->prot);
 		if (!rc)
 			break;
 		rc = prot_write(cli->prot, cli->pollitem.fd);
-		if (rc == -EAGAIN) {
-			pfd.fd = cli->pollitem.fd;
-			pfd.events = POLLOUT;
-			do { rc = poll(&pfd, 1, 0); } while (rc < 0 && errno == EINTR);
-			if (rc < 0)
-				rc = -errno;
-		}
 		if (rc < 0)
 			break;
 	}
+	update_events(cli);
 	return rc;
 }
 
+/**
+ * Record that the output of the client is to be flushed after the
+ * dispatch of the current events, so that the replies to all the
+ * requests received at once are written together
+ * @param cli the client
+ */
+static
+void
+flush_later(
+	client_t *cli
+) {
+	client_t **list;
+
+	if (!cli->flushing) {
+		list = cli->worker ? &cli->worker->flushes : &flushes;
+		cli->flushing = 1;
+		cli->next_flush = *list;
+		*list = cli;
+	}
+}
+
+/**
+ * Send the reply of 'n' 'fields' to client
+ */
+static
+int
+putv(
+	client_t *cli,
+	unsigned n,
+	const char *fields[]
+) {
+	int rc;
+
+	/* emit the log */
+	if (cyn_server_log)
+		dolog(cli, 0, n, fields);
+
+	/* send now or after the waiting replies */
+	if (!cli->outq) {
+		rc = prot_put(cli->prot, n, fields);
+		if (rc == -ECANCELED) {
+			flushw(cli);
+			rc = cli->outq ? -ECANCELED : prot_put(cli->prot, n, fields);
+		}
+		if (rc >= 0)
+			return rc;
+		/* queue it unless it can't fit an empty buffer */
+		if (rc != -ECANCELED || (!cli->outq && !prot_should_write(cli->prot))) {
+			unsendable(cli, n, fields);
+			return rc;
+		}
+	}
+	return queue_reply(cli, n, fields);
+}
+
 /**
  * Send a reply to client
  */
@@ -239,7 +638,6 @@ putx(
 	const char *p, *fields[MAX_PUTX_ITEMS];
 	unsigned n;
 	va_list l;
-	int rc;
 
 	/* store temporary in fields */
 	n = 0;
@@ -255,18 +653,7 @@ putx(
 	}
 	va_end(l);
 
-	/* emit the log */
-	if (cyn_server_log)
-		dolog(cli, 0, n, fields);
-
-	/* send now */
-	rc = prot_put(cli->prot, n, fields);
-	if (rc == -ECANCELED) {
-		rc = flushw(cli);
-		if (rc == 0)
-			rc = prot_put(cli->prot, n, fields);
-	}
-	return rc;
+	return putv(cli, n, fields);
 }
 
 /** emit a simple done reply and flush */
@@ -276,7 +663,7 @@ send_done(
 	client_t *cli
 ) {
 	putx(cli, _done_, NULL);
-	flushw(cli);
+	flush_later(cli);
 }
 
 /** emit a simple error reply and flush */
@@ -287,7 +674,7 @@ send_error(
 	const char *errorstr
 ) {
 	putx(cli, _error_, errorstr, NULL);
-	flushw(cli);
+	flush_later(cli);
 }
 
 /** emit a simple done/error reply */
@@ -303,6 +690,45 @@ send_done_or_error(
 		send_error(cli, NULL);
 }
 
+/**
+ * Get the monotonic time
+ * @return the monotonic time in milliseconds
+ */
+static
+int64_t
+now_ms(
+) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + (int64_t)(ts.tv_nsec / 1000000);
+}
+
+/**
+ * Record that the client waits the flush of its commit before
+ * receiving the reply. The first waiting client sets the deadline
+ * of the flush so that the commits of the next GROUP_COMMIT_DELAY
+ * milliseconds share the same flush.
+ * @param cli the client
+ */
+static
+void
+wait_flush(
+	client_t *cli
+) {
+	client_t **prv;
+
+	if (!committers)
+		committers_deadline = now_ms() + GROUP_COMMIT_DELAY;
+	prv = &committers;
+	while (*prv)
+		prv = &(*prv)->next_committer;
+	cli->next_committer = NULL;
+	cli->committing = 1;
+	*prv = cli;
+	update_events(cli);
+}
+
 /** callback of entering */
 static
 void
@@ -316,6 +742,25 @@ entercb(
 	send_done(cli);
 }
 
+/**
+ * Get the string of the changeid known by the client
+ * @param cli the client
+ * @param buffer a buffer for the string if needed
+ * @return the string of the changeid
+ */
+static
+const char *
+changeid_string(
+	client_t *cli,
+	char buffer[12]
+) {
+	/* only the main thread can use cyn */
+	if (!cli->worker)
+		return cyn_changeid_string();
+	snprintf(buffer, 12, "%u", cli->worker->changeid);
+	return buffer;
+}
+
 /** translate optional expire value */
 static
 const char *
@@ -353,6 +798,34 @@ exp2get(
 	return buffer;
 }
 
+/**
+ * Get the texts of the result of a check
+ * @param value the value of the check or NULL on error
+ * @param ischeck is it a check? otherwise it is a test
+ * @param etxt where to store the text of the expiration or NULL
+ * @param text a buffer for the text of the expiration
+ * @return the text of the status
+ */
+static
+const char *
+checkresult(
+	const data_value_t *value,
+	bool ischeck,
+	const char **etxt,
+	char text[30]
+) {
+	if (!value) {
+		*etxt = "-";
+		return _no_;
+	}
+	*etxt = exp2check(value->expire, text, 30);
+	if (!strcmp(value->value, ALLOW))
+		return _yes_;
+	if (!strcmp(value->value, DENY) || ischeck)
+		return _no_;
+	return _ack_;
+}
+
 /** callback of checking */
 static
 void
@@ -365,31 +838,22 @@ replycheck(
 	char text[30];
 	const char *etxt, *vtxt;
 
-	if (!value) {
-		vtxt = _no_;
-		etxt = "-";
-	} else {
-		if (!strcmp(value->value, ALLOW))
-			vtxt = _yes_;
-		else if (!strcmp(value->value, DENY) || ischeck)
-			vtxt = _no_;
-		else
-			vtxt = _ack_;
-		etxt = exp2check(value->expire, text, sizeof text);
-	}
+	vtxt = checkresult(value, ischeck, &etxt, text);
 	cli->caching = 1;
 	putx(cli, vtxt, id, etxt, NULL);
-	flushw(cli);
+	flush_later(cli);
 }
 
-/** callback of checking */
+/**
+ * Remove the check from the pending checks of its client
+ * @param check the check
+ * @return the client of the check or NULL if it is gone
+ */
 static
-void
-checkcb(
-	void *closure,
-	const data_value_t *value
+client_t *
+unlinkcheck(
+	check_t *check
 ) {
-	check_t *check = closure;
 	check_t **pc;
 	client_t *cli;
 
@@ -403,7 +867,81 @@ checkcb(
 				*pc = check->next;
 				break;
 			}
-		replycheck(cli, check->id, value, check->ischeck);
+	}
+	return cli;
+}
+
+/**
+ * Release a pending check of the batch and reply when none remains
+ * @param batch the batch
+ */
+static
+void
+releasebatch(
+	batch_t *batch
+) {
+	const char *fields[2 + CHECKM_MAX_PERMISSIONS];
+	client_t *cli;
+	unsigned i;
+
+	if (--batch->pending)
+		return;
+
+	cli = unlinkcheck(batch->check);
+	if (cli) {
+		fields[0] = _done_;
+		fields[1] = batch->check->id;
+		for (i = 0 ; i < batch->count ; i++)
+			fields[2 + i] = batch->results[i];
+		cli->caching = 1;
+		putv(cli, 2 + batch->count, fields);
+		flush_later(cli);
+	}
+	free(batch->check);
+	free(batch);
+}
+
+/**
+ * Record the result of a check of a batch
+ * @param batch the batch
+ * @param index index of the check in the batch
+ * @param value the value of the check or NULL on error
+ */
+static
+void
+setbatch(
+	batch_t *batch,
+	unsigned index,
+	const data_value_t *value
+) {
+	char text[30];
+	const char *etxt, *vtxt;
+
+	vtxt = checkresult(value, true, &etxt, text);
+	if (!etxt)
+		strcpy(batch->results[index], vtxt);
+	else
+		snprintf(batch->results[index], sizeof batch->results[index],
+				"%s:%s", vtxt, etxt);
+	releasebatch(batch);
+}
+
+/** callback of checking */
+static
+void
+checkcb(
+	void *closure,
+	const data_value_t *value
+) {
+	check_t *check = closure;
+	client_t *cli;
+
+	if (check->batch)
+		setbatch(check->batch, check->index, value);
+	else {
+		cli = unlinkcheck(check);
+		if (cli)
+			replycheck(cli, check->id, value, check->ischeck);
 	}
 	free(check);
 }
@@ -422,6 +960,8 @@ alloccheck(
 	if (check) {
 		strcpy(check->id, id);
 		check->ischeck = ischeck;
+		check->batch = NULL;
+		check->index = 0;
 		check->client = cli;
 		check->next = cli->checks;
 		cli->checks = check;
@@ -429,6 +969,211 @@ alloccheck(
 	return check;
 }
 
+/**
+ * Forward to the main thread the check that requires an agent
+ * @param worker the worker forwarding the check
+ * @param check the check
+ * @param key the key of the check
+ */
+static
+void
+forward_check(
+	worker_t *worker,
+	check_t *check,
+	const data_key_t *key
+) {
+	size_t szcli, szses, szuse, szper;
+	cyn_server_t *server = worker->server;
+	forward_t *fwd;
+	char *ptr;
+
+	/* allocate with a copy of the key */
+	szcli = 1 + strlen(key->client);
+	szses = 1 + strlen(key->session);
+	szuse = 1 + strlen(key->user);
+	szper = 1 + strlen(key->permission);
+	fwd = malloc(sizeof *fwd + szcli + szses + szuse + szper);
+	if (!fwd) {
+		checkcb(check, NULL);
+		return;
+	}
+	fwd->check = check;
+	fwd->worker = worker;
+	fwd->value = NULL;
+	fwd->expire = 0;
+	ptr = fwd->text;
+	fwd->key.client = ptr;
+	ptr = mempcpy(ptr, key->client, szcli);
+	fwd->key.session = ptr;
+	ptr = mempcpy(ptr, key->session, szses);
+	fwd->key.user = ptr;
+	ptr = mempcpy(ptr, key->user, szuse);
+	fwd->key.permission = ptr;
+	mempcpy(ptr, key->permission, szper);
+
+	/* give it to the main thread */
+	pthread_mutex_lock(&server->mutex);
+	fwd->next = server->forwards;
+	server->forwards = fwd;
+	pthread_mutex_unlock(&server->mutex);
+	eventfd_write(server->forward.fd, 1);
+}
+
+/** callback of forwarded checks, gives the result back to the worker */
+static
+void
+forwardcb(
+	void *closure,
+	const data_value_t *value
+) {
+	forward_t *fwd = closure;
+	worker_t *worker = fwd->worker;
+
+	/* not pending anymore */
+	*fwd->prv_pending = fwd->next_pending;
+	if (fwd->next_pending)
+		fwd->next_pending->prv_pending = fwd->prv_pending;
+
+	/* the worker is stopped and its clients are destroyed */
+	if (!worker) {
+		checkcb(fwd->check, NULL);
+		free(fwd);
+		return;
+	}
+
+	fwd->value = strdup(value->value);
+	fwd->expire = value->expire;
+	pthread_mutex_lock(&worker->mutex);
+	fwd->next = worker->resolved;
+	worker->resolved = fwd;
+	pthread_mutex_unlock(&worker->mutex);
+	eventfd_write(worker->wakeup.fd, 1);
+}
+
+/** reply to the forwarded checks */
+static
+void
+reply_forwards(
+	forward_t *fwd
+) {
+	forward_t *next;
+	data_value_t value;
+
+	while (fwd) {
+		next = fwd->next;
+		value.value = fwd->value;
+		value.expire = fwd->expire;
+		checkcb(fwd->check, fwd->value ? &value : NULL);
+		free(fwd->value);
+		free(fwd);
+		fwd = next;
+	}
+}
+
+/** handle checks forwarded by the workers */
+static
+void
+on_forward_event(
+	pollitem_t *pollitem,
+	uint32_t events,
+	int pollfd
+) {
+	cyn_server_t *server = pollitem->closure;
+	forward_t *fwd, *next;
+	eventfd_t count;
+
+	eventfd_read(pollitem->fd, &count);
+	pthread_mutex_lock(&server->mutex);
+	fwd = server->forwards;
+	server->forwards = NULL;
+	pthread_mutex_unlock(&server->mutex);
+	while (fwd) {
+		next = fwd->next;
+		fwd->prv_pending = &server->pending;
+		fwd->next_pending = server->pending;
+		if (server->pending)
+			server->pending->prv_pending = &fwd->next_pending;
+		server->pending = fwd;
+		cyn_check_async(forwardcb, fwd, &fwd->key);
+		fwd = next;
+	}
+}
+
+/** closure of checks made directly and published in the shared cache */
+struct publish
+{
+	/** the check */
+	check_t *check;
+
+	/** the key of the check */
+	const data_key_t *key;
+
+	/** the changeid known when the check started */
+	uint32_t changeid;
+};
+
+/** callback of checking directly, publishing the decision */
+static
+void
+publishcb(
+	void *closure,
+	const data_value_t *value
+) {
+	struct publish *pub = closure;
+	const data_key_t *key = pub->key;
+
+	if (value->expire >= 0)
+		shcache_put(shcache, pub->changeid,
+			key->client, key->session, key->user, key->permission,
+			!strcmp(value->value, ALLOW), value->expire);
+	checkcb(pub->check, value);
+}
+
+/**
+ * Check directly the key, without calling agents, publishing the decision
+ * in the shared cache if any
+ * @param cli the client
+ * @param check the check
+ * @param key the key to check
+ * @return 1 if the check is done or 0 when an agent is required
+ */
+static
+int
+checkdirect(
+	client_t *cli,
+	check_t *check,
+	const data_key_t *key
+) {
+	struct publish pub;
+
+	if (!shcache)
+		return cyn_check_direct(checkcb, check, key);
+
+	/* the changeid is read before the check so that decisions made
+	 * with a newer state of the database are never published as
+	 * older */
+	pub.check = check;
+	pub.key = key;
+	pub.changeid = cli->worker ? cli->worker->changeid : cyn_changeid();
+	return cyn_check_direct(publishcb, &pub, key);
+}
+
+/** start the check of the key */
+static
+void
+startcheck(
+	client_t *cli,
+	check_t *check,
+	const data_key_t *key
+) {
+	if (cli->worker) {
+		if (!checkdirect(cli, check, key))
+			forward_check(cli->worker, check, key);
+	}
+	else if (!shcache || !checkdirect(cli, check, key))
+		cyn_check_async(checkcb, check, key);
+}
+
 /** initiate the check */
 static
 void
@@ -451,8 +1196,64 @@ makecheck(
 		key.session = args[3];
 		key.user = args[4];
 		key.permission = args[5];
-		(ischeck ? cyn_check_async : cyn_test_async)(checkcb, check, &key);
+		if (ischeck)
+			startcheck(cli, check, &key);
+		else if (!cli->worker)
+			cyn_test_async(checkcb, check, &key);
+		else if (!cyn_test_direct(checkcb, check, &key))
+			forward_check(cli->worker, check, &key);
+	}
+}
+
+/** initiate the checks of a batch */
+static
+void
+makecheckm(
+	client_t *cli,
+	unsigned count,
+	const char *args[]
+) {
+	data_key_t key;
+	batch_t *batch;
+	check_t *check;
+	unsigned i, n;
+
+	/* allocate the batch and its check */
+	n = count - 5;
+	batch = malloc(sizeof *batch + n * sizeof *batch->results);
+	if (!batch) {
+		send_error(cli, NULL);
+		return;
+	}
+	batch->check = alloccheck(cli, args[1], true);
+	if (!batch->check) {
+		free(batch);
+		send_error(cli, NULL);
+		return;
+	}
+	batch->count = n;
+	batch->pending = n + 1;
+
+	/* the checks share client, session and user */
+	key.client = args[2];
+	key.session = args[3];
+	key.user = args[4];
+	for (i = 0 ; i < n ; i++) {
+		key.permission = args[5 + i];
+		check = malloc(sizeof *check + 1);
+		if (!check) {
+			setbatch(batch, i, NULL);
+			continue;
+		}
+		check->next = NULL;
+		check->client = NULL;
+		check->ischeck = true;
+		check->batch = batch;
+		check->index = i;
+		check->id[0] = 0;
+		startcheck(cli, check, &key);
 	}
+	releasebatch(batch);
 }
 
 /** callback of getting list of entries */
@@ -521,7 +1322,7 @@ agentcb(
 	putx(cli, _ask_, ask->id, name, value,
 			key->client, key->session, key->user, key->permission,
 			NULL);
-	flushw(cli);
+	flush_later(cli);
 	return 0;
 }
 
@@ -573,12 +1374,80 @@ makesub(
 			key.user = args[5];
 			key.permission = args[6];
 
-			cyn_query_subquery_async(
-					ask->query, checkcb, check, &key);
-			return;
-		}
-	}
-	replycheck(cli, id, NULL, true);
+			cyn_query_subquery_async(
+					ask->query, checkcb, check, &key);
+			return;
+		}
+	}
+	replycheck(cli, id, NULL, true);
+}
+
+/**
+ * Count the batch of 'count' events dispatched by one wait
+ * of the main thread or of a worker
+ */
+static
+void
+count_batch(
+	int count
+) {
+	int max;
+
+	if (count > 0) {
+		__atomic_add_fetch(&stats.waits, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats.events, (unsigned long)count, __ATOMIC_RELAXED);
+		max = __atomic_load_n(&stats.max_batch, __ATOMIC_RELAXED);
+		while (count > max
+			&& !__atomic_compare_exchange_n(&stats.max_batch, &max, count,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+}
+
+/** emit the statistic of 'name' having 'value' */
+static
+void
+putstat(
+	client_t *cli,
+	const char *name,
+	unsigned long value
+) {
+	char text[24];
+
+	snprintf(text, sizeof text, "%lu", value);
+	putx(cli, _item_, name, text, NULL);
+}
+
+/** emit the statistics of the dispatch and of the cache of decisions */
+static
+void
+send_stats(
+	client_t *cli
+) {
+	unsigned long hits, misses;
+	unsigned count, size;
+
+	cyn_decision_cache_stats(&hits, &misses, &count, &size);
+	putstat(cli, "events", __atomic_load_n(&stats.events, __ATOMIC_RELAXED));
+	putstat(cli, "waits", __atomic_load_n(&stats.waits, __ATOMIC_RELAXED));
+	putstat(cli, "max-batch", (unsigned long)__atomic_load_n(&stats.max_batch, __ATOMIC_RELAXED));
+	putstat(cli, "cache-hits", hits);
+	putstat(cli, "cache-misses", misses);
+	putstat(cli, "cache-count", count);
+	putstat(cli, "cache-size", size);
+	send_done(cli);
+}
+
+/** tells whether the socket 'fd' is a unix socket able to pass descriptors */
+static
+bool
+is_unix(
+	int fd
+) {
+	struct sockaddr_storage addr;
+	socklen_t length = sizeof addr;
+
+	return getsockname(fd, (struct sockaddr*)&addr, &length) == 0
+		&& addr.ss_family == AF_UNIX;
 }
 
 /** handle a request */
@@ -589,10 +1458,12 @@ onrequest(
 	unsigned count,
 	const char *args[]
 ) {
-	bool nextlog;
+	bool nextlog, commit;
 	int rc;
+	unsigned i;
 	data_key_t key;
 	data_value_t value;
+	char text[12];
 
 	/* just ignore empty lines */
 	if (count == 0)
@@ -605,11 +1476,29 @@ onrequest(
 	/* version hand-shake */
 	if (!cli->version) {
 		if (ckarg(args[0], _cynagora_, 0)) {
-			if (count < 2 || !ckarg(args[1], "1", 0))
+			/* select the highest of the proposed versions */
+			for (i = 1 ; i < count ; i++) {
+				if (!strcmp(args[i], "2"))
+					cli->version = 2;
+				else if (!strcmp(args[i], "1") && !cli->version)
+					cli->version = 1;
+			}
+			if (!cli->version)
 				goto invalid;
-			putx(cli, _done_, "1", cyn_changeid_string(), NULL);
-			flushw(cli);
-			cli->version = 1;
+			/* check clients are also given the shared cache
+			 * whose descriptor is passed with the reply */
+			cli->sharing = shcache && cli->type == server_Check
+					&& is_unix(cli->pollitem.fd);
+			if (cli->sharing)
+				prot_put_fd(cli->prot, shcache_fd(shcache));
+			putx(cli, _done_, cli->version == 2 ? "2" : "1",
+					changeid_string(cli, text),
+					cli->sharing ? _shared_ : NULL,
+					NULL);
+			flush_later(cli);
+			/* version 2 switches to binary framing after the reply */
+			if (cli->version == 2 && prot_set_binary(cli->prot, 1) < 0)
+				cli->invalid = 1;
 			return;
 		}
 		/* switch automatically to version 1 */
@@ -631,6 +1520,11 @@ onrequest(
 			makecheck(cli, count, args, true);
 			return;
 		}
+		if (ckarg(args[0], _checkm_, 1) && count >= 6
+		 && count <= 5 + CHECKM_MAX_PERMISSIONS) {
+			makecheckm(cli, count, args);
+			return;
+		}
 		if (ckarg(args[0], _clearall_, 1) && count == 1) {
 			if (cli->type != server_Admin && cli->type != server_Agent)
 				break;
@@ -687,9 +1581,13 @@ onrequest(
 				break;
 			if (!cli->entered)
 				break;
-			rc = cyn_leave(cli, count == 2 && ckarg(args[1], _commit_, 0));
+			commit = count == 2 && ckarg(args[1], _commit_, 0);
+			rc = cyn_leave(cli, commit);
 			cli->entered = 0;
-			send_done_or_error(cli, rc);
+			if (rc >= 0 && commit && cyn_flush_pending())
+				wait_flush(cli);
+			else
+				send_done_or_error(cli, rc);
 			return;
 		} /* log */
 		if (ckarg(args[0], _log_, 1) && count <= 2) {
@@ -702,7 +1600,7 @@ onrequest(
 				nextlog = ckarg(args[1], _on_, 0);
 			}
 			putx(cli, _done_, nextlog ? _on_ : _off_, NULL);
-			flushw(cli);
+			flush_later(cli);
 			cyn_server_log = nextlog;
 			return;
 		}
@@ -740,6 +1638,12 @@ onrequest(
 				break;
 			makesub(cli, args);
 			return;
+		} /* stats */
+		if (ckarg(args[0], _stats_, 1) && count == 1) {
+			if (cli->type != server_Admin)
+				break;
+			send_stats(cli);
+			return;
 		}
 		break;
 	case 't': /* test */
@@ -762,10 +1666,39 @@ onchange(
 	void *closure
 ) {
 	client_t *cli = closure;
-	if (cli->caching) {
+	char text[12];
+
+	if (cli->caching || cli->sharing) {
 		cli->caching = 0;
-		putx(cli, _clear_, cyn_changeid_string(), NULL);
-		flushw(cli);
+		putx(cli, _clear_, changeid_string(cli, text), NULL);
+		flush_later(cli);
+	}
+}
+
+/** ignore events of destroyed clients */
+static
+void
+on_zombie_event(
+	pollitem_t *pollitem,
+	uint32_t events,
+	int pollfd
+) {
+}
+
+/**
+ * Free the destroyed clients
+ * @param list the list of destroyed clients
+ */
+static
+void
+free_zombies(
+	client_t **list
+) {
+	client_t *cli;
+
+	while ((cli = *list) != NULL) {
+		*list = cli->next_zombie;
+		free(cli);
 	}
 }
 
@@ -778,10 +1711,35 @@ destroy_client(
 ) {
 	ask_t *ask;
 	check_t *check;
+	reply_t *reply;
+	client_t **prv;
 	data_value_t value;
 
 	/* remove observers */
-	cyn_on_change_remove(onchange, cli);
+	if (!cli->worker)
+		cyn_on_change_remove(onchange, cli);
+	else {
+		prv = &cli->worker->clients;
+		while (*prv != cli)
+			prv = &(*prv)->next_client;
+		*prv = cli->next_client;
+	}
+
+	/* not waiting a flush anymore */
+	if (cli->flushing) {
+		prv = cli->worker ? &cli->worker->flushes : &flushes;
+		while (*prv != cli)
+			prv = &(*prv)->next_flush;
+		*prv = cli->next_flush;
+	}
+
+	/* not waiting a commit anymore */
+	if (cli->committing) {
+		prv = &committers;
+		while (*prv != cli)
+			prv = &(*prv)->next_committer;
+		*prv = cli->next_committer;
+	}
 
 	/* clean of checks */
 	check = cli->checks;
@@ -813,9 +1771,67 @@ destroy_client(
 	}
 
 	/* clean of agents */
-	cyn_agent_remove_by_cc(agentcb, cli);
+	if (cli->type == server_Agent)
+		cyn_agent_remove_by_cc(agentcb, cli);
 	prot_destroy(cli->prot);
-	free(cli);
+
+	/* drop the waiting replies */
+	while ((reply = cli->outq) != NULL) {
+		cli->outq = reply->next;
+		free(reply);
+	}
+
+	/* events of the client can remain in the dispatched batch */
+	prv = cli->worker ? &cli->worker->zombies : &zombies;
+	cli->pollitem.handler = on_zombie_event;
+	cli->next_zombie = *prv;
+	*prv = cli;
+}
+
+/**
+ * Process the requests received by the client. The processing stops
+ * while the commit of the client isn't flushed, to keep the order of
+ * replies, or while the client doesn't read its replies.
+ * @param cli the client
+ * @return 0 on success or -1 if the client must be terminated
+ */
+static
+int
+process_requests(
+	client_t *cli
+) {
+	int nargs;
+	const char **args;
+
+	while (!cli->committing && !cli->throttled) {
+		nargs = prot_get(cli->prot, &args);
+		if (nargs == -EAGAIN)
+			break;
+		if (nargs < 0)
+			return -1;
+		onrequest(cli, (unsigned)nargs, args);
+		if (cli->invalid && !cli->relax)
+			return -1;
+		prot_next(cli->prot);
+	}
+	return 0;
+}
+
+/**
+ * Flush the output of the client and restart processing of its
+ * requests if it is not throttled anymore
+ * @param cli the client
+ * @return 0 on success or -1 if the client must be terminated
+ */
+static
+int
+flush_resume(
+	client_t *cli
+) {
+	bool throttled = cli->throttled;
+
+	flushw(cli);
+	return throttled && !cli->throttled ? process_requests(cli) : 0;
 }
 
 /** handle client requests */
@@ -826,27 +1842,22 @@ on_client_event(
 	uint32_t events,
 	int pollfd
 ) {
-	int nargs, nr;
-	const char **args;
+	int nr;
 	client_t *cli = pollitem->closure;
 
 	/* is it a hangup? */
-	if (events & EPOLLHUP)
+	if (events & (EPOLLHUP|EPOLLERR))
 		goto terminate;
 
-	/* possible input */
-	if (events & EPOLLIN) {
+	/* possible output */
+	if ((events & EPOLLOUT) && flush_resume(cli) < 0)
+		goto terminate;
+
+	/* possible input, if still expected */
+	if ((events & EPOLLIN) && (cli->events & EPOLLIN)) {
 		nr = prot_read(cli->prot, cli->pollitem.fd);
-		if (nr <= 0)
+		if (nr <= 0 || process_requests(cli) < 0)
 			goto terminate;
-		nargs = prot_get(cli->prot, &args);
-		while (nargs >= 0) {
-			onrequest(cli, (unsigned)nargs, args);
-			if (cli->invalid && !cli->relax)
-				goto terminate;
-			prot_next(cli->prot);
-			nargs = prot_get(cli->prot, &args);
-		}
 	}
 	return;
 
@@ -856,13 +1867,76 @@ terminate:
 	destroy_client(cli, true);
 }
 
-/** create a client */
+/**
+ * Compute the time to wait before flushing the waiting commits
+ * @return the delay in milliseconds or -1 if no commit is waiting
+ */
+static
+int
+flush_delay(
+) {
+	int64_t delay;
+
+	if (!committers)
+		return -1;
+	delay = committers_deadline - now_ms();
+	return delay > 0 ? (int)delay : 0;
+}
+
+/**
+ * Flush the waiting commits, reply to their clients and
+ * restart processing of their requests
+ * @param pollfd the epoll file descriptor
+ */
+static
+void
+flush_commits(
+	int pollfd
+) {
+	int rc;
+	client_t *cli;
+
+	rc = cyn_flush();
+	while ((cli = committers) != NULL) {
+		committers = cli->next_committer;
+		cli->committing = 0;
+		send_done_or_error(cli, rc);
+		if (process_requests(cli) < 0) {
+			pollitem_del(&cli->pollitem, pollfd);
+			destroy_client(cli, true);
+		}
+	}
+}
+
+/**
+ * Flush the output of the clients having replies
+ * @param list the list of clients to flush
+ */
+static
+void
+flush_replies(
+	client_t **list
+) {
+	client_t *cli;
+
+	while ((cli = *list) != NULL) {
+		*list = cli->next_flush;
+		cli->flushing = 0;
+		if (flush_resume(cli) < 0) {
+			pollitem_del(&cli->pollitem, cli->pollfd);
+			destroy_client(cli, true);
+		}
+	}
+}
+
+/** create a client, served by the worker if not NULL */
 static
 int
 create_client(
 	client_t **pcli,
 	int fd,
-	server_type_t type
+	server_type_t type,
+	worker_t *worker
 ) {
 	client_t *cli;
 	int rc;
@@ -879,10 +1953,15 @@ create_client(
 	if (rc < 0)
 		goto error2;
 
-	/* monitor change and caching */
-	rc = cyn_on_change_add(onchange, cli);
-	if (rc < 0)
-		goto error3;
+	/* monitor change and caching, workers notify their clients */
+	if (worker) {
+		cli->next_client = worker->clients;
+		worker->clients = cli;
+	} else {
+		rc = cyn_on_change_add(onchange, cli);
+		if (rc < 0)
+			goto error3;
+	}
 
 	/* records the file descriptor */
 	cli->type = type;
@@ -892,9 +1971,15 @@ create_client(
 	cli->entered = 0; /* not entered */
 	cli->entering = 0; /* not entering */
 	cli->caching = 0; /* no caching made */
+	cli->sharing = 0;
 	cli->pollitem.handler = on_client_event;
 	cli->pollitem.closure = cli;
 	cli->pollitem.fd = fd;
+	cli->events = EPOLLIN;
+	cli->outq = NULL;
+	cli->outq_tail = &cli->outq;
+	cli->outq_size = 0;
+	cli->worker = worker;
 	cli->asks = NULL;
 	cli->checks = NULL;
 	idgen_init(cli->idgen);
@@ -915,7 +2000,8 @@ on_server_event(
 	pollitem_t *pollitem,
 	uint32_t events,
 	int pollfd,
-	server_type_t type
+	server_type_t type,
+	worker_t *worker
 ) {
 	int servfd = pollitem->fd;
 	int fd, rc;
@@ -937,14 +2023,16 @@ on_server_event(
 	slen = (socklen_t)sizeof saddr;
 	fd = accept(servfd, &saddr, &slen);
 	if (fd < 0) {
-		fprintf(stderr, "can't accept connection: %s\n", strerror(errno));
+		/* workers polling the same socket can race for it */
+		if (errno != EAGAIN)
+			fprintf(stderr, "can't accept connection: %s\n", strerror(errno));
 		return;
 	}
 	fcntl(fd, F_SETFD, FD_CLOEXEC);
 	fcntl(fd, F_SETFL, O_NONBLOCK);
 
 	/* create a client for the connection */
-	rc = create_client(&cli, fd, type);
+	rc = create_client(&cli, fd, type, worker);
 	if (rc < 0) {
 		fprintf(stderr, "can't create client connection: %s\n", strerror(-rc));
 		close(fd);
@@ -952,7 +2040,8 @@ on_server_event(
 	}
 
 	/* add the client to the epolling */
-	rc = pollitem_add(&cli->pollitem, EPOLLIN, pollfd);
+	cli->pollfd = pollfd;
+	rc = pollitem_add(&cli->pollitem, cli->events, pollfd);
 	if (rc < 0) {
 		fprintf(stderr, "can't poll client connection: %s\n", strerror(-rc));
 		destroy_client(cli, 1);
@@ -968,7 +2057,7 @@ on_check_server_event(
 	uint32_t events,
 	int pollfd
 ) {
-	on_server_event(pollitem, events, pollfd, server_Check);
+	on_server_event(pollitem, events, pollfd, server_Check, NULL);
 }
 
 /** handle admin server events */
@@ -979,7 +2068,7 @@ on_admin_server_event(
 	uint32_t events,
 	int pollfd
 ) {
-	on_server_event(pollitem, events, pollfd, server_Admin);
+	on_server_event(pollitem, events, pollfd, server_Admin, NULL);
 }
 
 /** handle admin server events */
@@ -990,7 +2079,320 @@ on_agent_server_event(
 	uint32_t events,
 	int pollfd
 ) {
-	on_server_event(pollitem, events, pollfd, server_Agent);
+	on_server_event(pollitem, events, pollfd, server_Agent, NULL);
+}
+
+/** handle check server events of a worker */
+static
+void
+on_worker_check_event(
+	pollitem_t *pollitem,
+	uint32_t events,
+	int pollfd
+) {
+	on_server_event(pollitem, events, pollfd, server_Check, pollitem->closure);
+}
+
+/**
+ * Drop the expired rules and arm the timer for the next expiration
+ * @param server the server
+ */
+static
+void
+arm_expire(
+	cyn_server_t *server
+) {
+	struct itimerspec its;
+	time_t next;
+
+	next = cyn_expire();
+	if (next != server->expire_armed) {
+		memset(&its, 0, sizeof its);
+		its.it_value.tv_sec = next; /* disarm when zero */
+		if (timerfd_settime(server->expire.fd, TFD_TIMER_ABSTIME, &its, NULL) == 0)
+			server->expire_armed = next;
+	}
+}
+
+/** handle expiration of rules */
+static
+void
+on_expire_event(
+	pollitem_t *pollitem,
+	uint32_t events,
+	int pollfd
+) {
+	cyn_server_t *server = pollitem->closure;
+	uint64_t count;
+
+	if (read(pollitem->fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		fprintf(stderr, "can't read timer of expiration: %s\n", strerror(errno));
+	server->expire_armed = 0;
+	arm_expire(server);
+}
+
+/** rearm the timer of expiration when rules change */
+static
+void
+on_change_expire(
+	void *closure
+) {
+	arm_expire(closure);
+}
+
+/** handle wake up of a worker by the main thread */
+static
+void
+on_wakeup_event(
+	pollitem_t *pollitem,
+	uint32_t events,
+	int pollfd
+) {
+	worker_t *worker = pollitem->closure;
+	forward_t *fwd;
+	uint32_t changeid;
+	eventfd_t count;
+	client_t *cli;
+
+	eventfd_read(pollitem->fd, &count);
+	pthread_mutex_lock(&worker->mutex);
+	fwd = worker->resolved;
+	worker->resolved = NULL;
+	changeid = worker->next_changeid;
+	worker->stopped = worker->stopping;
+	pthread_mutex_unlock(&worker->mutex);
+
+	/* reply the checks resolved by agents */
+	reply_forwards(fwd);
+
+	/* emits a clear to the caching clients on change */
+	if (changeid != worker->changeid) {
+		worker->changeid = changeid;
+		for (cli = worker->clients ; cli ; cli = cli->next_client)
+			onchange(cli);
+	}
+}
+
+/** clear the shared cache on changes */
+static
+void
+on_change_shared(
+	void *closure
+) {
+	shcache_clear(shcache, cyn_changeid());
+}
+
+/** notify the workers of changes */
+static
+void
+on_change_workers(
+	void *closure
+) {
+	cyn_server_t *server = closure;
+	worker_t *worker;
+	uint32_t changeid;
+	unsigned i;
+
+	changeid = cyn_changeid();
+	for (i = 0 ; i < server->nworkers ; i++) {
+		worker = &server->workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		worker->next_changeid = changeid;
+		pthread_mutex_unlock(&worker->mutex);
+		eventfd_write(worker->wakeup.fd, 1);
+	}
+}
+
+/** main routine of the threads of workers */
+static
+void *
+worker_main(
+	void *closure
+) {
+	worker_t *worker = closure;
+	client_t *cli;
+
+	while (!worker->stopped) {
+		count_batch(pollitem_wait_dispatch(worker->pollfd, -1));
+		flush_replies(&worker->flushes);
+		free_zombies(&worker->zombies);
+	}
+
+	/* terminate the clients */
+	while ((cli = worker->clients) != NULL) {
+		pollitem_del(&cli->pollitem, worker->pollfd);
+		destroy_client(cli, true);
+	}
+	free_zombies(&worker->zombies);
+	return NULL;
+}
+
+/**
+ * Release the checks forwarded to a stopped worker
+ * @param fwd list of the forwarded checks
+ */
+static
+void
+drop_forwards(
+	forward_t *fwd
+) {
+	forward_t *next;
+
+	while (fwd) {
+		next = fwd->next;
+		checkcb(fwd->check, NULL); /* its client is destroyed */
+		free(fwd->value);
+		free(fwd);
+		fwd = next;
+	}
+}
+
+/**
+ * Stop the threads of the workers and release them. The check socket
+ * is polled again by the main thread.
+ * @param server the server
+ */
+static
+void
+stop_workers(
+	cyn_server_t *server
+) {
+	worker_t *worker;
+	forward_t *fwd;
+	unsigned i;
+
+	/* stop the threads */
+	for (i = 0 ; i < server->nworkers ; i++) {
+		worker = &server->workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		worker->stopping = true;
+		pthread_mutex_unlock(&worker->mutex);
+		eventfd_write(worker->wakeup.fd, 1);
+	}
+	for (i = 0 ; i < server->nworkers ; i++) {
+		worker = &server->workers[i];
+		pthread_join(worker->thread, NULL);
+		drop_forwards(worker->resolved);
+		close(worker->wakeup.fd);
+		close(worker->pollfd);
+		pthread_mutex_destroy(&worker->mutex);
+	}
+	drop_forwards(server->forwards);
+	server->forwards = NULL;
+
+	/* checks waiting agents are detached, they are dropped when resolved */
+	while ((fwd = server->pending) != NULL) {
+		server->pending = fwd->next_pending;
+		fwd->worker = NULL;
+		fwd->next_pending = NULL;
+		fwd->prv_pending = &fwd->next_pending;
+	}
+
+	/* release the workers */
+	if (server->workers) {
+		cyn_on_change_remove(on_change_workers, server);
+		pollitem_del(&server->forward, server->pollfd);
+		close(server->forward.fd);
+		pthread_mutex_destroy(&server->mutex);
+		pollitem_add(&server->check, EPOLLIN, server->pollfd);
+		free(server->workers);
+		server->workers = NULL;
+	}
+	server->nworkers = 0;
+}
+
+/**
+ * Start the threads of the workers serving the check clients
+ * @param server the server
+ * @param count count of workers to start
+ * @return 0 on success or a negative -errno value
+ */
+static
+int
+start_workers(
+	cyn_server_t *server,
+	unsigned count
+) {
+	worker_t *worker;
+	int rc;
+
+	/* allocate the workers */
+	server->workers = calloc(count, sizeof *server->workers);
+	if (!server->workers) {
+		rc = -ENOMEM;
+		fprintf(stderr, "can't alloc memory: %s\n", strerror(-rc));
+		return rc;
+	}
+
+	/* create the event of forwarded checks */
+	server->forwards = NULL;
+	pthread_mutex_init(&server->mutex, NULL);
+	server->forward.fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	server->forward.handler = on_forward_event;
+	server->forward.closure = server;
+	if (server->forward.fd < 0 || pollitem_add(&server->forward, EPOLLIN, server->pollfd) < 0) {
+		rc = -errno;
+		fprintf(stderr, "can't create forward event: %s\n", strerror(-rc));
+		goto error0;
+	}
+
+	/* the workers notify their clients of changes */
+	rc = cyn_on_change_add(on_change_workers, server);
+	if (rc < 0) {
+		fprintf(stderr, "can't observe changes: %s\n", strerror(-rc));
+		goto error0;
+	}
+
+	/* the check socket is now polled by the workers */
+	pollitem_del(&server->check, server->pollfd);
+
+	/* create the workers */
+	while (server->nworkers < count) {
+		worker = &server->workers[server->nworkers];
+		worker->server = server;
+		worker->changeid = worker->next_changeid = cyn_changeid();
+		pthread_mutex_init(&worker->mutex, NULL);
+		worker->pollfd = epoll_create1(EPOLL_CLOEXEC);
+		if (worker->pollfd < 0)
+			goto error;
+		worker->wakeup.fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+		if (worker->wakeup.fd < 0)
+			goto error2;
+		worker->wakeup.handler = on_wakeup_event;
+		worker->wakeup.closure = worker;
+		worker->check.fd = server->check.fd;
+		worker->check.handler = on_worker_check_event;
+		worker->check.closure = worker;
+		if (pollitem_add(&worker->wakeup, EPOLLIN, worker->pollfd) < 0
+		 || pollitem_add(&worker->check, EPOLLIN|EPOLLEXCLUSIVE, worker->pollfd) < 0)
+			goto error3;
+		rc = pthread_create(&worker->thread, NULL, worker_main, worker);
+		if (rc != 0) {
+			errno = rc;
+			goto error3;
+		}
+		server->nworkers++;
+	}
+	return 0;
+
+error3:
+	close(worker->wakeup.fd);
+error2:
+	close(worker->pollfd);
+error:
+	rc = -errno;
+	fprintf(stderr, "can't create worker: %s\n", strerror(-rc));
+	pthread_mutex_destroy(&worker->mutex);
+	stop_workers(server);
+	return rc;
+
+error0:
+	if (server->forward.fd >= 0)
+		close(server->forward.fd);
+	pthread_mutex_destroy(&server->mutex);
+	free(server->workers);
+	server->workers = NULL;
+	return rc;
 }
 
 /* see cyn-server.h */
@@ -999,6 +2401,14 @@ cyn_server_destroy(
 	cyn_server_t *server
 ) {
 	if (server) {
+		cyn_on_change_remove(on_change_expire, server);
+		if (shcache) {
+			cyn_on_change_remove(on_change_shared, NULL);
+			shcache_destroy(shcache);
+			shcache = NULL;
+		}
+		if (server->expire.fd >= 0)
+			close(server->expire.fd);
 		if (server->pollfd >= 0)
 			close(server->pollfd);
 		if (server->admin.fd >= 0)
@@ -1030,7 +2440,12 @@ cyn_server_create(
 	}
 
 	/* create the polling fd */
-	srv->admin.fd = srv->check.fd = srv->agent.fd = -1;
+	srv->admin.fd = srv->check.fd = srv->agent.fd = srv->expire.fd = -1;
+	srv->expire_armed = 0;
+	srv->nworkers = 0;
+	srv->workers = NULL;
+	srv->forwards = NULL;
+	srv->pending = NULL;
 	srv->pollfd = epoll_create1(EPOLL_CLOEXEC);
 	if (srv->pollfd < 0) {
 		rc = -errno;
@@ -1101,8 +2516,53 @@ cyn_server_create(
 		goto error2;
 	}
 
+	/* create the timer of expiration of rules */
+	srv->expire.fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (srv->expire.fd < 0) {
+		rc = -errno;
+		fprintf(stderr, "can't create timer: %s\n", strerror(-rc));
+		goto error2;
+	}
+
+	/* add the timer to pollfd */
+	srv->expire.handler = on_expire_event;
+	srv->expire.closure = srv;
+	rc = pollitem_add(&srv->expire, EPOLLIN, srv->pollfd);
+	if (rc < 0) {
+		rc = -errno;
+		fprintf(stderr, "can't poll timer: %s\n", strerror(-rc));
+		goto error2;
+	}
+
+	/* rearm the timer on changes */
+	rc = cyn_on_change_add(on_change_expire, srv);
+	if (rc < 0) {
+		fprintf(stderr, "can't observe changes: %s\n", strerror(-rc));
+		goto error2;
+	}
+
+	/* create the cache shared with the check clients */
+	if (cyn_server_shared_cache) {
+		rc = shcache_create(&shcache);
+		if (rc < 0) {
+			fprintf(stderr, "can't create shared cache: %s\n", strerror(-rc));
+			goto error3;
+		}
+		shcache_clear(shcache, cyn_changeid());
+		rc = cyn_on_change_add(on_change_shared, NULL);
+		if (rc < 0) {
+			fprintf(stderr, "can't observe changes: %s\n", strerror(-rc));
+			shcache_destroy(shcache);
+			shcache = NULL;
+			goto error3;
+		}
+	}
+
 	return 0;
 
+error3:
+	cyn_on_change_remove(on_change_expire, srv);
+
 error2:
 	if (srv->pollfd >= 0)
 		close(srv->pollfd);
@@ -1112,6 +2572,8 @@ error2:
 		close(srv->check.fd);
 	if (srv->agent.fd >= 0)
 		close(srv->agent.fd);
+	if (srv->expire.fd >= 0)
+		close(srv->expire.fd);
 	free(srv);
 error:
 	*server = NULL;
@@ -1132,10 +2594,26 @@ int
 cyn_server_serve(
 	cyn_server_t *server
 ) {
+	int n;
+
+	/* start the workers */
+	if (cyn_server_workers) {
+		n = start_workers(server, cyn_server_workers);
+		if (n < 0)
+			return n;
+	}
+
 	/* process inputs */
+	arm_expire(server);
 	server->stopped = 0;
 	while(!server->stopped) {
-		pollitem_wait_dispatch(server->pollfd, -1);
+		n = pollitem_wait_dispatch(server->pollfd, flush_delay());
+		count_batch(n);
+		if (committers && !flush_delay())
+			flush_commits(server->pollfd);
+		flush_replies(&flushes);
+		free_zombies(&zombies);
 	}
+	stop_workers(server);
 	return server->stopped == INT_MIN ? 0 : server->stopped;
 }
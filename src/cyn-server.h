@@ -30,6 +30,31 @@ extern
 bool
 cyn_server_log;
 
+/**
+ * Count of threads serving the clients of the check socket
+ * When 0, the default, all clients are served by the main thread
+ */
+extern
+unsigned
+cyn_server_workers;
+
+/**
+ * Size in bytes of the replies waiting to be sent to a client above
+ * which the requests of the client are not read anymore, until the
+ * size falls under the half of it
+ */
+extern
+size_t
+cyn_server_high_water;
+
+/**
+ * Boolean flag telling whether the server shares a cache of its decisions
+ * with the clients of the check socket. False by default.
+ */
+extern
+bool
+cyn_server_shared_cache;
+
 /**
  * Create a cynagora server
  * 
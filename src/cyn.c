@@ -27,9 +27,11 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "data.h"
 #include "db.h"
+#include "dcache.h"
 #include "queue.h"
 #include "cyn.h"
 #include "names.h"
@@ -37,6 +39,12 @@
 #if !CYN_SEARCH_DEEP_MAX
 # define CYN_SEARCH_DEEP_MAX 10
 #endif
+#if !defined(CYN_SNAPSHOT_QUEUE_SIZE)
+# define CYN_SNAPSHOT_QUEUE_SIZE 32768
+#endif
+#if !defined(CYN_AGENT_BUCKETS)
+# define CYN_AGENT_BUCKETS 32 /* must be a power of 2 */
+#endif
 #if !defined(AGENT_SEPARATOR_CHARACTER)
 # define AGENT_SEPARATOR_CHARACTER ':'
 #endif
@@ -59,6 +67,9 @@ struct callback
 
 		/** observer callback */
 		on_change_cb_t *on_change_cb;
+
+		/** waiter of the result of a query */
+		on_result_cb_t *on_result_cb;
 	};
 
 	/** closure of the callback */
@@ -66,13 +77,16 @@ struct callback
 };
 
 /**
- * items of the list of agents
+ * items of the buckets of agents
  */
 struct agent
 {
-	/** link to the next item of the list */
+	/** link to the next item of the bucket */
 	struct agent *next;
 
+	/** hash of the name */
+	uint32_t hash;
+
 	/** agent callback */
 	agent_cb_t *agent_cb;
 
@@ -91,6 +105,18 @@ struct agent
  */
 struct cynagora_query
 {
+	/** link to the next query in flight */
+	cynagora_query_t *next;
+
+	/** the queried agent or NULL if the query can't be joined */
+	struct agent *agent;
+
+	/** value given to the agent */
+	const char *value;
+
+	/** other callbacks waiting the result */
+	struct callback *waiters;
+
 	/** callback for handling result of the check */
 	on_result_cb_t *on_result_cb;
 
@@ -102,6 +128,9 @@ struct cynagora_query
 
 	/** down counter for recursivity limitation */
 	int decount;
+
+	/** generation of the cache of decisions when the query started */
+	uint32_t generation;
 };
 
 /** for locking critical section with magic */
@@ -113,8 +142,26 @@ static struct callback *awaiters;
 /** head of the list of change observers */
 static struct callback *observers;
 
-/** head of the list of recorded agents */
-static struct agent *agents;
+/** the recorded agents hashed by name */
+static struct agent *agents[CYN_AGENT_BUCKETS];
+
+/** length of the longest name of the recorded agents */
+static uint8_t agent_maxlen;
+
+/** head of the list of the queries in flight */
+static cynagora_query_t *inflight;
+
+/**
+ * lock of the rules and of the agents: the main thread is the only one
+ * modifying them, it locks for writing when modifying and for reading
+ * when querying so that other threads can query at the same time.
+ * Big commits only lock for switching the tests to a snapshot of the
+ * rules and back.
+ */
+static pthread_rwlock_t rules_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+
+/** are the results of agents having an expiration cached? */
+static bool cache_agents = false;
 
 /** holding of changeid */
 static struct {
@@ -193,6 +240,7 @@ cyn_changed(
 ) {
 	struct callback *c;
 
+	dcache_clear();
 	changeid.current = changeid.current + 1 ?: 1;
 	for (c = observers; c ; c = c->next)
 		c->on_change_cb(c->closure);
@@ -261,6 +309,7 @@ cyn_leave(
 	bool commit
 ) {
 	int rc, rcp;
+	bool changed, snapshot;
 	struct callback *e, **p;
 
 	if (!magic)
@@ -274,13 +323,34 @@ cyn_leave(
 	if (!commit)
 		rc = 0;
 	else {
+		changed = false;
+
+		/* big changes are made while tests use a snapshot */
+		snapshot = queue_size() >= CYN_SNAPSHOT_QUEUE_SIZE
+				&& db_snapshot_make() == 0;
+		pthread_rwlock_wrlock(&rules_lock);
+		if (snapshot) {
+			db_snapshot_use(true);
+			pthread_rwlock_unlock(&rules_lock);
+		}
+
 		rc = db_transaction_begin();
 		if (rc == 0) {
 			rcp = queue_play();
 			rc = db_transaction_end(rcp == 0) ?: rcp;
-			if (rcp == 0)
-				cyn_changed();
+			changed = rcp == 0;
 		}
+
+		/* switch tests to the changed database */
+		if (snapshot)
+			pthread_rwlock_wrlock(&rules_lock);
+		db_snapshot_use(false);
+		if (changed)
+			dcache_clear();
+		pthread_rwlock_unlock(&rules_lock);
+		db_snapshot_drop();
+		if (changed)
+			cyn_changed();
 	}
 	queue_clear();
 
@@ -304,6 +374,37 @@ cyn_leave(
 	return rc;
 }
 
+/* see cyn.h */
+int
+cyn_flush(
+) {
+	int rc;
+
+	pthread_rwlock_wrlock(&rules_lock);
+	rc = db_flush();
+	pthread_rwlock_unlock(&rules_lock);
+	return rc;
+}
+
+/* see cyn.h */
+bool
+cyn_flush_pending(
+) {
+	return db_flush_pending();
+}
+
+/* see cyn.h */
+time_t
+cyn_expire(
+) {
+	time_t next;
+
+	pthread_rwlock_wrlock(&rules_lock);
+	next = db_expire();
+	pthread_rwlock_unlock(&rules_lock);
+	return next;
+}
+
 /* see cyn.h */
 int
 cyn_set(
@@ -332,7 +433,10 @@ cyn_list(
 	void *closure,
 	const data_key_t *key
 ) {
+	/* listing drops the expired rules */
+	pthread_rwlock_wrlock(&rules_lock);
 	db_for_all(callback, closure, key);
+	pthread_rwlock_unlock(&rules_lock);
 }
 
 /**
@@ -351,11 +455,31 @@ default_value(
 	return value;
 }
 
+/** hash of the empty name */
+#define HASH_INIT 2166136261u
+
 /**
- * Search the agent of name and return its item in the list
+ * Hash the next character of a name
+ *
+ * @param hash the hash of the previous characters
+ * @param c the next character
+ * @return the hash including c
+ */
+static inline
+uint32_t
+hash_next(
+	uint32_t hash,
+	char c
+) {
+	return (hash ^ (uint32_t)(unsigned char)c) * 16777619u;
+}
+
+/**
+ * Search the agent of name and return its item in its bucket
  *
  * @param name of the agent to find (optionally zero terminated)
  * @param len length of the name (without terminating zero)
+ * @param hash hash of the name
  * @param ppprev for catching the pointer referencing the return item
  * @return 0 if not found or the pointer to the item of the found agent
  */
@@ -364,31 +488,69 @@ struct agent *
 search_agent(
 	const char *name,
 	uint8_t length,
+	uint32_t hash,
 	struct agent ***ppprev
 ) {
 	struct agent *it, **pprev;
 
-	pprev = &agents;
-	it = agents;
-	while(it && length > it->len) {
-		pprev = &it->next;
-		it = it->next;
-	}
-	while(it && length == it->len) {
-		if (!memcmp(it->name, name, length)) {
-			*ppprev = pprev;
-			return it;
-		}
+	pprev = &agents[hash & (CYN_AGENT_BUCKETS - 1)];
+	while((it = *pprev)) {
+		if (it->hash == hash && it->len == length
+		 && !memcmp(it->name, name, length))
+			break;
 		pprev = &it->next;
-		it = it->next;
 	}
 	*ppprev = pprev;
-	return NULL;
+	return it;
+}
+
+/**
+ * Compute the hash of the name of an agent
+ *
+ * @param name the name to hash
+ * @param length length of the name
+ * @return the hash of the name
+ */
+static
+uint32_t
+hash_name(
+	const char *name,
+	uint8_t length
+) {
+	uint32_t hash;
+	uint8_t i;
+
+	for (hash = HASH_INIT, i = 0 ; i < length ; i++)
+		hash = hash_next(hash, name[i]);
+	return hash;
+}
+
+/**
+ * Unlink the agent from its bucket and update the length of the
+ * longest name. Must be called with the rules locked for writing.
+ *
+ * @param pprev the pointer referencing the agent
+ */
+static
+void
+unlink_agent(
+	struct agent **pprev
+) {
+	struct agent *it;
+	unsigned i;
+
+	*pprev = (*pprev)->next;
+	agent_maxlen = 0;
+	for (i = 0 ; i < CYN_AGENT_BUCKETS ; i++)
+		for (it = agents[i] ; it ; it = it->next)
+			if (it->len > agent_maxlen)
+				agent_maxlen = it->len;
 }
 
 /**
  * Return the agent required by the value or NULL if no agent is required
- * or if the agent is not found.
+ * or if the agent is not found. The hash of the prefixes is computed
+ * while scanning the value so that it is scanned only once.
  *
  * @param value string where agent is the prefix followed by one colon
  * @return the item of the required agent or NULL when no agent is required
@@ -399,26 +561,69 @@ required_agent(
 	const char *value
 ) {
 	struct agent **pprev, *agent;
+	uint32_t hash;
 	size_t length;
 
-	for (length = 0 ; length <= UINT8_MAX && value[length] ; length++)
+	hash = HASH_INIT;
+	for (length = 0 ; length <= agent_maxlen && value[length] ; length++) {
 		if (value[length] == AGENT_SEPARATOR_CHARACTER) {
-			agent = search_agent(value, (uint8_t)length, &pprev);
+			agent = search_agent(value, (uint8_t)length, hash, &pprev);
 			if (agent)
 				return agent;
 		}
+		hash = hash_next(hash, value[length]);
+	}
 	return NULL;
 }
 
+/**
+ * Get the value for the key, from the cache of decisions when possible,
+ * and return the agent to query for completing it. Must be called with
+ * the rules locked for reading.
+ *
+ * @param key the key to query
+ * @param maxdepth maximum depth of the agent subrequests
+ * @param value where to store the value
+ * @param buffer buffer of DCACHE_VALUE_SIZE bytes for the values of the cache
+ * @param generation where to store the generation of the cache of decisions
+ * @return the agent to query or NULL when the value is the result
+ */
+static
+struct agent*
+get_value(
+	const data_key_t *key,
+	int maxdepth,
+	data_value_t *value,
+	char *buffer,
+	uint32_t *generation
+) {
+	struct agent *agent;
+
+	*generation = dcache_generation();
+	if (!dcache_get(key, false, value, buffer)) {
+		if (!db_test(key, value))
+			default_value(value);
+		dcache_put(*generation, key, false, value);
+	}
+	if (maxdepth <= 0)
+		return NULL;
+	agent = required_agent(value->value);
+	if (agent && cache_agents && dcache_get(key, true, value, buffer))
+		agent = NULL;
+	return agent;
+}
+
 /**
  * Allocates the query structure for handling the given parameters
- * and return it. The query structure copies the key data to be compatible
- * with asynchronous processing.
+ * and return it. The query structure copies the key data and the value
+ * to be compatible with asynchronous processing.
  *
  * @param on_result_cb the result callback to record
  * @param closure the closure for the result callback
  * @param key the key of the query
  * @param maxdepth maximum depth of the agent subrequests
+ * @param agent the agent to query
+ * @param value the value for the agent
  * @return the allocated structure or NULL in case of memory depletion
  */
 static
@@ -427,9 +632,11 @@ alloc_query(
 	on_result_cb_t *on_result_cb,
 	void *closure,
 	const data_key_t *key,
-	int maxdepth
+	int maxdepth,
+	struct agent *agent,
+	const char *value
 ) {
-	size_t szcli, szses, szuse, szper;
+	size_t szcli, szses, szuse, szper, szval;
 	cynagora_query_t *query;
 	void *ptr;
 
@@ -438,13 +645,18 @@ alloc_query(
 	szses = key->session ? 1 + strlen(key->session) : 0;
 	szuse = key->user ? 1 + strlen(key->user) : 0;
 	szper = key->permission ? 1 + strlen(key->permission) : 0;
-	query = malloc(szcli + szses + szuse + szper + sizeof *query);
+	szval = 1 + strlen(value);
+	query = malloc(szcli + szses + szuse + szper + szval + sizeof *query);
 	if (query) {
 		/* init the structure */
 		ptr = &query[1];
 		query->on_result_cb = on_result_cb;
 		query->closure = closure;
 		query->decount = maxdepth;
+		query->agent = agent;
+		query->waiters = NULL;
+		query->value = ptr;
+		ptr = mempcpy(ptr, value, szval);
 
 		/* copy strings of the key */
 		if (!key->client)
@@ -475,6 +687,70 @@ alloc_query(
 	return query;
 }
 
+/**
+ * Test if the strings are equal, NULL being only equal to NULL
+ *
+ * @param a first string
+ * @param b second string
+ * @return true if equal
+ */
+static
+bool
+same(
+	const char *a,
+	const char *b
+) {
+	return a == b || (a && b && !strcmp(a, b));
+}
+
+/**
+ * Search a query in flight for the agent, the value and the key
+ *
+ * @param agent the queried agent
+ * @param value the value given to the agent
+ * @param key the key of the query
+ * @param maxdepth maximum depth of the agent subrequests
+ * @return the query in flight found or NULL
+ */
+static
+cynagora_query_t *
+search_inflight(
+	struct agent *agent,
+	const char *value,
+	const data_key_t *key,
+	int maxdepth
+) {
+	cynagora_query_t *query;
+
+	for (query = inflight ; query ; query = query->next)
+		if (query->agent == agent
+		 && query->decount == maxdepth
+		 && !strcmp(query->value, value)
+		 && same(query->key.permission, key->permission)
+		 && same(query->key.user, key->user)
+		 && same(query->key.client, key->client)
+		 && same(query->key.session, key->session))
+			break;
+	return query;
+}
+
+/**
+ * Forbid to join the queries in flight for the agent
+ *
+ * @param agent the agent being removed
+ */
+static
+void
+detach_inflight(
+	struct agent *agent
+) {
+	cynagora_query_t *query;
+
+	for (query = inflight ; query ; query = query->next)
+		if (query->agent == agent)
+			query->agent = NULL;
+}
+
 /* see cyn.h */
 int
 cyn_query_async(
@@ -484,41 +760,49 @@ cyn_query_async(
 	int maxdepth
 ) {
 	int rc;
-	unsigned score;
+	uint32_t generation;
 	data_value_t value;
 	cynagora_query_t *query;
 	struct agent *agent;
+	char buffer[DCACHE_VALUE_SIZE];
 
-	/* get the direct value */
-	score = db_test(key, &value);
+	/* get the direct value, only the main thread modifies it */
+	pthread_rwlock_rdlock(&rules_lock);
+	agent = get_value(key, maxdepth, &value, buffer, &generation);
+	pthread_rwlock_unlock(&rules_lock);
 
-	/* missing value */
-	if (score == 0) {
-		default_value(&value);
+	/* if not an agent or agent not required */
+	if (!agent) {
 		on_result_cb(closure, &value);
 		return 0;
 	}
 
-	/* if not an agent or agent not required */
-	agent = required_agent(value.value);
-	if (!agent || maxdepth <= 0) {
-		on_result_cb(closure, &value);
-		return 0;
+	/* join the identical query in flight if any */
+	query = search_inflight(agent, &value.value[agent->len + 1], key, maxdepth);
+	if (query) {
+		rc = addcb(on_result_cb, closure, &query->waiters);
+		if (rc < 0)
+			on_result_cb(closure, &value);
+		return rc;
 	}
 
 	/* allocate asynchronous query */
-	query = alloc_query(on_result_cb, closure, key, maxdepth);
+	query = alloc_query(on_result_cb, closure, key, maxdepth,
+				agent, &value.value[agent->len + 1]);
 	if (!query) {
 		on_result_cb(closure, &value);
 		return -ENOMEM;
 	}
+	query->generation = generation;
+	query->next = inflight;
+	inflight = query;
 
 	/* call the agent */
 	rc = agent->agent_cb(
 			agent->name,
 			agent->closure,
 			&query->key,
-			&value.value[agent->len + 1],
+			query->value,
 			query);
 	if (rc < 0)
 		cyn_query_reply(query, &value);
@@ -545,6 +829,57 @@ cyn_check_async(
 	return cyn_query_async(on_result_cb, closure, key, CYN_SEARCH_DEEP_MAX);
 }
 
+/* see cyn.h */
+int
+cyn_query_direct(
+	on_result_cb_t *on_result_cb,
+	void *closure,
+	const data_key_t *key,
+	int maxdepth
+) {
+	int rc;
+	size_t length;
+	uint32_t generation;
+	data_value_t value;
+	char buffer[DCACHE_VALUE_SIZE];
+
+	/* get the value and copy it in buffer for releasing the rules
+	 * before calling the callback */
+	pthread_rwlock_rdlock(&rules_lock);
+	rc = !get_value(key, maxdepth, &value, buffer, &generation);
+	if (rc && value.value != buffer) {
+		length = strlen(value.value);
+		rc = length < sizeof buffer;
+		if (rc)
+			value.value = memcpy(buffer, value.value, length + 1);
+	}
+	pthread_rwlock_unlock(&rules_lock);
+
+	if (rc)
+		on_result_cb(closure, &value);
+	return rc;
+}
+
+/* see cyn.h */
+int
+cyn_test_direct(
+	on_result_cb_t *on_result_cb,
+	void *closure,
+	const data_key_t *key
+) {
+	return cyn_query_direct(on_result_cb, closure, key, 0);
+}
+
+/* see cyn.h */
+int
+cyn_check_direct(
+	on_result_cb_t *on_result_cb,
+	void *closure,
+	const data_key_t *key
+) {
+	return cyn_query_direct(on_result_cb, closure, key, CYN_SEARCH_DEEP_MAX);
+}
+
 /* see cyn.h */
 int
 cyn_query_subquery_async(
@@ -562,7 +897,26 @@ cyn_query_reply(
 	cynagora_query_t *query,
 	const data_value_t *value
 ) {
+	cynagora_query_t **prv;
+	struct callback *waiter;
+
+	/* no more in flight */
+	prv = &inflight;
+	while (*prv != query)
+		prv = &(*prv)->next;
+	*prv = query->next;
+
+	/* cache the final results of agents having an expiration */
+	if (cache_agents && value->expire > 0 && !required_agent(value->value))
+		dcache_put(query->generation, &query->key, true, value);
+
+	/* fan out the result */
 	query->on_result_cb(query->closure, value);
+	while ((waiter = query->waiters)) {
+		query->waiters = waiter->next;
+		waiter->on_result_cb(waiter->closure, value);
+		free(waiter);
+	}
 	free(query);
 }
 
@@ -574,6 +928,7 @@ cyn_agent_add(
 	void *closure
 ) {
 	struct agent *agent, **pprev;
+	uint32_t hash;
 	uint8_t length;
 
 	/* compute and check name */
@@ -582,7 +937,8 @@ cyn_agent_add(
 		return -EINVAL;
 
 	/* search the agent */
-	agent = search_agent(name, length, &pprev);
+	hash = hash_name(name, length);
+	agent = search_agent(name, length, hash, &pprev);
 	if (agent)
 		return -EEXIST;
 
@@ -596,8 +952,14 @@ cyn_agent_add(
 	agent->closure = closure;
 	agent->len = length;
 	memcpy(agent->name, name, 1 + (size_t)length);
+	agent->hash = hash;
 	agent->next = *pprev;
+	pthread_rwlock_wrlock(&rules_lock);
 	*pprev = agent;
+	if (length > agent_maxlen)
+		agent_maxlen = length;
+	dcache_clear();
+	pthread_rwlock_unlock(&rules_lock);
 
 	return 0;
 }
@@ -616,12 +978,16 @@ cyn_agent_remove_by_name(
 		return -EINVAL;
 
 	/* search the agent */
-	agent = search_agent(name, length, &pprev);
+	agent = search_agent(name, length, hash_name(name, length), &pprev);
 	if (!agent)
 		return -ENOENT;
 
 	/* remove the found agent */
-	*pprev = agent->next;
+	pthread_rwlock_wrlock(&rules_lock);
+	unlink_agent(pprev);
+	dcache_clear();
+	pthread_rwlock_unlock(&rules_lock);
+	detach_inflight(agent);
 	free(agent);
 	return 0;
 }
@@ -633,15 +999,22 @@ cyn_agent_remove_by_cc(
 	void *closure
 ) {
 	struct agent *it, **pprev;
-
-	pprev = &agents;
-	while((it = *pprev))
-		if (it->agent_cb != agent_cb || it->closure != closure)
-			pprev = &it->next;
-		else {
-			*pprev = it->next;
-			free(it);
-		}
+	unsigned i;
+
+	for (i = 0 ; i < CYN_AGENT_BUCKETS ; i++) {
+		pprev = &agents[i];
+		while((it = *pprev))
+			if (it->agent_cb != agent_cb || it->closure != closure)
+				pprev = &it->next;
+			else {
+				pthread_rwlock_wrlock(&rules_lock);
+				unlink_agent(pprev);
+				dcache_clear();
+				pthread_rwlock_unlock(&rules_lock);
+				detach_inflight(it);
+				free(it);
+			}
+	}
 }
 
 /* see cyn.h */
@@ -671,3 +1044,25 @@ cyn_changeid_string(
 	/* return the string */
 	return changeid.string;
 }
+
+/* see cyn.h */
+void
+cyn_decision_cache_setup(
+	int size,
+	bool agents
+) {
+	if (size >= 0)
+		dcache_set_size((unsigned)size);
+	cache_agents = agents;
+}
+
+/* see cyn.h */
+void
+cyn_decision_cache_stats(
+	unsigned long *hits,
+	unsigned long *misses,
+	unsigned *count,
+	unsigned *size
+) {
+	dcache_stats(hits, misses, count, size);
+}
@@ -118,6 +118,43 @@ cyn_leave(
 	bool commit
 );
 
+/**
+ * Make durable the changes committed by 'cyn_leave'. Depending on the
+ * database, committed changes may only be durable after that call.
+ * This allows to share the cost of the flush between several commits.
+ *
+ * @return 0 success
+ *         negative codes: error when flushing the database
+ *
+ * @see cyn_leave, cyn_flush_pending
+ */
+extern
+int
+cyn_flush(
+);
+
+/**
+ * Tells if committed changes are waiting a call to 'cyn_flush'
+ *
+ * @return true if 'cyn_flush' has to be called
+ *
+ * @see cyn_flush
+ */
+extern
+bool
+cyn_flush_pending(
+);
+
+/**
+ * Drop the expired rules
+ *
+ * @return the time of the next expiration of a rule or 0 if none
+ */
+extern
+time_t
+cyn_expire(
+);
+
 /**
  * Enter asynchronously in the critical recoverable section if possible.
  * If the critical recoverable section is free, lock it with magic,
@@ -306,6 +343,70 @@ cyn_check_async(
 	const data_key_t *key
 );
 
+/**
+ * Query the value for the given key if it doesn't require an agent.
+ *
+ * Unlike other functions, this function can be called by any thread
+ * while the main thread runs. The callback is called during the call
+ * after the rules are released.
+ *
+ * @param on_result_cb callback function receiving the result
+ * @param closure closure for the callback
+ * @param key key to be queried
+ * @param maxdepth maximum imbrication of agent resolution
+ * @return 1 if the callback was called or 0 if an agent is required
+ * or if the value is too long to be copied, in that case, the query
+ * must be made by the main thread using cyn_query_async
+ *
+ * @see cyn_test_direct, cyn_check_direct
+ */
+extern
+int
+cyn_query_direct(
+	on_result_cb_t *on_result_cb,
+	void *closure,
+	const data_key_t *key,
+	int maxdepth
+);
+
+/**
+ * Same as cyn_query_direct but with a maxdepth of 0,
+ * the callback is called unless the value is too long
+ *
+ * @param on_result_cb callback function receiving the result
+ * @param closure closure for the callback
+ * @param key key to be queried
+ * @return 1 if the callback was called or 0 if the value is too long
+ *
+ * @see cyn_query_direct, cyn_check_direct
+ */
+extern
+int
+cyn_test_direct(
+	on_result_cb_t *on_result_cb,
+	void *closure,
+	const data_key_t *key
+);
+
+/**
+ * Same as cyn_query_direct but with a default maxdepth for agent subqueries
+ *
+ * @param on_result_cb callback function receiving the result
+ * @param closure closure for the callback
+ * @param key key to be queried
+ * @return 1 if the callback was called or 0 if an agent is required
+ * or if the value is too long
+ *
+ * @see cyn_query_direct, cyn_test_direct
+ */
+extern
+int
+cyn_check_direct(
+	on_result_cb_t *on_result_cb,
+	void *closure,
+	const data_key_t *key
+);
+
 /**
  * Makes a recursive query asynchronous
  *
@@ -425,3 +526,40 @@ extern
 const char *
 cyn_changeid_string(
 );
+
+/**
+ * Setup the cache of the decisions made using the database.
+ * The cache is cleared on any change.
+ *
+ * @param size count of decisions kept by the cache, 0 disables the cache,
+ *             a negative value keeps the current count
+ * @param agents if true, the results of agents having an expiration
+ *               are also cached
+ *
+ * @see cyn_decision_cache_stats
+ */
+extern
+void
+cyn_decision_cache_setup(
+	int size,
+	bool agents
+);
+
+/**
+ * Get the statistics of the cache of decisions
+ *
+ * @param hits where to store the count of decisions found in the cache
+ * @param misses where to store the count of decisions not found in the cache
+ * @param count where to store the count of decisions in the cache
+ * @param size where to store the count of decisions the cache can hold
+ *
+ * @see cyn_decision_cache_setup
+ */
+extern
+void
+cyn_decision_cache_stats(
+	unsigned long *hits,
+	unsigned long *misses,
+	unsigned *count,
+	unsigned *size
+);
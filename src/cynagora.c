@@ -40,6 +40,7 @@
 #include "cyn-protocol.h"
 #include "cynagora.h"
 #include "cache.h"
+#include "shcache.h"
 #include "socket.h"
 #include "expire.h"
 #include "idgen.h"
@@ -123,6 +124,15 @@ struct cynagora
 	/** cache  object */
 	cache_t *cache;
 
+	/** cache shared by the server */
+	struct {
+		/** the mapped shared cache or NULL */
+		shcache_t *cache;
+
+		/** the cacheid given by the server */
+		uint32_t cacheid;
+	} shared;
+
 	/** copy of the reply */
 	struct {
 		/** count of fields of the reply */
@@ -153,6 +163,9 @@ struct cynagora
 	/** id generator */
 	idgen_t idgen;
 
+	/** last numeric id */
+	unsigned numid;
+
 	/** spec of the socket */
 	char socketspec[];
 };
@@ -246,7 +259,7 @@ flushw(
 }
 
 /**
- * Send a reply
+ * Put a reply in the output buffer, flushing it only if it is full
  *
  * @param cynagora the client
  * @param fields the fields to send
@@ -255,7 +268,7 @@ flushw(
  */
 static
 int
-send_reply(
+put_reply(
 	cynagora_t *cynagora,
 	const char **fields,
 	int count
@@ -272,13 +285,11 @@ send_reply(
 		for (i = rc = 0 ; i < count && rc == 0 ; i++)
 			rc = prot_put_field(prot, fields[i]);
 
-		/* send if done */
+		/* done if terminated */
 		if (rc == 0) {
 			rc = prot_put_end(prot);
-			if (rc == 0) {
-				rc = flushw(cynagora);
+			if (rc == 0)
 				break;
-			}
 		}
 
 		/* failed to fill protocol, cancel current composition  */
@@ -298,6 +309,25 @@ send_reply(
 	return rc;
 }
 
+/**
+ * Send a reply
+ *
+ * @param cynagora the client
+ * @param fields the fields to send
+ * @param count the count of fields
+ * @return 0 on success or a negative error code
+ */
+static
+int
+send_reply(
+	cynagora_t *cynagora,
+	const char **fields,
+	int count
+) {
+	int rc = put_reply(cynagora, fields, count);
+	return rc ? rc : flushw(cynagora);
+}
+
 /**
  * Put the command made of arguments ...
  * Increment the count of pending requests.
@@ -389,6 +419,47 @@ wait_input(
 	return rc < 0 ? -errno : 0;
 }
 
+/**
+ * Stop using the cache shared by the server
+ *
+ * @param cynagora  the handler of the client
+ */
+static
+void
+shared_close(
+	cynagora_t *cynagora
+) {
+	shcache_close(cynagora->shared.cache);
+	cynagora->shared.cache = NULL;
+	cynagora->shared.cacheid = 0;
+}
+
+/**
+ * Search the key in the cache of the client and, for checks,
+ * in the cache shared by the server
+ *
+ * @param cynagora  the handler of the client
+ * @param key       the key to search
+ * @param check     is it a check? otherwise it is a test
+ *
+ * @return the cached status or -ENOENT
+ */
+static
+int
+search_cache(
+	cynagora_t *cynagora,
+	const cynagora_key_t *key,
+	bool check
+) {
+	int rc;
+
+	rc = cache_search(cynagora->cache, key);
+	if (rc == -ENOENT && check && cynagora->cache && cynagora->shared.cache)
+		rc = shcache_search(cynagora->shared.cache, cynagora->shared.cacheid,
+				key->client, key->session, key->user, key->permission);
+	return rc;
+}
+
 /**
  * Get the next reply if any
  *
@@ -414,6 +485,7 @@ get_reply(
 			/* clearing the cache */
 			cacheid = rc > 1 ? (uint32_t)atol(cynagora->reply.fields[1]) : 0;
 			cache_clear(cynagora->cache, cacheid);
+			cynagora->shared.cacheid = cacheid;
 			rc = 0;
 		} else if (0 == strcmp(first, _ask_)) {
 			/* on asking agent */
@@ -456,19 +528,22 @@ wait_reply(
 		if (rc > 0)
 			return rc;
 
-		if (rc < 0) {
+		if (rc == -EAGAIN) {
 			/* wait for an answer */
 			rc = prot_read(cynagora->prot, cynagora->fd);
 			while (rc <= 0) {
-				if (rc == 0)
+				if (rc == 0) {
+					shared_close(cynagora);
 					return -(errno = EPIPE);
+				}
 				if (rc == -EAGAIN && block)
 					rc = wait_input(cynagora);
 				if (rc < 0)
 					return rc;
 				rc = prot_read(cynagora->prot, cynagora->fd);
 			}
-		}
+		} else if (rc < 0)
+			return rc;
 	}
 }
 
@@ -542,6 +617,26 @@ status_done(
 	return strcmp(cynagora->reply.fields[0], _done_) ? -ECANCELED : 0;
 }
 
+/**
+ * Translates the text of an expiration of a reply
+ *
+ * @param text      the text of the expiration or NULL if missing
+ * @param expire    where to store the expiration read
+ */
+static
+void
+get_expire(
+	const char *text,
+	time_t *expire
+) {
+	if (!text)
+		*expire = 0;
+	else if (text[0] == '-')
+		*expire = -1;
+	else
+		txt2exp(text, expire, true);
+}
+
 /**
  * Translates the check/test reply to a forbiden/granted status
  *
@@ -568,13 +663,38 @@ status_check(
 	else
 		rc = -EPROTO;
 
-	if (count < 3)
-		*expire = 0;
-	else if (cynagora->reply.fields[2][0] == '-')
-		*expire = -1;
+	get_expire(count < 3 ? NULL : cynagora->reply.fields[2], expire);
+	return rc;
+}
+
+/**
+ * Translates a result of the reply to checkm to a forbiden/granted status
+ *
+ * @param text      the result: yes or no optionally followed by :EXPIRE
+ * @param expire    where to store the expiration read
+ *
+ * @return  0 if forbidden, 1 if granted or -EPROTO
+ */
+static
+int
+status_result(
+	const char *text,
+	time_t *expire
+) {
+	const char *sep;
+	size_t len;
+	int rc;
+
+	sep = strchr(text, ':');
+	len = sep ? (size_t)(sep - text) : strlen(text);
+	if (!strncmp(text, _yes_, len) && !_yes_[len])
+		rc = 1;
+	else if (!strncmp(text, _no_, len) && !_no_[len])
+		rc = 0;
 	else
-		txt2exp(cynagora->reply.fields[2], expire, true);
+		rc = -EPROTO;
 
+	get_expire(sep ? sep + 1 : NULL, expire);
 	return rc;
 }
 
@@ -643,6 +763,7 @@ disconnection(
 		async_control(cynagora, EPOLL_CTL_DEL, 0);
 		close(cynagora->fd);
 		cynagora->fd = -1;
+		shared_close(cynagora);
 	}
 }
 
@@ -658,7 +779,8 @@ int
 connection(
 	cynagora_t *cynagora
 ) {
-	int rc;
+	static const char *hello[] = { _cynagora_, "1", "2" };
+	int rc, fd;
 	agent_t *agent;
 
 	/* init the client */
@@ -668,16 +790,31 @@ connection(
 	if (cynagora->fd < 0)
 		return -errno;
 
-	/* negociate the protocol */
-	rc = putxkv(cynagora, _cynagora_, "1", 0, 0);
+	/* the check server can pass its shared cache with its reply */
+	prot_set_accept_fd(cynagora->prot, cynagora->type == cynagora_Check);
+
+	/* negociate the protocol, proposing versions 1 and 2 */
+	rc = send_reply(cynagora, hello, 3);
 	if (rc >= 0) {
 		rc = wait_any_reply(cynagora);
 		if (rc >= 0) {
 			rc = -EPROTO;
 			if (cynagora->reply.count >= 2
 			 && 0 == strcmp(cynagora->reply.fields[0], _done_)
-			 && 0 == strcmp(cynagora->reply.fields[1], "1")) {
+			 && (0 == strcmp(cynagora->reply.fields[1], "1")
+			  || (0 == strcmp(cynagora->reply.fields[1], "2")
+			   && 0 == (rc = prot_set_binary(cynagora->prot, 1))))) {
 				cache_clear(cynagora->cache, 0);
+				/* use the cache shared by the server if any */
+				fd = prot_take_fd(cynagora->prot);
+				prot_set_accept_fd(cynagora->prot, 0);
+				if (fd >= 0) {
+					if (cynagora->reply.count >= 4 && cynagora->cache
+					 && !strcmp(cynagora->reply.fields[3], _shared_)
+					 && shcache_open(&cynagora->shared.cache, fd) == 0)
+						cynagora->shared.cacheid = (uint32_t)atol(cynagora->reply.fields[2]);
+					close(fd);
+				}
 				rc = async_control(cynagora, EPOLL_CTL_ADD, EPOLLIN);
 				/* reconnect agent */
 				agent = cynagora->agents;
@@ -748,7 +885,7 @@ check_or_test(
 		/* ensure there is no clear cache pending */
 		flushr(cynagora);
 
-		rc = cache_search(cynagora->cache, key);
+		rc = search_cache(cynagora, key, action == _check_);
 		if (rc >= 0)
 			goto end;
 	}
@@ -826,6 +963,24 @@ async_reply_process(
 	return 1;
 }
 
+/**
+ * Generate the next id of request. With the binary framing, ids are
+ * decimal numbers because the framing sends them as their value.
+ *
+ * @param cynagora  the handler of the client
+ */
+static
+void
+next_id(
+	cynagora_t *cynagora
+) {
+	if (prot_is_binary(cynagora->prot)) {
+		cynagora->numid = cynagora->numid % 999999 + 1;
+		snprintf(cynagora->idgen, sizeof cynagora->idgen, "%u", cynagora->numid);
+	} else
+		idgen_next(cynagora->idgen);
+}
+
 static
 int
 async_check(
@@ -854,7 +1009,7 @@ async_check(
 		/* ensure there is no clear cache pending */
 		flushr(cynagora);
 
-		rc = cache_search(cynagora->cache, key);
+		rc = search_cache(cynagora, key, !simple);
 		if (rc >= 0) {
 			callback(closure, rc);
 			return 0;
@@ -906,7 +1061,7 @@ async_check(
 	ar->key.permission = p;
 	stpcpy(p, key->permission);
 	do {
-		idgen_next(cynagora->idgen);
+		next_id(cynagora);
 	} while (search_async_request(cynagora, cynagora->idgen, false));
 	strcpy(ar->id, cynagora->idgen);
 	ar->next = cynagora->async.requests;
@@ -989,6 +1144,8 @@ cynagora_create(
 
 	/* record type and weakly create cache */
 	cache_create(&cynagora->cache, CACHESIZE(cache_size)); /* ignore errors */
+	cynagora->shared.cache = NULL;
+	cynagora->shared.cacheid = 0;
 	cynagora->entered = false;
 	cynagora->synclock = false;
 	cynagora->type = type;
@@ -998,6 +1155,7 @@ cynagora_create(
 	cynagora->agents = NULL;
 	cynagora->queries = NULL;
 	idgen_init(cynagora->idgen);
+	cynagora->numid = 0;
 
 	/* lazy connection */
 	cynagora->fd = -1;
@@ -1104,7 +1262,7 @@ cynagora_cache_check(
 ) {
 	/* ensure there is no clear cache pending */
 	flushr(cynagora);
-	return cache_search(cynagora->cache, key);
+	return search_cache(cynagora, key, true);
 }
 
 /* see cynagora.h */
@@ -1127,6 +1285,139 @@ cynagora_test(
 	return check_or_test(cynagora, key, force, _test_);
 }
 
+/**
+ * Check if the keys have the same client, session and user
+ *
+ * @param a the first key
+ * @param b the second key
+ *
+ * @return true if client, session and user are the same
+ */
+static
+bool
+same_subject(
+	const cynagora_key_t *a,
+	const cynagora_key_t *b
+) {
+	return !strcmp(a->client, b->client)
+		&& !strcmp(a->session, b->session)
+		&& !strcmp(a->user, b->user);
+}
+
+/* see cynagora.h */
+int
+cynagora_check_many(
+	cynagora_t *cynagora,
+	const cynagora_key_t *keys,
+	int *results,
+	unsigned count,
+	int force
+) {
+	int rc, nf, status;
+	unsigned i, j, k, m, n, nmsg, nrep, *index, *starts;
+	time_t expire;
+	char id[16];
+	const char *fields[5 + CHECKM_MAX_PERMISSIONS];
+	bool batch;
+
+	if (!synchronous_enter(cynagora))
+		return -EBUSY;
+
+	/* ensure opened */
+	rc = ensure_opened(cynagora);
+	if (rc < 0)
+		goto end;
+
+	/* check cache items */
+	if (!force)
+		flushr(cynagora);
+	for (i = n = 0 ; i < count ; i++) {
+		results[i] = force ? -ENOENT : search_cache(cynagora, &keys[i], true);
+		n += results[i] == -ENOENT;
+	}
+	if (n == 0)
+		goto end;
+
+	/* messages are the ranges starts[m]..starts[m+1] of index */
+	index = malloc((2 * n + 1) * sizeof *index);
+	if (index == NULL) {
+		rc = -ENOMEM;
+		goto end;
+	}
+	starts = &index[n];
+
+	/* with the version 2, group the keys of same subject in checkm */
+	batch = prot_is_binary(cynagora->prot);
+	for (i = j = nmsg = 0 ; i < count ; i++) {
+		if (results[i] != -ENOENT)
+			continue;
+		starts[nmsg++] = j;
+		index[j++] = i;
+		results[i] = -EAGAIN;
+		for (k = i + 1 ; batch && k < count
+				&& j - starts[nmsg - 1] < CHECKM_MAX_PERMISSIONS ; k++) {
+			if (results[k] == -ENOENT && same_subject(&keys[i], &keys[k])) {
+				index[j++] = k;
+				results[k] = -EAGAIN;
+			}
+		}
+	}
+	starts[nmsg] = j;
+
+	/* send the requests at once */
+	for (m = 0 ; m < nmsg && rc >= 0 ; m++) {
+		i = index[starts[m]];
+		snprintf(id, sizeof id, "{%u}", m);
+		fields[0] = batch ? _checkm_ : _check_;
+		fields[1] = id;
+		fields[2] = keys[i].client;
+		fields[3] = keys[i].session;
+		fields[4] = keys[i].user;
+		nf = 5;
+		for (j = starts[m] ; j < starts[m + 1] ; j++)
+			fields[nf++] = keys[index[j]].permission;
+		rc = put_reply(cynagora, fields, nf);
+	}
+	if (rc >= 0)
+		rc = flushw(cynagora);
+
+	/* get the replies */
+	for (nrep = 0 ; nrep < nmsg && rc >= 0 ; nrep++) {
+		rc = wait_any_reply(cynagora);
+		if (rc < 0)
+			break;
+		if (rc < 2 || sscanf(cynagora->reply.fields[1], "{%u}", &m) != 1
+		 || m >= nmsg || results[index[starts[m]]] != -EAGAIN
+		 || (batch && (strcmp(cynagora->reply.fields[0], _done_)
+				|| (unsigned)rc != 2 + starts[m + 1] - starts[m]))) {
+			rc = -EPROTO;
+			break;
+		}
+		for (j = starts[m] ; j < starts[m + 1] ; j++) {
+			i = index[j];
+			if (batch)
+				status = status_result(cynagora->reply.fields[2 + j - starts[m]], &expire);
+			else
+				status = status_check(cynagora, rc, &expire);
+			results[i] = status;
+			if (status >= 0)
+				cache_put(cynagora->cache, &keys[i], status, expire, true);
+		}
+		rc = 0;
+	}
+	free(index);
+
+	/* on error, the remaining replies would be out of sync */
+	if (rc < 0) {
+		for (i = 0 ; i < count ; i++)
+			if (results[i] == -EAGAIN)
+				results[i] = rc;
+		disconnection(cynagora);
+	}
+end:
+	return synchronous_leave(cynagora, rc < 0 ? rc : 0);
+}
+
 /* see cynagora.h */
 int
 cynagora_async_check(
@@ -1216,6 +1507,37 @@ cynagora_log(
 	return synchronous_leave(cynagora, rc);
 }
 
+/* see cynagora.h */
+int
+cynagora_stats(
+	cynagora_t *cynagora,
+	cynagora_stats_cb_t *callback,
+	void *closure
+) {
+	int rc;
+
+	if (cynagora->type != cynagora_Admin)
+		return -EPERM;
+
+	if (!synchronous_enter(cynagora))
+		return -EBUSY;
+
+	rc = ensure_opened(cynagora);
+	if (rc >= 0) {
+		rc = putxkv(cynagora, _stats_, 0, 0, 0);
+		if (rc >= 0) {
+			rc = wait_reply(cynagora, true);
+			while (rc == 3 && !strcmp(cynagora->reply.fields[0], _item_)) {
+				callback(closure, cynagora->reply.fields[1],
+					strtoul(cynagora->reply.fields[2], NULL, 10));
+				rc = wait_reply(cynagora, true);
+			}
+			rc = status_done(cynagora);
+		}
+	}
+	return synchronous_leave(cynagora, rc);
+}
+
 /* see cynagora.h */
 int
 cynagora_enter(
@@ -89,6 +89,8 @@ typedef int cynagora_async_ctl_cb_t(
 /**
  * Create a client to the permission server cynagora
  * The client is created but not connected. The connection is made on need.
+ * When it has a cache, the client also uses the cache of decisions that
+ * the server shares with its check clients if any.
  *
  * @param cynagora   pointer to the handle of the opened client
  * @param type       type of the client to open
@@ -256,6 +258,35 @@ cynagora_test(
 	int force
 );
 
+/**
+ * Query the permission database for many keys at once (synchronous)
+ * Allows agent resolution. The requests are sent together and, when the
+ * server supports it, the keys of same client, session and user are
+ * checked by a single request.
+ *
+ * @param cynagora the client handler
+ * @param keys     the keys to check
+ * @param results  where to store the result of each key: 0 if permission
+ *                 forbidden, 1 if permission granted or if error a negative
+ *                 -errno value
+ * @param count    the count of keys and of results
+ * @param force    if not set forbids cache use
+ *
+ * @return 0 on success or if error a negative -errno value
+ *         -EBUSY if pending synchronous request
+ *
+ * @see cynagora_check
+ */
+extern
+int
+cynagora_check_many(
+	cynagora_t *cynagora,
+	const cynagora_key_t *keys,
+	int *results,
+	unsigned count,
+	int force
+);
+
 /**
  * Check the key asynchronously (async)
  *
@@ -348,6 +379,37 @@ cynagora_log(
 	int off
 );
 
+/**
+ * Callback for enumeration of statistics (admin)
+ * The function is called for each statistic of the server
+ * with its name and its value
+ *
+ * @see cynagora_stats
+ */
+typedef void cynagora_stats_cb_t(
+			void *closure,
+			const char *name,
+			unsigned long value);
+
+/**
+ * Get the statistics of the server (admin, synchronous)
+ *
+ * @param cynagora the client handler
+ * @param callback the callback for receiving statistics
+ * @param closure  closure of the callback
+ *
+ * @return 0 in case of success or a negative -errno value
+ *         -EPERM if not a admin client
+ *         -EBUSY if pending synchronous request
+ */
+extern
+int
+cynagora_stats(
+	cynagora_t *cynagora,
+	cynagora_stats_cb_t *callback,
+	void *closure
+);
+
 /**
  * Enter cancelable section for modifying database (admin, synchronous)
  *
@@ -49,7 +49,7 @@ static int end(int rc)
 		cyn_leave(begin, 0);
 	else {
 		/* commit the changes */
-		rc = cyn_leave(begin, 1);
+		rc = cyn_leave(begin, 1) ?: cyn_flush();
 		if (rc < 0)
 			fprintf(stderr, "unable to commit changes\n");
 	}
@@ -40,6 +40,19 @@
 static anydb_t *memdb;
 static anydb_t *filedb;
 static bool modifiable;
+static bool unflushed;
+
+/** snapshot of the database: copies of memdb and filedb */
+static struct {
+	/** copy of memdb */
+	anydb_t *memdb;
+
+	/** copy of filedb */
+	anydb_t *filedb;
+
+	/** is the snapshot tested instead of the database? */
+	bool used;
+} snapshot;
 
 /**
  * check whether the 'text' fit String_Any, String_Wide, NULL or ""
@@ -158,6 +171,22 @@ db_drop(
 	return 0;
 }
 
+/* see db.h */
+int
+db_drop_batch(
+	const data_key_t *keys,
+	unsigned count
+) {
+	int rc1, rc2;
+
+	if (!modifiable)
+		return -EACCES;
+
+	rc1 = anydb_drop_batch(filedb, keys, count);
+	rc2 = anydb_drop_batch(memdb, keys, count);
+	return rc1 ?: rc2;
+}
+
 /* see db.h */
 int
 db_set(
@@ -183,8 +212,13 @@ db_test(
 	unsigned s1, s2;
 	data_value_t v1, v2;
 
-	s1 = anydb_test(memdb, key, &v1);
-	s2 = anydb_test(filedb, key, &v2);
+	if (snapshot.used) {
+		s1 = anydb_test(snapshot.memdb, key, &v1);
+		s2 = anydb_test(snapshot.filedb, key, &v2);
+	} else {
+		s1 = anydb_test(memdb, key, &v1);
+		s2 = anydb_test(filedb, key, &v2);
+	}
 	if (s2 > s1) {
 		*value = v2;
 		return s2;
@@ -203,12 +237,90 @@ db_cleanup(
 	return 0;
 }
 
+/* see db.h */
+time_t
+db_expire(
+) {
+	time_t t1 = anydb_expire(filedb);
+	time_t t2 = anydb_expire(memdb);
+	return !t1 || (t2 && t2 < t1) ? t2 : t1;
+}
+
 /* see db.h */
 int
 db_sync(
 ) {
 	int rc1 = anydb_sync(filedb);
 	int rc2 = anydb_sync(memdb);
+	if (rc1 == 0 && anydb_has_flush(filedb))
+		unflushed = true;
 	return rc1 ?: rc2;
 }
 
+/* see db.h */
+int
+db_flush(
+) {
+	int rc = 0;
+
+	if (unflushed) {
+		rc = anydb_flush(filedb);
+		unflushed = rc < 0;
+	}
+	return rc;
+}
+
+/* see db.h */
+bool
+db_flush_pending(
+) {
+	return unflushed;
+}
+
+/* see db.h */
+int
+db_snapshot_make(
+) {
+	int rc;
+
+	if (snapshot.memdb)
+		return -EALREADY;
+
+	rc = memdb_create(&snapshot.memdb);
+	if (rc == 0) {
+		rc = memdb_create(&snapshot.filedb);
+		if (rc == 0) {
+			rc = anydb_copy(snapshot.memdb, memdb);
+			if (rc == 0) {
+				rc = anydb_copy(snapshot.filedb, filedb);
+				if (rc == 0)
+					return 0;
+			}
+			anydb_destroy(snapshot.filedb);
+		}
+		anydb_destroy(snapshot.memdb);
+	}
+	snapshot.memdb = snapshot.filedb = NULL;
+	return rc;
+}
+
+/* see db.h */
+void
+db_snapshot_use(
+	bool use
+) {
+	snapshot.used = use && snapshot.memdb;
+}
+
+/* see db.h */
+void
+db_snapshot_drop(
+) {
+	if (snapshot.memdb) {
+		if (snapshot.used)
+			snapshot.used = false;
+		anydb_destroy(snapshot.filedb);
+		anydb_destroy(snapshot.memdb);
+		snapshot.memdb = snapshot.filedb = NULL;
+	}
+}
@@ -93,6 +93,22 @@ db_drop(
 	const data_key_t *key
 );
 
+/**
+ * Erase rules matching one of the keys, in one pass over the rules
+ *
+ * @param keys the search keys for the rules to remove
+ * @param count the count of keys
+ * @return 0 in case of success or a negative -errno like value
+ *
+ * @see db_transaction_begin, db_transaction_end, db_drop
+ */
+extern
+int
+db_drop_batch(
+	const data_key_t *keys,
+	unsigned count
+);
+
 /**
  * Add the rule of key and value
  *
@@ -142,6 +158,45 @@ db_test(
 	data_value_t *value
 );
 
+/**
+ * Make a snapshot of the current content of the database. Making the
+ * snapshot doesn't modify the database.
+ *
+ * @return 0 in case of success or a negative -errno like value
+ *
+ * @see db_snapshot_use, db_snapshot_drop
+ */
+extern
+int
+db_snapshot_make(
+);
+
+/**
+ * Set whether db_test searches the snapshot instead of the database. While
+ * the snapshot is used, the database can be modified without disturbing
+ * the tests. No test must be running when switching.
+ *
+ * @param use true for testing the snapshot, false for testing the database
+ *
+ * @see db_snapshot_make, db_snapshot_drop
+ */
+extern
+void
+db_snapshot_use(
+	bool use
+);
+
+/**
+ * Drop the snapshot and test again the database. No test must be running
+ * if the snapshot is still used.
+ *
+ * @see db_snapshot_make, db_snapshot_use
+ */
+extern
+void
+db_snapshot_drop(
+);
+
 /**
  * Cleanup the database by removing expired items
  *
@@ -152,6 +207,16 @@ int
 db_cleanup(
 );
 
+/**
+ * Drop the expired items and get the time of the next expiration
+ *
+ * @return the time of the next expiration of an item or 0 if none
+ */
+extern
+time_t
+db_expire(
+);
+
 /**
  * Write the database to the file system (synchrnize it)
  *
@@ -161,3 +226,24 @@ extern
 int
 db_sync(
 );
+
+/**
+ * Flush the synchronized database to the file system, making the
+ * synchronized changes durable
+ *
+ * @return 0 in case of success or a negative -errno like value
+ */
+extern
+int
+db_flush(
+);
+
+/**
+ * Tells if synchronized changes are waiting to be flushed
+ *
+ * @return true if db_flush has to be called
+ */
+extern
+bool
+db_flush_pending(
+);
@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/******************************************************************************/
+/******************************************************************************/
+/* IMPLEMENTATION OF THE CACHE OF DECISIONS OF THE SERVER                     */
+/******************************************************************************/
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "data.h"
+#include "dcache.h"
+
+#if !defined(DCACHE_DEFAULT_SIZE)
+# define DCACHE_DEFAULT_SIZE 4096
+#endif
+#if !defined(DCACHE_BUCKET_DEPTH)
+# define DCACHE_BUCKET_DEPTH 8
+#endif
+
+/**
+ * An entry of the cache
+ */
+struct entry
+{
+	/** next entry of the bucket */
+	struct entry *next;
+
+	/** hash of the key */
+	uint32_t hash;
+
+	/** is the value resolved by agents? */
+	bool resolved;
+
+	/** was the entry used since the last eviction in its bucket? */
+	bool referenced;
+
+	/** expiration of the value */
+	time_t expire;
+
+	/** the value */
+	const char *value;
+
+	/** session, user, permission and value follow the client */
+	char client[];
+};
+typedef struct entry entry_t;
+
+/**
+ * A bucket of the cache. Each bucket has its own lock and keeps at most
+ * 'depth' entries. When full, the entry evicted is the oldest one not used
+ * since the last eviction (second chance), approximating LRU.
+ */
+struct bucket
+{
+	/** lock of the bucket */
+	pthread_mutex_t mutex;
+
+	/** entries of the bucket, the oldest first */
+	entry_t *head;
+
+	/** count of entries of the bucket */
+	unsigned count;
+};
+typedef struct bucket bucket_t;
+
+/** initialization of the buckets */
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/** count of entries to keep, 0 when disabled */
+static unsigned size = DCACHE_DEFAULT_SIZE;
+
+/** count of buckets, a power of 2, 0 when disabled */
+static unsigned nbuckets;
+
+/** count of entries to keep in each bucket */
+static unsigned depth;
+
+/** the buckets */
+static bucket_t *buckets;
+
+/** count of recorded entries (atomic) */
+static unsigned count;
+
+/** generation of the content (atomic) */
+static uint32_t generation;
+
+/** count of successful searches (atomic) */
+static unsigned long hits;
+
+/** count of failed searches (atomic) */
+static unsigned long misses;
+
+/**
+ * Compute the hash of the key, the permission being case insensitive
+ *
+ * @param key the key to hash
+ * @param resolved is the value resolved by agents?
+ * @return the hash of the key
+ */
+static
+uint32_t
+hashkey(
+	const data_key_t *key,
+	bool resolved
+) {
+	const unsigned char *s;
+	uint32_t h = 2166136261u;
+
+	for (s = (const unsigned char*)key->client ; *s ; s++)
+		h = (h ^ *s) * 16777619u;
+	h = (h ^ 1) * 16777619u;
+	for (s = (const unsigned char*)key->session ; *s ; s++)
+		h = (h ^ *s) * 16777619u;
+	h = (h ^ 2) * 16777619u;
+	for (s = (const unsigned char*)key->user ; *s ; s++)
+		h = (h ^ *s) * 16777619u;
+	h = (h ^ 3) * 16777619u;
+	for (s = (const unsigned char*)key->permission ; *s ; s++)
+		h = (h ^ (unsigned)toupper(*s)) * 16777619u;
+	h = (h ^ (resolved ? 5 : 4)) * 16777619u;
+	return h ^ (h >> 16);
+}
+
+/**
+ * Check if the key is valid for the cache
+ *
+ * @param key the key to check
+ * @return true if the key can be cached
+ */
+static
+bool
+cachable(
+	const data_key_t *key
+) {
+	return key->client && key->session && key->user && key->permission;
+}
+
+/**
+ * Compute the effective expiration of an expire value
+ *
+ * @param expire the expire value
+ * @return the effective expiration, 0 for never
+ */
+static
+time_t
+expiration(
+	time_t expire
+) {
+	return expire < 0 ? -(expire + 1) : expire;
+}
+
+/**
+ * Allocate the buckets for keeping 'sz' entries
+ *
+ * @param sz count of entries to keep, 0 disables the cache
+ */
+static
+void
+setup(
+	unsigned sz
+) {
+	unsigned i, n;
+
+	for (n = 1 ; n * DCACHE_BUCKET_DEPTH < sz ; n <<= 1);
+	buckets = sz ? calloc(n, sizeof *buckets) : NULL;
+	nbuckets = buckets ? n : 0;
+	depth = (sz + n - 1) / n;
+	size = nbuckets ? sz : 0;
+	for (i = 0 ; i < nbuckets ; i++)
+		pthread_mutex_init(&buckets[i].mutex, NULL);
+}
+
+/**
+ * Allocate the buckets for the default size
+ */
+static
+void
+init(
+) {
+	setup(size);
+}
+
+/**
+ * Remove the entry from its bucket and free it
+ *
+ * @param bucket the bucket of the entry
+ * @param prv the pointer referencing the entry
+ */
+static
+void
+drop(
+	bucket_t *bucket,
+	entry_t **prv
+) {
+	entry_t *entry = *prv;
+
+	*prv = entry->next;
+	free(entry);
+	bucket->count--;
+	__atomic_sub_fetch(&count, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Remove from the full bucket the oldest entry not used since the last
+ * eviction, or the oldest entry if all were used
+ *
+ * @param bucket the bucket
+ */
+static
+void
+evict(
+	bucket_t *bucket
+) {
+	entry_t **prv;
+
+	for (prv = &bucket->head ; *prv ; prv = &(*prv)->next) {
+		if (!(*prv)->referenced)
+			break;
+		(*prv)->referenced = false;
+	}
+	drop(bucket, *prv ? prv : &bucket->head);
+}
+
+/**
+ * Search the entry of the key in its bucket
+ *
+ * @param bucket the bucket of the key
+ * @param key the key to search
+ * @param resolved is the value resolved by agents?
+ * @param hash the hash of the key
+ * @return the pointer referencing the found entry or the last one
+ */
+static
+entry_t **
+search(
+	bucket_t *bucket,
+	const data_key_t *key,
+	bool resolved,
+	uint32_t hash
+) {
+	entry_t **prv, *entry;
+	const char *s;
+
+	for (prv = &bucket->head ; (entry = *prv) ; prv = &entry->next) {
+		if (entry->hash != hash || entry->resolved != resolved)
+			continue;
+		s = entry->client;
+		if (strcmp(s, key->client))
+			continue;
+		s = &s[1 + strlen(s)];
+		if (strcmp(s, key->session))
+			continue;
+		s = &s[1 + strlen(s)];
+		if (strcmp(s, key->user))
+			continue;
+		s = &s[1 + strlen(s)];
+		if (!strcasecmp(s, key->permission))
+			break;
+	}
+	return prv;
+}
+
+/**
+ * Remove all the entries
+ */
+static
+void
+reset(
+) {
+	unsigned i;
+	bucket_t *bucket;
+
+	/* entries computed before are not recorded after */
+	__atomic_add_fetch(&generation, 1, __ATOMIC_ACQ_REL);
+	for (i = 0 ; i < nbuckets ; i++) {
+		bucket = &buckets[i];
+		pthread_mutex_lock(&bucket->mutex);
+		while (bucket->head)
+			drop(bucket, &bucket->head);
+		pthread_mutex_unlock(&bucket->mutex);
+	}
+}
+
+/* see dcache.h */
+void
+dcache_set_size(
+	unsigned sz
+) {
+	unsigned i;
+
+	pthread_once(&once, init);
+	reset();
+	for (i = 0 ; i < nbuckets ; i++)
+		pthread_mutex_destroy(&buckets[i].mutex);
+	free(buckets);
+	setup(sz);
+}
+
+/* see dcache.h */
+void
+dcache_clear(
+) {
+	pthread_once(&once, init);
+	reset();
+}
+
+/* see dcache.h */
+uint32_t
+dcache_generation(
+) {
+	return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+/* see dcache.h */
+bool
+dcache_get(
+	const data_key_t *key,
+	bool resolved,
+	data_value_t *value,
+	char *buffer
+) {
+	bucket_t *bucket;
+	entry_t **prv, *entry;
+	uint32_t hash;
+	time_t expire;
+
+	if (!cachable(key))
+		return false;
+	pthread_once(&once, init);
+	if (!nbuckets)
+		return false;
+
+	hash = hashkey(key, resolved);
+	bucket = &buckets[hash & (nbuckets - 1)];
+	pthread_mutex_lock(&bucket->mutex);
+	prv = search(bucket, key, resolved, hash);
+	entry = *prv;
+	if (entry) {
+		expire = expiration(entry->expire);
+		if (expire && expire <= time(NULL)) {
+			drop(bucket, prv);
+			entry = NULL;
+		}
+		else {
+			entry->referenced = true;
+			value->value = strcpy(buffer, entry->value);
+			value->expire = entry->expire;
+		}
+	}
+	pthread_mutex_unlock(&bucket->mutex);
+
+	__atomic_add_fetch(entry ? &hits : &misses, 1, __ATOMIC_RELAXED);
+	return entry != NULL;
+}
+
+/* see dcache.h */
+void
+dcache_put(
+	uint32_t gen,
+	const data_key_t *key,
+	bool resolved,
+	const data_value_t *value
+) {
+	size_t szcli, szses, szuse, szper, szval;
+	uint32_t hash;
+	bucket_t *bucket;
+	entry_t *entry, **prv;
+	time_t expire;
+	char *ptr;
+
+	/* check if cachable */
+	if (!cachable(key))
+		return;
+	pthread_once(&once, init);
+	if (!nbuckets)
+		return;
+	szval = 1 + strlen(value->value);
+	if (szval > DCACHE_VALUE_SIZE)
+		return;
+	expire = expiration(value->expire);
+	if (expire && expire <= time(NULL))
+		return;
+
+	/* prepare the entry */
+	szcli = 1 + strlen(key->client);
+	szses = 1 + strlen(key->session);
+	szuse = 1 + strlen(key->user);
+	szper = 1 + strlen(key->permission);
+	entry = malloc(szcli + szses + szuse + szper + szval + sizeof *entry);
+	if (!entry)
+		return;
+	hash = hashkey(key, resolved);
+	entry->next = NULL;
+	entry->hash = hash;
+	entry->resolved = resolved;
+	entry->referenced = false;
+	entry->expire = value->expire;
+	ptr = mempcpy(entry->client, key->client, szcli);
+	ptr = mempcpy(ptr, key->session, szses);
+	ptr = mempcpy(ptr, key->user, szuse);
+	ptr = mempcpy(ptr, key->permission, szper);
+	entry->value = memcpy(ptr, value->value, szval);
+
+	bucket = &buckets[hash & (nbuckets - 1)];
+	pthread_mutex_lock(&bucket->mutex);
+
+	/* record if still valid */
+	if (gen != __atomic_load_n(&generation, __ATOMIC_ACQUIRE))
+		free(entry);
+	else {
+		/* replace any previous entry and make room */
+		prv = search(bucket, key, resolved, hash);
+		if (*prv)
+			drop(bucket, prv);
+		if (bucket->count >= depth)
+			evict(bucket);
+
+		/* link the entry as the newest */
+		for (prv = &bucket->head ; *prv ; prv = &(*prv)->next);
+		*prv = entry;
+		bucket->count++;
+		__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_unlock(&bucket->mutex);
+}
+
+/* see dcache.h */
+void
+dcache_stats(
+	unsigned long *phits,
+	unsigned long *pmisses,
+	unsigned *pcount,
+	unsigned *psize
+) {
+	*phits = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+	*pmisses = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+	*pcount = __atomic_load_n(&count, __ATOMIC_RELAXED);
+	*psize = size;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+/******************************************************************************/
+/******************************************************************************/
+/* IMPLEMENTATION OF THE CACHE OF DECISIONS OF THE SERVER                     */
+/******************************************************************************/
+/******************************************************************************/
+
+/**
+ * The cache of decisions records for a given key either the value of the
+ * rule of the database that applies to it or, when 'resolved' is set,
+ * the final value returned by the agents for it.
+ *
+ * It is safe to use it from several threads: its entries are spread in
+ * buckets having their own lock, each bucket evicting an entry not recently
+ * used when full. Any clear of the cache increments its generation so that
+ * decisions computed from data that existed before the clear are not
+ * recorded after it.
+ */
+
+/** size of buffers receiving values, longer values are not cached */
+#define DCACHE_VALUE_SIZE 128
+
+/**
+ * Set the count of decisions kept by the cache and clear it.
+ * Must not be called while other threads use the cache.
+ *
+ * @param size count of decisions to keep, 0 disables the cache
+ */
+extern
+void
+dcache_set_size(
+	unsigned size
+);
+
+/**
+ * Clear the cache and increment its generation
+ */
+extern
+void
+dcache_clear(
+);
+
+/**
+ * Get the current generation of the cache
+ *
+ * @return the current generation
+ */
+extern
+uint32_t
+dcache_generation(
+);
+
+/**
+ * Search the decision for 'key' in the cache
+ *
+ * @param key the key to search
+ * @param resolved search the result of agents if true or the value of the
+ *                 rule of the database if false
+ * @param value where to store the found value
+ * @param buffer buffer of DCACHE_VALUE_SIZE bytes receiving the string of
+ *               the found value
+ *
+ * @return true if found or else false
+ */
+extern
+bool
+dcache_get(
+	const data_key_t *key,
+	bool resolved,
+	data_value_t *value,
+	char *buffer
+);
+
+/**
+ * Record the decision 'value' for 'key' in the cache unless the cache
+ * was cleared since 'generation'
+ *
+ * @param generation the generation of the cache when the computation of
+ *                   the decision started
+ * @param key the key of the decision
+ * @param resolved true if the value is the result of agents
+ * @param value the value to record
+ */
+extern
+void
+dcache_put(
+	uint32_t generation,
+	const data_key_t *key,
+	bool resolved,
+	const data_value_t *value
+);
+
+/**
+ * Get the statistics of the cache
+ *
+ * @param hits where to store the count of successful searches
+ * @param misses where to store the count of failed searches
+ * @param count where to store the count of recorded decisions
+ * @param size where to store the count of decisions that can be recorded
+ */
+extern
+void
+dcache_stats(
+	unsigned long *hits,
+	unsigned long *misses,
+	unsigned *count,
+	unsigned *size
+);
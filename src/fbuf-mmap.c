@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/******************************************************************************/
+/******************************************************************************/
+/* IMPLEMENTATION OF MEMORY MAPPED BUFFERED FILES                             */
+/******************************************************************************/
+/******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <linux/fs.h>
+
+#include "fbuf-mmap.h"
+
+/**
+ * Round 'size' to a non zero count of pages
+ * @param size the size to round
+ * @return the rounded size
+ */
+static
+size_t
+page_round(
+	size_t size
+) {
+	size_t pgsz = (size_t)sysconf(_SC_PAGESIZE);
+	return size ? (size + pgsz - 1) & ~(pgsz - 1) : pgsz;
+}
+
+/**
+ * Map at 'buffer' of 'capacity' bytes the 'mapped' first bytes of the
+ * opened file 'fd', the remaining bytes being anonymous memory
+ * @param buffer the address of the memory or NULL for a new one
+ * @param capacity the size of the memory
+ * @param fd the file to map
+ * @param mapped count of bytes to map from the file
+ * @return the address of the memory or NULL on error
+ */
+static
+void *
+overlay(
+	void *buffer,
+	size_t capacity,
+	int fd,
+	uint32_t mapped
+) {
+	void *addr;
+	int fixed = buffer ? MAP_FIXED : 0;
+
+	/* anonymous private memory */
+	addr = mmap(buffer, capacity, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|fixed, -1, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	/* overlay the file, private to copy the pages on write */
+	if (mapped && mmap(addr, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
+		if (!fixed)
+			munmap(addr, capacity);
+		return NULL;
+	}
+	return addr;
+}
+
+/**
+ * Build a new memory of 'capacity' bytes for 'fb' whose 'mapped' first bytes
+ * are mapped from the opened file 'fd' and whose bytes from 'mapped' to
+ * used are copied from the current memory. The current memory is released.
+ * @param fb the fbuf
+ * @param capacity the capacity of the new memory
+ * @param fd the file to map
+ * @param mapped count of bytes to map from the file
+ * @return 0 on success or -ENOMEM
+ */
+static
+int
+remap(
+	fbuf_t *fb,
+	uint32_t capacity,
+	int fd,
+	uint32_t mapped
+) {
+	size_t cap = page_round(capacity);
+	void *buffer;
+
+	if (cap > UINT32_MAX)
+		cap = UINT32_MAX;
+
+	buffer = overlay(NULL, cap, fd, mapped);
+	if (buffer == NULL)
+		return -ENOMEM;
+
+	/* copy the bytes not mapped */
+	if (mapped < fb->used)
+		memcpy(buffer + mapped, fb->buffer + mapped, fb->used - mapped);
+
+	fbuf_mmap_release(fb);
+	fb->buffer = buffer;
+	fb->capacity = (uint32_t)cap;
+	return 0;
+}
+
+/* see fbuf-mmap.h */
+int fbuf_mmap_read(fbuf_t *fb)
+{
+	int fd, rc;
+	struct stat st, stb;
+
+	/* open the file */
+	fd = open(fb->name, O_RDWR|O_CREAT, 0600);
+	if (fd < 0) {
+		rc = -errno;
+		goto error;
+	}
+
+	/* get file stat */
+	rc = fstat(fd, &st);
+	if (rc < 0) {
+		rc = -errno;
+		goto error2;
+	}
+
+	/* compute backuped flag */
+	rc = stat(fb->backup, &stb);
+	fb->backuped = rc == 0 && st.st_dev == stb.st_dev && st.st_ino == stb.st_ino;
+
+	/* check file size */
+	if ((off_t)INT32_MAX < st.st_size) {
+		rc = -EFBIG;
+		goto error2;
+	}
+
+	/* map the file */
+	fb->used = 0;
+	rc = remap(fb, (uint32_t)st.st_size, fd, (uint32_t)st.st_size);
+	if (rc < 0)
+		goto error2;
+
+	/* done */
+	fb->used = fb->size = (uint32_t)st.st_size;
+	close(fd);
+	return 0;
+
+error2:
+	close(fd);
+error:
+	fprintf(stderr, "can't map file %s: %s\n", fb->name, strerror(-rc));
+	fb->saved = fb->used = fb->size = 0;
+	return rc;
+}
+
+/**
+ * Write to the file 'fd' the bytes of 'fb' from 'off' to 'end' excluded
+ * @param fd the file
+ * @param fb the fbuf
+ * @param off offset of the first byte
+ * @param end offset after the last byte
+ * @return 0 on success or -errno
+ */
+static
+int
+write_range(
+	int fd,
+	fbuf_t *fb,
+	uint32_t off,
+	uint32_t end
+) {
+	ssize_t rcs;
+
+	for ( ; off < end ; off += (uint32_t)rcs) {
+		rcs = pwrite(fd, fb->buffer + off, end - off, (off_t)off);
+		if (rcs < 0) {
+			if (errno != EINTR)
+				return -errno;
+			rcs = 0;
+		}
+	}
+	return 0;
+}
+
+/* see fbuf-mmap.h */
+int fbuf_mmap_sync(fbuf_t *fb)
+{
+	int fd, rc;
+	uint32_t off, count;
+	struct stat st;
+	bool shrink;
+
+	/* open the file */
+	fd = open(fb->name, O_RDWR|O_CREAT, 0600);
+	if (fd < 0) {
+		rc = -errno;
+		goto error;
+	}
+
+	/* write the pages modified in place then the unsaved bytes */
+	off = 0;
+	while ((count = fbuf_pages_next(&fb->unsaved, fb->saved, &off)) != 0) {
+		rc = write_range(fd, fb, off, off + count);
+		if (rc < 0)
+			goto error2;
+		off += count;
+	}
+	rc = write_range(fd, fb, fb->saved, fb->used);
+	if (rc < 0)
+		goto error2;
+
+	/* adjust the size */
+	if (fstat(fd, &st) < 0) {
+		rc = -errno;
+		goto error2;
+	}
+	shrink = st.st_size > (off_t)fb->used;
+	if (shrink && ftruncate(fd, (off_t)fb->used) < 0) {
+		rc = -errno;
+		goto error2;
+	}
+
+	/* flush to the disk */
+	if (fdatasync(fd) < 0) {
+		rc = -errno;
+		goto error2;
+	}
+
+	/* pages beyond the end of a shrunk file can't stay mapped,
+	 * map it again in place as its content is the one in memory */
+	if (shrink && overlay(fb->buffer, fb->capacity, fd, fb->used) == NULL) {
+		rc = -ENOMEM;
+		goto error2;
+	}
+
+	close(fd);
+	return 0;
+
+error2:
+	close(fd);
+error:
+	fprintf(stderr, "write of file %s failed: %s\n", fb->name, strerror(-rc));
+	return rc;
+}
+
+/* see fbuf-mmap.h */
+int fbuf_mmap_backup(fbuf_t *fb)
+{
+	int fdi, fdo, rc;
+	ssize_t rcs;
+
+	/* open the files */
+	fdi = open(fb->name, O_RDONLY);
+	if (fdi < 0) {
+		rc = -errno;
+		goto error;
+	}
+	unlink(fb->backup);
+	fdo = open(fb->backup, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if (fdo < 0) {
+		rc = -errno;
+		goto error2;
+	}
+
+	/* clone the file if possible or else copy it */
+	rc = 0;
+	if (ioctl(fdo, FICLONE, fdi) < 0) {
+		do {
+			rcs = copy_file_range(fdi, NULL, fdo, NULL, INT32_MAX, 0);
+		} while (rcs > 0 || (rcs < 0 && errno == EINTR));
+		if (rcs < 0)
+			rc = -errno;
+	}
+	close(fdo);
+	if (rc < 0)
+		unlink(fb->backup);
+error2:
+	close(fdi);
+error:
+	if (rc < 0)
+		fprintf(stderr, "backup of file %s failed: %s\n", fb->name, strerror(-rc));
+	return rc;
+}
+
+/* see fbuf-mmap.h */
+int fbuf_mmap_recover(fbuf_t *fb)
+{
+	int fd, rc;
+	struct stat st;
+	ssize_t rcs;
+
+	/* open the backup */
+	fd = open(fb->backup, O_RDONLY);
+	if (fd < 0) {
+		rc = -errno;
+		goto error;
+	}
+	rc = fstat(fd, &st);
+	if (rc < 0) {
+		rc = -errno;
+		goto error2;
+	}
+	if ((off_t)INT32_MAX < st.st_size) {
+		rc = -EFBIG;
+		goto error2;
+	}
+
+	/* read it in anonymous memory because the backup is replaced later */
+	fb->used = 0;
+	rc = remap(fb, (uint32_t)st.st_size, -1, 0);
+	if (rc < 0)
+		goto error2;
+	rcs = read(fd, fb->buffer, (size_t)st.st_size);
+	if (rcs != (ssize_t)st.st_size) {
+		rc = rcs < 0 ? -errno : -EINTR;
+		goto error2;
+	}
+
+	/* done */
+	fb->used = fb->size = (uint32_t)st.st_size;
+	close(fd);
+	return 0;
+
+error2:
+	close(fd);
+error:
+	fprintf(stderr, "can't read file %s: %s\n", fb->backup, strerror(-rc));
+	fb->saved = fb->used = fb->size = 0;
+	return rc;
+}
+
+/* see fbuf-mmap.h */
+int fbuf_mmap_resize(fbuf_t *fb, uint32_t capacity)
+{
+	int fd, rc;
+	uint32_t mapped;
+
+	/* the saved bytes before the first page modified in place
+	 * are the ones of the file */
+	mapped = 0;
+	if (fbuf_pages_next(&fb->unsaved, fb->saved, &mapped) == 0)
+		mapped = fb->saved;
+
+	/* nothing to remap */
+	if (mapped == 0)
+		return remap(fb, capacity, -1, 0);
+
+	fd = open(fb->name, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	rc = remap(fb, capacity, fd, mapped);
+	close(fd);
+	return rc;
+}
+
+/* see fbuf-mmap.h */
+void fbuf_mmap_release(fbuf_t *fb)
+{
+	if (fb->buffer != NULL)
+		munmap(fb->buffer, fb->capacity);
+	fb->buffer = NULL;
+	fb->capacity = 0;
+}
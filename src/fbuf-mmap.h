@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "fbuf.h"
+
+/**
+ * Memory mapped files for fbuf.
+ *
+ * The files are mapped privately: the pages are shared with the page
+ * cache until they are modified (copy on write). The synchronisation
+ * only writes the bytes between 'saved' and 'used'.
+ */
+
+/**
+ * Read in 'fb' from its main storage by mapping it
+ * @param fb the fbuf
+ * @return 0 on success
+ *         -EFBIG if the file is too big
+ *         -errno system error
+ */
+extern int fbuf_mmap_read(fbuf_t *fb);
+
+/**
+ * Write to the main storage the unsaved bytes of 'fb' and synchronize it
+ * @param fb the fbuf
+ * @return 0 on success
+ *         -errno system error
+ */
+extern int fbuf_mmap_sync(fbuf_t *fb);
+
+/**
+ * Create the back-up file
+ * As the main file is modified in place, the backup is a copy of it.
+ * @param fb the fbuf
+ * @return 0 in case of success
+ *         a negative -errno code
+ */
+extern int fbuf_mmap_backup(fbuf_t *fb);
+
+/**
+ * recover data from latest backup
+ * @param fb the fbuf
+ * @return 0 on success
+ *         a negative -errno code
+ */
+extern int fbuf_mmap_recover(fbuf_t *fb);
+
+/**
+ * Resize the memory of 'fb' to 'capacity', keeping its content
+ * @param fb the fbuf
+ * @param capacity the new capacity
+ * @return 0 on success
+ *         -ENOMEM if out of memory
+ */
+extern int fbuf_mmap_resize(fbuf_t *fb, uint32_t capacity);
+
+/**
+ * Release the memory of 'fb'
+ * @param fb the fbuf
+ */
+extern void fbuf_mmap_release(fbuf_t *fb);
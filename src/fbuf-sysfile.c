@@ -96,34 +96,111 @@ error:
 	return rc;
 }
 
+/**
+ * Write the content of 'fb' to the file 'fd' and flush it to the disk
+ * @param fb the fbuf
+ * @param fd the file descriptor
+ * @return 0 on success
+ *         -errno system error
+ */
+static int write_fd(fbuf_t *fb, int fd)
+{
+	ssize_t rcs;
+	uint32_t off;
+
+	for (off = 0 ; off < fb->used ; off += (uint32_t)rcs) {
+		rcs = write(fd, fb->buffer + off, fb->used - off);
+		if (rcs < 0) {
+			if (errno != EINTR)
+				return -errno;
+			rcs = 0;
+		}
+	}
+	return fsync(fd) < 0 ? -errno : 0;
+}
+
+/**
+ * Flush to the disk the directory 'dir'
+ * @param dir the directory
+ * @return 0 on success
+ *         -errno system error
+ */
+static int sync_dir(const char *dir)
+{
+	int fd, rc;
+
+	fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	rc = fsync(fd) < 0 ? -errno : 0;
+	close(fd);
+	return rc;
+}
+
 /* see fbuf_sysfile.h */
 int fbuf_sysfile_write_file(fbuf_t *fb, const char *name)
 {
-	ssize_t rcs;
 	int rc, fd;
+	size_t len;
+	char *tmp, *dir, *slash, proc[40];
+
+	/* compute the names of the directory and of the temporary file */
+	len = strlen(name);
+	tmp = alloca(len + 2);
+	memcpy(tmp, name, len);
+	tmp[len] = '+';
+	tmp[len + 1] = 0;
+	slash = strrchr(name, '/');
+	if (slash == NULL)
+		dir = ".";
+	else if (slash == name)
+		dir = "/";
+	else
+		dir = strndupa(name, (size_t)(slash - name));
+
+	/* write an anonymous file and link it when complete */
+	unlink(tmp);
+	fd = open(dir, O_TMPFILE|O_WRONLY|O_CLOEXEC, 0600);
+	if (fd < 0)
+		rc = -ENOENT; /* not available */
+	else {
+		rc = write_fd(fb, fd);
+		if (rc == 0) {
+			snprintf(proc, sizeof proc, "/proc/self/fd/%d", fd);
+			rc = linkat(AT_FDCWD, proc, AT_FDCWD, tmp, AT_SYMLINK_FOLLOW) < 0 ? -errno : 0;
+		}
+		close(fd);
+		if (rc < 0 && rc != -ENOENT)
+			goto error;
+	}
 
-	/* open the file */
-	unlink(name);
-	fd = creat(name, 0600);
-	if (fd < 0) {
-		rc = -errno;
-		goto error;
+	/* or write a temporary file when anonymous files are not available */
+	if (rc == -ENOENT) {
+		fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+		if (fd < 0) {
+			rc = -errno;
+			goto error;
+		}
+		rc = write_fd(fb, fd);
+		close(fd);
+		if (rc < 0)
+			goto error2;
 	}
 
-	/* write unsaved bytes */
-	rcs = write(fd, fb->buffer, fb->used);
-	close(fd);
-	if (rcs < 0) {
+	/* replace the file with the complete temporary file */
+	if (rename(tmp, name) < 0) {
 		rc = -errno;
-		goto error;
-	}
-	if ((uint32_t)rcs != fb->used) {
-		rc = -EINTR;
-		goto error;
+		goto error2;
 	}
 
+	/* make the replacement durable */
+	rc = sync_dir(dir);
+	if (rc < 0)
+		goto error;
 	return 0;
 
+error2:
+	unlink(tmp);
 error:
 	fprintf(stderr, "write of file %s failed: %s\n", name, strerror(-rc));
 	return rc;
@@ -154,3 +231,23 @@ int fbuf_sysfile_recover(fbuf_t *fb)
 	return fbuf_sysfile_read_file(fb, fb->backup);
 }
 
+/* see fbuf-sysfile.h */
+int fbuf_sysfile_resize(fbuf_t *fb, uint32_t capacity)
+{
+	void *buffer;
+
+	buffer = realloc(fb->buffer, capacity);
+	if (buffer == NULL)
+		return -ENOMEM;
+	fb->buffer = buffer;
+	fb->capacity = capacity;
+	return 0;
+}
+
+/* see fbuf-sysfile.h */
+void fbuf_sysfile_release(fbuf_t *fb)
+{
+	free(fb->buffer);
+	fb->buffer = NULL;
+	fb->capacity = 0;
+}
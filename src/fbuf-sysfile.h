@@ -73,3 +73,18 @@ extern int fbuf_sysfile_backup(fbuf_t *fb);
  *         a negative -errno code
  */
 extern int fbuf_sysfile_recover(fbuf_t *fb);
+
+/**
+ * Resize the memory of 'fb' to 'capacity', keeping its content
+ * @param fb the fbuf
+ * @param capacity the new capacity
+ * @return 0 on success
+ *         -ENOMEM if out of memory
+ */
+extern int fbuf_sysfile_resize(fbuf_t *fb, uint32_t capacity);
+
+/**
+ * Release the memory of 'fb'
+ * @param fb the fbuf
+ */
+extern void fbuf_sysfile_release(fbuf_t *fb);
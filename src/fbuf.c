@@ -28,11 +28,23 @@
 #include <string.h>
 #include <errno.h>
 
+#if defined(WITH_FBUF_MMAP)
+#include "fbuf-mmap.h"
+#define FBUF_READ    fbuf_mmap_read
+#define FBUF_SYNC    fbuf_mmap_sync
+#define FBUF_BACKUP  fbuf_mmap_backup
+#define FBUF_RECOVER fbuf_mmap_recover
+#define FBUF_RESIZE  fbuf_mmap_resize
+#define FBUF_RELEASE fbuf_mmap_release
+#else
 #include "fbuf-sysfile.h"
 #define FBUF_READ    fbuf_sysfile_read
 #define FBUF_SYNC    fbuf_sysfile_sync
 #define FBUF_BACKUP  fbuf_sysfile_backup
 #define FBUF_RECOVER fbuf_sysfile_recover
+#define FBUF_RESIZE  fbuf_sysfile_resize
+#define FBUF_RELEASE fbuf_sysfile_release
+#endif
 
 #ifndef FBUF_MAX_CAPACITY
 #define FBUF_MAX_CAPACITY UINT32_MAX
@@ -52,6 +64,77 @@ get_asz(
 	return r > sz ? r : UINT32_MAX;
 }
 
+/**
+ * Mark in 'pages' the pages holding the bytes from 'begin' to 'end' excluded
+ * @param pages the bitmap of pages
+ * @param begin offset of the first byte
+ * @param end offset after the last byte, greater than begin
+ * @return 0 on success or -ENOMEM
+ */
+static
+int
+pages_mark(
+	fbuf_pages_t *pages,
+	uint32_t begin,
+	uint32_t end
+) {
+	uint32_t page, last, count, *bits, mask;
+
+	/* grow the bitmap as needed, by words of 32 pages */
+	last = (end - 1) >> FBUF_PAGE_SHIFT;
+	if (last >= pages->count) {
+		count = (last + 32) & ~(uint32_t)31;
+		if (count < pages->count << 1)
+			count = pages->count << 1;
+		bits = realloc(pages->bits, (count >> 5) * sizeof *bits);
+		if (bits == NULL)
+			return -ENOMEM;
+		memset(&bits[pages->count >> 5], 0, ((count - pages->count) >> 5) * sizeof *bits);
+		pages->bits = bits;
+		pages->count = count;
+	}
+
+	/* set the bits */
+	for (page = begin >> FBUF_PAGE_SHIFT ; page <= last ; page++) {
+		mask = 1u << (page & 31);
+		if (!(pages->bits[page >> 5] & mask)) {
+			pages->bits[page >> 5] |= mask;
+			pages->set++;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Clear the bits of 'pages'
+ * @param pages the bitmap of pages
+ */
+static
+void
+pages_clear(
+	fbuf_pages_t *pages
+) {
+	if (pages->set) {
+		memset(pages->bits, 0, (pages->count >> 5) * sizeof *pages->bits);
+		pages->set = 0;
+	}
+}
+
+/**
+ * Test if the bit of 'page' is set in 'pages'
+ * @param pages the bitmap of pages
+ * @param page the page to test, lower than pages->count
+ * @return true if set
+ */
+static
+bool
+pages_test(
+	const fbuf_pages_t *pages,
+	uint32_t page
+) {
+	return (pages->bits[page >> 5] >> (page & 31)) & 1;
+}
+
 /* see fbuf.h */
 int
 fbuf_open(
@@ -100,7 +183,7 @@ fbuf_open(
 		goto error;
 
 	/* any read data is already saved */
-	fb->saved = fb->used;
+	fb->saved = fb->logged = fb->used;
 	return 0;
 
 error:
@@ -116,7 +199,9 @@ fbuf_close(
 ) {
 	free(fb->name);
 	free(fb->backup);
-	free(fb->buffer);
+	free(fb->unsaved.bits);
+	free(fb->unlogged.bits);
+	FBUF_RELEASE(fb);
 	memset(fb, 0, sizeof *fb);
 }
 
@@ -128,14 +213,108 @@ fbuf_sync(
 	int rc = 0;
 
 	/* is sync needed? */
-	if (fb->used != fb->saved || fb->used != fb->size) {
+	if (fb->used != fb->saved || fb->used != fb->size || fb->unsaved.set) {
 		rc = FBUF_SYNC(fb);
-		if (rc == 0)
-			fb->size = fb->saved = fb->used;
+		if (rc == 0) {
+			fb->size = fb->saved = fb->logged = fb->used;
+			pages_clear(&fb->unsaved);
+			pages_clear(&fb->unlogged);
+			fb->backuped = 0; /* the backup is now outdated */
+		}
 	}
 	return rc;
 }
 
+/* see fbuf.h */
+int
+fbuf_reload(
+	fbuf_t	*fb
+) {
+	int rc;
+
+	rc = FBUF_READ(fb);
+	if (rc == 0) {
+		fb->saved = fb->logged = fb->used;
+		pages_clear(&fb->unsaved);
+		pages_clear(&fb->unlogged);
+	}
+	return rc;
+}
+
+/* see fbuf.h */
+void
+fbuf_touch(
+	fbuf_t	*fb,
+	uint32_t offset
+) {
+	if (offset < fb->saved)
+		fb->saved = offset;
+	if (offset < fb->logged)
+		fb->logged = offset;
+}
+
+/* see fbuf.h */
+void
+fbuf_mark(
+	fbuf_t	*fb,
+	uint32_t offset,
+	uint32_t count
+) {
+	uint32_t end = offset + count;
+
+	/* when out of memory, fallback to rewrite from offset */
+	if (offset < fb->saved
+	 && pages_mark(&fb->unsaved, offset, end < fb->saved ? end : fb->saved) < 0)
+		fb->saved = offset;
+	if (offset < fb->logged
+	 && pages_mark(&fb->unlogged, offset, end < fb->logged ? end : fb->logged) < 0)
+		fb->logged = offset;
+}
+
+/* see fbuf.h */
+uint32_t
+fbuf_pages_next(
+	const fbuf_pages_t *pages,
+	uint32_t limit,
+	uint32_t *offset
+) {
+	uint32_t page, end, lim;
+	uint64_t begin, stop;
+
+	if (!pages->set)
+		return 0;
+
+	/* search the first set page */
+	lim = (uint32_t)(((uint64_t)limit + FBUF_PAGE_SIZE - 1) >> FBUF_PAGE_SHIFT);
+	if (lim > pages->count)
+		lim = pages->count;
+	page = (uint32_t)(((uint64_t)*offset + FBUF_PAGE_SIZE - 1) >> FBUF_PAGE_SHIFT);
+	while (page < lim && !pages_test(pages, page))
+		page = pages->bits[page >> 5] ? page + 1 : (page | 31) + 1;
+	if (page >= lim)
+		return 0;
+
+	/* search the end of the range */
+	end = page + 1;
+	while (end < lim && pages_test(pages, end))
+		end++;
+	begin = (uint64_t)page << FBUF_PAGE_SHIFT;
+	stop = (uint64_t)end << FBUF_PAGE_SHIFT;
+	if (stop > limit)
+		stop = limit;
+	*offset = (uint32_t)begin;
+	return (uint32_t)(stop - begin);
+}
+
+/* see fbuf.h */
+void
+fbuf_logged(
+	fbuf_t	*fb
+) {
+	fb->logged = fb->used;
+	pages_clear(&fb->unlogged);
+}
+
 /* see fbuf.h */
 int
 fbuf_ensure_capacity(
@@ -143,7 +322,7 @@ fbuf_ensure_capacity(
 	uint32_t capacity
 ) {
 	uint32_t asz;
-	void *buffer;
+	int rc;
 
 	if (capacity > fb->capacity) {
 		asz = get_asz(capacity);
@@ -155,14 +334,12 @@ fbuf_ensure_capacity(
 			return -ENOMEM;
 		}
 #endif
-		buffer = realloc(fb->buffer, asz);
-		if (buffer == NULL) {
+		rc = FBUF_RESIZE(fb, asz);
+		if (rc < 0) {
 			fprintf(stderr, "alloc %u for file %s failed: %s\n",
-					asz, fb->name, strerror(ENOMEM));
-			return -ENOMEM;
+					asz, fb->name, strerror(-rc));
+			return rc;
 		}
-		fb->buffer = buffer;
-		fb->capacity = asz;
 	}
 	return 0;
 }
@@ -194,8 +371,7 @@ fbuf_put(
 	memcpy(fb->buffer + offset, buffer, count);
 
 	/* write the data to the disk */
-	if (offset < fb->saved)
-		fb->saved = offset;
+	fbuf_mark(fb, offset, count);
 	return 0;
 }
 
@@ -277,7 +453,9 @@ fbuf_recover(
 	int rc;
 
 	rc = FBUF_RECOVER(fb);
-	fb->saved = 0; /* ensure rewrite of restored data */
+	fb->saved = fb->logged = 0; /* ensure rewrite of restored data */
+	pages_clear(&fb->unsaved);
+	pages_clear(&fb->unlogged);
 	fb->backuped = 1;
 	return rc;
 }
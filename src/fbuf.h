@@ -39,6 +39,30 @@ enum fbuf_type
 /** short type */
 typedef enum fbuf_type fbuf_type_t;
 
+/** log2 of the size of the pages whose modification is recorded */
+#define FBUF_PAGE_SHIFT 12
+
+/** size of the pages whose modification is recorded */
+#define FBUF_PAGE_SIZE  (1u << FBUF_PAGE_SHIFT)
+
+/**
+ * Bitmap of the pages of a fbuf modified in place
+ */
+struct fbuf_pages
+{
+	/** the bits, one per page */
+	uint32_t *bits;
+
+	/** count of pages having a bit */
+	uint32_t count;
+
+	/** count of bits set */
+	uint32_t set;
+};
+
+/** short type */
+typedef struct fbuf_pages fbuf_pages_t;
+
 /**
  * A fbuf records file data and access
  */
@@ -68,8 +92,17 @@ struct fbuf
 	/** size saved to the file */
 	uint32_t saved;
 
+	/** size saved to the write-ahead log */
+	uint32_t logged;
+
 	/** size currently used */
 	uint32_t used;
+
+	/** pages modified below 'saved' */
+	fbuf_pages_t unsaved;
+
+	/** pages modified below 'logged' */
+	fbuf_pages_t unlogged;
 };
 
 /** short type */
@@ -115,6 +148,71 @@ fbuf_sync(
 	fbuf_t	*fb
 );
 
+/**
+ * Read again the file of 'fb', discarding the unsaved bytes
+ * @param fb the fbuf
+ * @return 0 on success
+ *         a negative -errno code
+ */
+extern
+int
+fbuf_reload(
+	fbuf_t	*fb
+);
+
+/**
+ * Record that the memory of 'fb' is modified from 'offset'
+ * @param fb the fbuf
+ * @param offset offset of the modification
+ */
+extern
+void
+fbuf_touch(
+	fbuf_t	*fb,
+	uint32_t offset
+);
+
+/**
+ * Record that the 'count' bytes of the memory of 'fb' at 'offset' are
+ * modified in place. Only the pages holding them will be written.
+ * @param fb the fbuf
+ * @param offset offset of the modification
+ * @param count count of modified bytes
+ */
+extern
+void
+fbuf_mark(
+	fbuf_t	*fb,
+	uint32_t offset,
+	uint32_t count
+);
+
+/**
+ * Search the next range of modified pages in 'pages' from '*offset'
+ * up to 'limit' excluded
+ * @param pages the modified pages
+ * @param limit the offset where to stop the search
+ * @param offset in: offset of the search, out: offset of the found range
+ * @return the count of bytes of the found range or 0 if none
+ */
+extern
+uint32_t
+fbuf_pages_next(
+	const fbuf_pages_t *pages,
+	uint32_t limit,
+	uint32_t *offset
+);
+
+/**
+ * Record that the memory of 'fb' is fully saved to the write-ahead log
+ * @param fb the fbuf
+ */
+extern
+void
+fbuf_logged(
+	fbuf_t	*fb
+);
+
 /**
  * allocate enough memory in 'fb' to store 'count' bytes
  * @param fb the fbuf
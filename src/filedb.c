@@ -35,6 +35,11 @@
 #include "anydb.h"
 #include "fbuf.h"
 #include "filedb.h"
+#include "ruleidx.h"
+#include "sortidx.h"
+#if defined(WITH_FILEDB_WAL)
+#include "wal.h"
+#endif
 
 /**
  * A rule is a set of 32 bits integers
@@ -85,6 +90,17 @@ static const char uuid_names_v1[] = "b2c33494-995f-5cc2-9e5e-72ad412936a9\n--\n"
  */
 static const char uuid_rules_v1[] = "73630c61-89a9-5e82-8b07-5e53eee785c8\n--\n";
 
+#if defined(WITH_FILEDB_WAL)
+/** identification of write-ahead log version 1
+ *    $> uuidgen --sha1 -n @url -N urn:AGL:cynagora:db:wal:1
+ *    $> uuid -v 5 ns:URL urn:AGL:cynagora:db:wal:1
+ */
+static const char uuid_wal_v1[] = "31dc3c3a-ccb7-57cf-9da3-b71f6a033073\n--\n";
+
+/** minimal size of the write-ahead log triggering a checkpoint */
+#define WAL_MIN_CHECKPOINT 65536
+#endif
+
 /** length of the identifications */
 static const uint32_t uuidlen = 40;
 
@@ -97,11 +113,11 @@ struct filedb
 	/** the file for the rules */
 	fbuf_t frules;
 
-	/** count of names */
-	uint32_t names_count;
-
 	/** the name indexes sorted */
-	uint32_t *names_sorted;
+	sortidx_t names;
+
+	/** the name indexes of permissions sorted ignoring case */
+	sortidx_t perms;
 
 	/** count of rules */
 	uint32_t rules_count;
@@ -109,6 +125,9 @@ struct filedb
 	/** the rules */
 	rule_t *rules;
 
+	/** index of the rules */
+	ruleidx_t index;
+
 	/** is changed? */
 	bool is_changed;
 
@@ -118,6 +137,11 @@ struct filedb
 	/** has backup? */
 	bool has_backup;
 
+#if defined(WITH_FILEDB_WAL)
+	/** the write-ahead log of the files */
+	wal_t wal;
+#endif
+
 	/** the anydb interface */
 	anydb_t anydb;
 };
@@ -185,23 +209,32 @@ name_at(
 	return (const char*)(filedb->fnames.buffer + index);
 }
 
-/** compare names. used by qsort and bsearch */
+/** compare names. used by the index of names */
 static
 int
 cmpnames(
-	const void *pa,
-	const void *pb,
-	void *arg
+	void *closure,
+	uint32_t a,
+	uint32_t b
 ) {
-	uint32_t a = *(const uint32_t*)pa;
-	uint32_t b = *(const uint32_t*)pb;
-	filedb_t *filedb = arg;
+	filedb_t *filedb = closure;
 	return strcmp(name_at(filedb, a), name_at(filedb, b));
 }
 
+/** compare a name with a name index. used by the index of names */
+static
+int
+cmpkeyname(
+	void *closure,
+	const void *key,
+	uint32_t item
+) {
+	filedb_t *filedb = closure;
+	return strcmp(key, name_at(filedb, item));
+}
+
 /**
- * Initialize the fields 'names_sorted' and 'names_count' for the
- * current database.
+ * Initialize the index of names for the current database.
  * @param filedb the database handler
  * @return 0 in case of success or -ENOMEM or -EBADSLT
  */
@@ -210,14 +243,12 @@ int
 init_names(
 	filedb_t *filedb
 ) {
-	uint32_t pos, length, *sorted, *p, allocated, name_count, used;
+	uint32_t pos, length, used;
 	const char *name;
-
-	allocated = 0;
-	name_count = 0;
-	sorted = NULL;
+	int rc;
 
 	/* iterate over names */
+	sortidx_clear(&filedb->names);
 	pos = uuidlen;
 	used = filedb->fnames.used;
 	while (pos < used) {
@@ -227,30 +258,21 @@ init_names(
 		length = (uint32_t)strnlen(name, (size_t)(used - pos));
 		if (pos + length <= pos || pos + length >= used) {
 			/* overflow */
-			free(sorted);
+			sortidx_clear(&filedb->names);
 			fprintf(stderr, "bad file %s\n", filedb->fnames.name);
 			return -EBADSLT;
 		}
-		/* store the position */
-		if (allocated <= name_count) {
-			allocated += 1024;
-			p = realloc(sorted, allocated * sizeof *sorted);
-			if (p == NULL) {
-				free(sorted);
-				fprintf(stderr, "out of memory\n");
-				return -ENOMEM;
-			}
-			sorted = p;
+		/* index the position */
+		rc = sortidx_add(&filedb->names, pos);
+		if (rc < 0) {
+			sortidx_clear(&filedb->names);
+			fprintf(stderr, "out of memory\n");
+			return rc;
 		}
-		sorted[name_count++] = pos;
 		/* next */
 		pos += length + 1;
 	}
-
-	/* sort and record */
-	qsort_r(sorted, name_count, sizeof *sorted, cmpnames, filedb);
-	filedb->names_sorted = sorted;
-	filedb->names_count = name_count;
+	sortidx_compact(&filedb->names);
 	return 0;
 }
 
@@ -269,11 +291,205 @@ valid_rule_index(
 	return anydb_idx_is_special(index) || valid_name_at(filedb, index);
 }
 
+/** compare permissions ignoring case. used by the index of permissions */
+static
+int
+cmpperms(
+	void *closure,
+	uint32_t a,
+	uint32_t b
+) {
+	filedb_t *filedb = closure;
+	return strcasecmp(name_at(filedb, a), name_at(filedb, b));
+}
+
+/** compare a permission with a name index ignoring case. used by the index of permissions */
+static
+int
+cmpkeyperm(
+	void *closure,
+	const void *key,
+	uint32_t item
+) {
+	filedb_t *filedb = closure;
+	return strcasecmp(key, name_at(filedb, item));
+}
+
+/**
+ * Tell whether the rules 'a' and 'b' have the same key
+ * @param a the first rule
+ * @param b the second rule
+ * @return true if the keys are the same
+ */
+static
+bool
+same_key(
+	const rule_t *a,
+	const rule_t *b
+) {
+	return a->client == b->client
+	    && a->user == b->user
+	    && a->permission == b->permission;
+}
+
+/**
+ * Normalize the rules having permissions that only differ by case:
+ * they are changed to use the permission of the index and the rules
+ * becoming duplicates of previous rules are removed.
+ * @param filedb the database handler
+ * @return 0 in case of success or -ENOMEM
+ */
+static
+int
+normalize_perms(
+	filedb_t *filedb
+) {
+	uint32_t i, j, count, changed;
+	rule_t *rules = filedb->rules;
+	uint8_t *flags;
+
+	/* flags of the rules: 1 for changed, 2 for removed */
+	count = filedb->rules_count;
+	flags = calloc(count + 1, 1);
+	if (flags == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -ENOMEM;
+	}
+
+	/* use the same index for permissions only differing by case */
+	for (changed = i = 0 ; i < count ; i++)
+		if (anydb_idx_is_string(rules[i].permission)) {
+			j = rules[i].permission;
+			sortidx_search(&filedb->perms, name_at(filedb, j), &rules[i].permission);
+			if (j != rules[i].permission) {
+				flags[i] = 1;
+				changed++;
+			}
+		}
+
+	/* mark the rules duplicating a previous rule, at least one of the two changed */
+	for (i = 0 ; i < count ; i++)
+		if (flags[i] == 1)
+			for (j = 0 ; j < count ; j++)
+				if (j != i && !(flags[j] & 2) && same_key(&rules[i], &rules[j])) {
+					if (j < i) {
+						flags[i] = 2;
+						break;
+					}
+					flags[j] = 2;
+				}
+
+	/* remove the duplicates, keeping the order */
+	for (i = j = 0 ; i < count ; i++)
+		if (!(flags[i] & 2))
+			rules[j++] = rules[i];
+	free(flags);
+	filedb->rules_count = j;
+	filedb->frules.used = uuidlen + j * (uint32_t)sizeof *rules;
+	fbuf_touch(&filedb->frules, uuidlen);
+	filedb->is_changed = true;
+	filedb->need_cleanup = true;
+	fprintf(stderr, "normalized permissions of %s: %u rules changed, %u duplicates removed\n",
+			filedb->frules.name, (unsigned)changed, (unsigned)(count - j));
+	return 0;
+}
+
+/**
+ * Initialize the index of permissions from the permissions of the rules.
+ * If some rules have permissions that only differ by case, the rules are
+ * normalized using normalize_perms.
+ * @param filedb the database handler
+ * @return 0 in case of success or -ENOMEM
+ */
+static
+int
+init_perms(
+	filedb_t *filedb
+) {
+	uint32_t i, perm, found;
+	rule_t *rules = filedb->rules;
+	uint8_t *seen;
+	bool dup;
+	int rc;
+
+	/* bitmap of the name indexes already seen */
+	seen = calloc((filedb->fnames.used >> 3) + 1, 1);
+	if (seen == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -ENOMEM;
+	}
+
+	/* index the permissions, keeping the first of the ones only differing by case */
+	sortidx_clear(&filedb->perms);
+	dup = false;
+	rc = 0;
+	for (i = 0 ; rc == 0 && i < filedb->rules_count ; i++) {
+		perm = rules[i].permission;
+		if (anydb_idx_is_string(perm) && !(seen[perm >> 3] & (1 << (perm & 7)))) {
+			seen[perm >> 3] |= (uint8_t)(1 << (perm & 7));
+			if (sortidx_search(&filedb->perms, name_at(filedb, perm), &found))
+				dup = true;
+			else
+				rc = sortidx_add(&filedb->perms, perm);
+		}
+	}
+	free(seen);
+	if (rc < 0) {
+		fprintf(stderr, "out of memory\n");
+		return rc;
+	}
+	sortidx_compact(&filedb->perms);
+	return dup ? normalize_perms(filedb) : 0;
+}
+
+/**
+ * Compute the hash of the key of the rule for the index
+ * @param rule the rule
+ * @return the hash of the key of the rule
+ */
+static
+uint32_t
+rule_hash(
+	rule_t *rule
+) {
+	anydb_key_t key;
+
+	key.client = rule->client;
+	key.session = AnyIdx_Wide;
+	key.user = rule->user;
+	key.permission = rule->permission;
+	return ruleidx_hash(&key);
+}
+
+/**
+ * Rebuild the index of the rules
+ * @param filedb the database handler
+ * @return 0 in case of success or -ENOMEM
+ */
+static
+int
+reindex(
+	filedb_t *filedb
+) {
+	uint32_t i;
+	int rc;
+
+	ruleidx_clear(&filedb->index);
+	for (i = 0 ; i < filedb->rules_count ; i++) {
+		rc = ruleidx_add(&filedb->index, rule_hash(&filedb->rules[i]));
+		if (rc < 0) {
+			fprintf(stderr, "out of memory\n");
+			return rc;
+		}
+	}
+	return 0;
+}
+
 /**
  * Initialize the fields 'rules' and 'rules_count' for the
- * current database.
+ * current database and its index.
  * @param filedb the database handler
- * @return 0 in case of success or -EBADSLT
+ * @return 0 in case of success or -EBADSLT or -ENOMEM
  */
 static
 int
@@ -297,7 +513,42 @@ init_rules(
 		iter++;
 		count--;
 	}
-	return 0;
+	return init_perms(filedb) ?: reindex(filedb);
+}
+
+/**
+ * Make the path of the file of the database: directory/name.extension
+ * @param directory the directory containing the file
+ * @param name the basename for the file
+ * @param extension the extension of the file
+ * @return the allocated path or NULL if out of memory
+ */
+static
+char *
+make_path(
+	const char *directory,
+	const char *name,
+	const char *extension
+) {
+	char *file, *p;
+	size_t ldir, lext, lname;
+
+	/* compute sizes */
+	ldir = strlen(directory);
+	lname = strlen(name);
+	lext = strlen(extension);
+
+	/* allocate memory for file */
+	file = malloc((ldir + lname + lext) + 3);
+	if (file != NULL) {
+		/* make the file's name: directory/name.extension */
+		p = mempcpy(file, directory, ldir);
+		*p++ = '/';
+		p = mempcpy(p, name, lname);
+		*p++ = '.';
+		mempcpy(p, extension, lext + 1);
+	}
+	return file;
 }
 
 /**
@@ -327,27 +578,77 @@ open_identify(
 	const char *id,
 	uint32_t idlen
 ) {
-	char *file, *p;
-	size_t ldir, lext, lname;
+	char *file;
+	int rc;
 
-	/* compute sizes */
-	ldir = strlen(directory);
-	lname = strlen(name);
-	lext = strlen(extension);
+	file = make_path(directory, name, extension);
+	if (file == NULL)
+		return -ENOMEM;
 
-	/* allocate memory for file */
-	file = alloca((ldir + lname + lext) + 3);
+	/* open the fbuf now */
+	rc = fbuf_open_identify(fb, type, file, NULL, id, idlen);
+	free(file);
+	return rc;
+}
 
-	/* make the file's name: directory/name.extension */
-	p = mempcpy(file, directory, ldir);
-	*p++ = '/';
-	p = mempcpy(p, name, lname);
-	*p++ = '.';
-	mempcpy(p, extension, lext + 1);
+#if defined(WITH_FILEDB_WAL)
+/**
+ * Write the files of the database and reset its write-ahead log
+ * @param filedb the database to checkpoint
+ * @return 0 in case of success
+ *         a negative -errno code
+ */
+static
+int
+checkpointdb(
+	filedb_t *filedb
+) {
+	return fbuf_sync(&filedb->fnames)
+		?: fbuf_sync(&filedb->frules)
+		?: wal_reset(&filedb->wal);
+}
 
-	/* open the fbuf now */
-	return fbuf_open_identify(fb, type, file, NULL, id, idlen);
+/**
+ * Open the write-ahead log of the database and replay it
+ * @param filedb the database handler
+ * @param directory the directory containing the file
+ * @param name the basename for the file
+ * @return 0 in case of success
+ *         -ENOMEM if out of memory
+ *         -ENOKEY if identification failed
+ *         a negative -errno code
+ */
+static
+int
+open_wal(
+	filedb_t *filedb,
+	const char *directory,
+	const char *name
+) {
+	fbuf_t *fbufs[2] = { &filedb->fnames, &filedb->frules };
+	char *file;
+	int rc;
+
+	file = make_path(directory, name, "wal");
+	if (file == NULL)
+		return -ENOMEM;
+
+	/* open the log and replay it */
+	rc = wal_open(&filedb->wal, file, uuid_wal_v1, uuidlen);
+	free(file);
+	if (rc == 0) {
+		rc = wal_replay(&filedb->wal, fbufs, 2);
+
+		/* write the replayed state to the files, this also ensures
+		 * that the files exist with their identification */
+		if (rc == 0)
+			rc = checkpointdb(filedb);
+		if (rc < 0)
+			wal_close(&filedb->wal);
+	}
+	return rc;
 }
+#endif
 
 /**
  * Open the database of 'name' in 'directory'
@@ -382,6 +683,11 @@ opendb(
 		/* open the rules */
 		rc = open_identify(&filedb->frules, fbuf_type_Rules, directory, name, "rules", uuid_rules_v1, uuidlen);
 		if (rc == 0) {
+#if defined(WITH_FILEDB_WAL)
+			/* open the log */
+			rc = open_wal(filedb, directory, name);
+			if (rc == 0) {
+#endif
 			/* connect internals */
 			rc = init_names(filedb);
 			if (rc == 0) {
@@ -389,6 +695,10 @@ opendb(
 				if (rc == 0)
 					return 0;
 			}
+#if defined(WITH_FILEDB_WAL)
+				wal_close(&filedb->wal);
+			}
+#endif
 			fbuf_close(&filedb->frules);
 		}
 		fbuf_close(&filedb->fnames);
@@ -406,6 +716,11 @@ closedb(
 	filedb_t *filedb
 ) {
 	assert(filedb->fnames.name && filedb->frules.name);
+#if defined(WITH_FILEDB_WAL)
+	if (!filedb->is_changed)
+		checkpointdb(filedb);
+	wal_close(&filedb->wal);
+#endif
 	fbuf_close(&filedb->fnames);
 	fbuf_close(&filedb->frules);
 }
@@ -427,6 +742,24 @@ syncdb(
 	if (!filedb->is_changed)
 		rc = 0; /* unchanged */
 	else {
+#if defined(WITH_FILEDB_WAL)
+		fbuf_t *fbufs[2] = { &filedb->fnames, &filedb->frules };
+
+		/* log the changes unless the log becomes bigger than half the files */
+		if (filedb->wal.size + wal_frame_size(fbufs, 2) <= WAL_MIN_CHECKPOINT
+				+ ((filedb->fnames.used + filedb->frules.used) >> 1))
+			rc = wal_append(&filedb->wal, fbufs, 2);
+		else
+			/* the changes are logged first, so that replaying the log
+			 * over the files of an interrupted checkpoint is correct */
+			rc = wal_append(&filedb->wal, fbufs, 2)
+				?: wal_flush(&filedb->wal)
+				?: checkpointdb(filedb);
+		if (rc == 0) {
+			filedb->is_changed = false;
+			filedb->has_backup = false;
+		}
+#else
 		/* sync the names */
 		rc = fbuf_sync(&filedb->fnames);
 		if (rc == 0) {
@@ -437,6 +770,7 @@ syncdb(
 				filedb->has_backup = false;
 			}
 		}
+#endif
 	}
 	return rc;
 }
@@ -458,6 +792,11 @@ backupdb(
 	if (filedb->has_backup)
 		rc = 0; /* already backuped */
 	else {
+#if defined(WITH_FILEDB_WAL)
+		/* files and log are only modified by commits, they are the backup */
+		rc = 0;
+		filedb->has_backup = true;
+#else
 		/* backup names */
 		rc = fbuf_backup(&filedb->fnames);
 		if (rc == 0) {
@@ -466,6 +805,7 @@ backupdb(
 			if (rc == 0)
 				filedb->has_backup = true;
 		}
+#endif
 	}
 	return rc;
 }
@@ -487,6 +827,24 @@ recoverdb(
 	if (!filedb->is_changed || !filedb->has_backup)
 		rc = 0;
 	else {
+#if defined(WITH_FILEDB_WAL)
+		fbuf_t *fbufs[2] = { &filedb->fnames, &filedb->frules };
+
+		/* reload names */
+		rc = fbuf_reload(&filedb->fnames);
+		if (rc < 0)
+			goto error;
+
+		/* reload rules */
+		rc = fbuf_reload(&filedb->frules);
+		if (rc < 0)
+			goto error;
+
+		/* replay the log */
+		rc = wal_replay(&filedb->wal, fbufs, 2);
+		if (rc < 0)
+			goto error;
+#else
 		/* recover names */
 		rc = fbuf_recover(&filedb->fnames);
 		if (rc < 0)
@@ -496,6 +854,7 @@ recoverdb(
 		rc = fbuf_recover(&filedb->frules);
 		if (rc < 0)
 			goto error;
+#endif
 
 		/* init names */
 		rc = init_names(filedb);
@@ -527,32 +886,13 @@ index_itf(
 	bool create
 ) {
 	filedb_t *filedb = clodb;
-	uint32_t lo, up, m, i, *p;
-	int c;
-	const char *n;
+	uint32_t i;
+	int rc;
 	size_t len;
 
-	/* dichotomic search */
-	lo = 0;
-	up = filedb->names_count;
-	while(lo < up) {
-		m = (lo + up) >> 1;
-		i = filedb->names_sorted[m];
-		n = name_at(filedb, i);
-		c = strcmp(n, name);
-
-		if (c == 0) {
-			/* found */
-			*idx = i;
-			return 0;
-		}
-
-		/* dichotomic iteration */
-		if (c < 0)
-			lo = m + 1;
-		else
-			up = m;
-	}
+	/* search */
+	if (sortidx_search(&filedb->names, name, idx))
+		return 0;
 
 	/* not found */
 	if (!create) {
@@ -569,26 +909,53 @@ index_itf(
 
 	/* add the name in the file */
 	i = filedb->fnames.used;
-	c = fbuf_append(&filedb->fnames, name, 1 + (uint32_t)len);
-	if (c < 0)
-		return c;
-
-	/* add the name in sorted array */
-	up = filedb->names_count;
-	if (!(up & 1023)) {
-		p = realloc(filedb->names_sorted, (up + 1024) * sizeof *p);
-		if (p == NULL) {
-			fprintf(stderr, "out of memory\n");
-			return -1;
-		}
-		filedb->names_sorted = p;
+	rc = fbuf_append(&filedb->fnames, name, 1 + (uint32_t)len);
+	if (rc < 0)
+		return rc;
+
+	/* add the name in the index */
+	rc = sortidx_add(&filedb->names, i);
+	if (rc < 0) {
+		filedb->fnames.used = i;
+		fprintf(stderr, "out of memory\n");
+		return -1;
 	}
-	memmove(&filedb->names_sorted[lo + 1], &filedb->names_sorted[lo], (up - lo) * sizeof *filedb->names_sorted);
-	filedb->names_count = up + 1;
-	*idx = filedb->names_sorted[lo] = i;
+	*idx = i;
 	return 0;
 }
 
+/** implementation of anydb_itf.index_permission */
+static
+int
+index_permission_itf(
+	void *clodb,
+	anydb_idx_t *idx,
+	const char *name,
+	bool create
+) {
+	filedb_t *filedb = clodb;
+	int rc;
+
+	/* search */
+	if (sortidx_search(&filedb->perms, name, idx))
+		return 0;
+
+	/* not found */
+	if (!create) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* create */
+	rc = index_itf(clodb, idx, name, true);
+	if (rc == 0) {
+		rc = sortidx_add(&filedb->perms, *idx);
+		if (rc < 0)
+			fprintf(stderr, "out of memory\n");
+	}
+	return rc;
+}
+
 /** implementation of anydb_itf.string */
 static
 const char *
@@ -602,6 +969,82 @@ string_itf(
 	return name_at(filedb, idx);
 }
 
+/**
+ * Perform the action 'a' returned by an apply callback on the rule
+ * at index 'i' whose possibly updated value is 'value'
+ * @param filedb the database handler
+ * @param i index of the rule
+ * @param a the action to perform
+ * @param value the value of the rule
+ * @return true if the rule was removed from the array
+ */
+static
+bool
+act(
+	filedb_t *filedb,
+	uint32_t i,
+	anydb_action_t a,
+	const anydb_value_t *value
+) {
+	rule_t *rule = &filedb->rules[i];
+	uint32_t offset = (uint32_t)((void*)rule - filedb->frules.buffer);
+
+	if (a & Anydb_Action_Remove) {
+		/* move the last rule in place: only its slot and the end change */
+		*rule = filedb->rules[--filedb->rules_count];
+		ruleidx_remove(&filedb->index, i);
+		filedb->is_changed = true;
+		filedb->need_cleanup = true;
+		filedb->frules.used -= (uint32_t)sizeof *rule;
+		if (offset < filedb->frules.used)
+			fbuf_mark(&filedb->frules, offset, (uint32_t)sizeof *rule);
+		fbuf_touch(&filedb->frules, filedb->frules.used);
+		return true;
+	}
+	if (a & Anydb_Action_Update) {
+		rule->value = value->value;
+		set_expire(rule, value->expire);
+		filedb->need_cleanup = true;
+		filedb->is_changed = true;
+		fbuf_mark(&filedb->frules, offset, (uint32_t)sizeof *rule);
+	}
+	return false;
+}
+
+/**
+ * Call the operator 'oper' for the rule at index 'i'
+ * @param filedb the database handler
+ * @param i index of the rule
+ * @param oper the operator to call
+ * @param closure closure of the operator
+ * @param removed where to store if the rule was removed
+ * @return the action returned by the operator
+ */
+static
+anydb_action_t
+apply_at(
+	filedb_t *filedb,
+	uint32_t i,
+	anydb_applycb_t *oper,
+	void *closure,
+	bool *removed
+) {
+	rule_t *rule = &filedb->rules[i];
+	anydb_action_t a;
+	anydb_key_t key;
+	anydb_value_t value;
+
+	key.client = rule->client;
+	key.session = AnyIdx_Wide;
+	key.user = rule->user;
+	key.permission = rule->permission;
+	value.value = rule->value;
+	value.expire = get_expire(rule);
+	a = oper(closure, &key, &value);
+	*removed = act(filedb, i, a, &value);
+	return a;
+}
+
 /** implementation of anydb_itf.apply */
 static
 void
@@ -612,41 +1055,60 @@ apply_itf(
 ) {
 	filedb_t *filedb = clodb;
 	anydb_action_t a;
-	rule_t *rule;
-	anydb_key_t key;
-	anydb_value_t value;
-	uint32_t i, saved;
+	bool removed;
+	uint32_t i;
 
-	key.session = AnyIdx_Wide;
 	i = 0;
 	while (i < filedb->rules_count) {
-		rule = &filedb->rules[i];
-		key.client = rule->client;
-		key.user = rule->user;
-		key.permission = rule->permission;
-		value.value = rule->value;
-		value.expire = get_expire(rule);
-		a = oper(closure, &key, &value);
-		if (a & Anydb_Action_Remove) {
-			*rule = filedb->rules[--filedb->rules_count];
-			filedb->is_changed = true;
-			filedb->need_cleanup = true;
-			saved = (uint32_t)((void*)rule - filedb->frules.buffer);
-			if (saved < filedb->frules.saved)
-				filedb->frules.saved = saved;
-			filedb->frules.used -= (uint32_t)sizeof *rule;
-		} else if (a & Anydb_Action_Update) {
-			rule->value = value.value;
-			set_expire(rule, value.expire);
-			filedb->need_cleanup = true;
-			filedb->is_changed = true;
-			saved = (uint32_t)((void*)rule - filedb->frules.buffer);
-			if (saved < filedb->frules.saved)
-				filedb->frules.saved = saved;
-		}
+		a = apply_at(filedb, i, oper, closure, &removed);
 		if (a & Anydb_Action_Stop)
 			return;
-		i += !(a & Anydb_Action_Remove);
+		i += !removed;
+	}
+}
+
+/** implementation of anydb_itf.lookup */
+static
+void
+lookup_itf(
+	void *clodb,
+	const anydb_key_t *key,
+	anydb_applycb_t *oper,
+	void *closure
+) {
+	filedb_t *filedb = clodb;
+	anydb_key_t keys[RuleIdx_Max_Hashes];
+	uint32_t hashes[RuleIdx_Max_Hashes];
+	unsigned ih, nh;
+	uint32_t i, next;
+	anydb_action_t a;
+	anydb_key_t k;
+	rule_t *rule;
+	bool removed;
+
+	/* rules of the file are all for WIDE sessions */
+	k = *key;
+	k.session = AnyIdx_Wide;
+	nh = ruleidx_search_hashes(&k, keys, hashes);
+	for (ih = 0 ; ih < nh ; ih++) {
+		i = ruleidx_first(&filedb->index, hashes[ih]);
+		while (i != RuleIdx_End) {
+			next = ruleidx_next(&filedb->index, i);
+			rule = &filedb->rules[i];
+			if (rule->client != keys[ih].client
+			 || rule->user != keys[ih].user
+			 || rule->permission != keys[ih].permission) {
+				i = next;
+				continue; /* same hash but other key */
+			}
+			a = apply_at(filedb, i, oper, closure, &removed);
+			if (a & Anydb_Action_Stop)
+				return;
+			/* when removed, the last rule is moved at i */
+			if (removed && next == filedb->rules_count)
+				next = i;
+			i = next;
+		}
 	}
 }
 
@@ -698,13 +1160,17 @@ add_itf(
 		return rc;
 	rules = (rule_t*)(filedb->frules.buffer + uuidlen);
 	filedb->rules = rules;
-	count = filedb->rules_count++;
+	count = filedb->rules_count;
 	rules = &rules[count];
 	rules->client = key->client;
 	rules->user = key->user;
 	rules->permission = key->permission;
 	rules->value = value->value;
 	set_expire(rules, value->expire);
+	rc = ruleidx_add(&filedb->index, rule_hash(rules));
+	if (rc)
+		return rc;
+	filedb->rules_count = count + 1;
 	filedb->frules.used = alloc;
 	filedb->is_changed = true;
 	return 0;
@@ -862,7 +1328,7 @@ gc_itf(
 
 	/* mark items */
 	rule_count = filedb->rules_count;
-	name_count = filedb->names_count;
+	name_count = filedb->names.count;
 	rules = filedb->rules;
 	marked = alloca(name_count * sizeof *marked);
 	new_count = 0;
@@ -879,7 +1345,7 @@ gc_itf(
 
 	/* pack the names by removing the unused strings */
 	strings = (char*)filedb->fnames.buffer;
-	renum = filedb->names_sorted;
+	renum = alloca(new_count * sizeof *renum);
 	istr_before = istr_after = uuidlen;
 	while (istr_before < filedb->fnames.used) {
 		/* get name length */
@@ -902,14 +1368,18 @@ gc_itf(
 		gc_renum(marked, renum, new_count, &rules[irule].value);
 	}
 
-	/* record and sort */
-	filedb->names_count = new_count;
+	/* record and index */
 	filedb->fnames.used = istr_after;
-	qsort_r(renum, new_count, sizeof *renum, cmpnames, filedb);
+	sortidx_clear(&filedb->names);
+	for (imarked = 0 ; imarked < new_count ; imarked++)
+		sortidx_add(&filedb->names, renum[imarked]);
+	sortidx_compact(&filedb->names);
+	init_perms(filedb);
+	reindex(filedb);
 
 	/* set as changed */
-	filedb->frules.saved = uuidlen;
-	filedb->fnames.saved = uuidlen;
+	fbuf_touch(&filedb->frules, uuidlen);
+	fbuf_touch(&filedb->fnames, uuidlen);
 	filedb->is_changed = true;
 }
 
@@ -923,6 +1393,18 @@ sync_itf(
 	return syncdb(filedb);
 }
 
+#if defined(WITH_FILEDB_WAL)
+/** implementation of anydb_itf.flush */
+static
+int
+flush_itf(
+	void *clodb
+) {
+	filedb_t *filedb = clodb;
+	return wal_flush(&filedb->wal);
+}
+#endif
+
 /** implementation of anydb_itf.destroy */
 static
 void
@@ -933,6 +1415,9 @@ destroy_itf(
 	if (filedb) {
 		if (filedb->frules.name)
 			closedb(filedb);
+		ruleidx_destroy(&filedb->index);
+		sortidx_destroy(&filedb->names);
+		sortidx_destroy(&filedb->perms);
 		free(filedb);
 	}
 }
@@ -949,13 +1434,19 @@ init_anydb_itf(
 	filedb->anydb.clodb = filedb;
 
 	filedb->anydb.itf.index = index_itf;
+	filedb->anydb.itf.index_permission = index_permission_itf;
 	filedb->anydb.itf.string = string_itf;
 	filedb->anydb.itf.transaction = transaction_itf;
 	filedb->anydb.itf.apply = apply_itf;
+	filedb->anydb.itf.lookup = lookup_itf;
 	filedb->anydb.itf.add = add_itf;
 	filedb->anydb.itf.gc = gc_itf;
 	filedb->anydb.itf.sync = sync_itf;
+#if defined(WITH_FILEDB_WAL)
+	filedb->anydb.itf.flush = flush_itf;
+#endif
 	filedb->anydb.itf.destroy = destroy_itf;
+	filedb->anydb.next_expire = 0;
 }
 
 /* see filedb.h */
@@ -977,6 +1468,10 @@ filedb_create(
 	/* init anydb interface */
 	init_anydb_itf(filedb);
 
+	/* init indexes of names */
+	sortidx_init(&filedb->names, cmpnames, cmpkeyname, filedb);
+	sortidx_init(&filedb->perms, cmpperms, cmpkeyperm, filedb);
+
 	/* open the database file */
 	rc = opendb(filedb, directory, basename);
 	if (rc)
@@ -91,7 +91,7 @@ static
 const char
 help__text[] =
 	"\n"
-	"Commands are: list, set, drop, check, scheck, test, stest, cache, clearall, quit, log, help\n"
+	"Commands are: list, set, drop, check, scheck, test, stest, cache, clearall, quit, log, stats, help\n"
 	"Type 'help command' to get help on the command\n"
 	"Type 'help expiration' to get help on expirations\n"
 	"\n"
@@ -233,6 +233,18 @@ help_log_text[] =
 	"\n"
 ;
 
+static
+const char
+help_stats_text[] =
+	"\n"
+	"Command: stats\n"
+	"\n"
+	"Prints the statistics of the server: the dispatched events, the waits\n"
+	"for events, the most events dispatched by one wait and the hits, the\n"
+	"misses, the count and the size of its cache of decisions.\n"
+	"\n"
+;
+
 static
 const char
 help_cache_text[] =
@@ -615,6 +627,22 @@ int do_log(int ac, char **av)
 	return uc;
 }
 
+void statscb(void *closure, const char *name, unsigned long value)
+{
+	fprintf(stdout, "%s %lu\n", name, value);
+}
+
+int do_stats(int ac, char **av)
+{
+	int uc, rc;
+
+	plink(ac, av, &uc, 1);
+	last_status = rc = cynagora_stats(cynagora, statscb, NULL);
+	if (rc < 0)
+		fprintf(stderr, "error %s\n", strerror(-rc));
+	return uc;
+}
+
 int do_help(int ac, char **av)
 {
 	if (ac > 1 && !strcmp(av[1], "list"))
@@ -639,6 +667,8 @@ int do_help(int ac, char **av)
 		fprintf(stdout, "%s", help_clearall_text);
 	else if (ac > 1 && !strcmp(av[1], "log"))
 		fprintf(stdout, "%s", help_log_text);
+	else if (ac > 1 && !strcmp(av[1], "stats"))
+		fprintf(stdout, "%s", help_stats_text);
 	else if (ac > 1 && !strcmp(av[1], "quit"))
 		fprintf(stdout, "%s", help_quit_text);
 	else if (ac > 1 && !strcmp(av[1], "help"))
@@ -684,6 +714,9 @@ int do_any(int ac, char **av, int forcesync)
 	if (!strcmp(av[0], "log"))
 		return do_log(ac, av);
 
+	if (!strcmp(av[0], "stats"))
+		return do_stats(ac, av);
+
 	if (!strcmp(av[0], "clear")) {
 		cynagora_cache_clear(cynagora);
 		return 1;
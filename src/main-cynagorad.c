@@ -57,36 +57,44 @@
 #endif
 
 #define _OFFLINE_     '\001'
+#define _CACHEAGENTS_ '\002'
 #define _NO_CONFIG_   'C'
 #define _CONFIG_      'c'
 #define _DUMP_        'D'
 #define _DBDIR_       'd'
 #define _FORCEINIT_   'f'
 #define _GROUP_       'g'
+#define _HIGHWATER_   'H'
 #define _HELP_        'h'
+#define _DECISIONS_   'k'
 #define _INIT_        'i'
 #define _LOG_         'l'
 #define _MAKEDBDIR_   'm'
 #define _MAKESOCKDIR_ 'M'
 #define _OWNSOCKDIR_  'O'
 #define _OWNDBDIR_    'o'
+#define _SHAREDCACHE_ 's'
 #define _SOCKETDIR_   'S'
 #define _USER_        'u'
 #define _VERSION_     'v'
+#define _WORKERS_     'w'
 
 static
 const char
-shortopts[] = "Cc:Dd:fg:hi:lmMOoS:u:v";
+shortopts[] = "Cc:Dd:fg:H:hi:k:lmMOosS:u:vw:";
 
 static
 const struct option
 longopts[] = {
+	{ "cache-agents", 0, NULL, _CACHEAGENTS_ },
 	{ "config", 1, NULL, _CONFIG_ },
 	{ "dbdir", 1, NULL, _DBDIR_ },
+	{ "decision-cache", 1, NULL, _DECISIONS_ },
 	{ "dump", 0, NULL, _DUMP_ },
 	{ "force-init", 0, NULL, _FORCEINIT_ },
 	{ "group", 1, NULL, _GROUP_ },
 	{ "help", 0, NULL, _HELP_ },
+	{ "high-water", 1, NULL, _HIGHWATER_ },
 	{ "init", 1, NULL, _INIT_ },
 	{ "log", 0, NULL, _LOG_ },
 	{ "make-db-dir", 0, NULL, _MAKEDBDIR_ },
@@ -95,9 +103,11 @@ longopts[] = {
 	{ "offline", 0, NULL, _OFFLINE_ },
 	{ "own-db-dir", 0, NULL, _OWNDBDIR_ },
 	{ "own-socket-dir", 0, NULL, _OWNSOCKDIR_ },
+	{ "shared-cache", 0, NULL, _SHAREDCACHE_ },
 	{ "socketdir", 1, NULL, _SOCKETDIR_ },
 	{ "user", 1, NULL, _USER_ },
 	{ "version", 0, NULL, _VERSION_ },
+	{ "workers", 1, NULL, _WORKERS_ },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -129,6 +139,15 @@ helptxt[] =
 	"	-M, --make-socket-dir make the socket directory\n"
 	"	-O, --own-socket-dir  set user and group on socket directory\n"
 	"\n"
+	"	-w, --workers n       serve check clients with n threads\n"
+	"	                        (default: 0, main thread only)\n"
+	"	-H, --high-water n    stop reading requests of clients having\n"
+	"	                        more than n bytes of pending replies\n"
+	"	-s, --shared-cache    share decisions with check clients\n"
+	"	-k, --decision-cache n\n"
+	"	                      keep n decisions in cache, 0 for no cache\n"
+	"	    --cache-agents    also cache results of agents having an expiration\n"
+	"\n"
 	"	-h, --help            print this help and exit\n"
 	"	-v, --version         print the version and exit\n"
 	"\n"
@@ -189,10 +208,13 @@ int main(int ac, char **av)
 		case _VERSION_:
 			version = 1;
 			break;
+		case _CACHEAGENTS_:
 		case _DUMP_:
 		case _DBDIR_:
+		case _DECISIONS_:
 		case _FORCEINIT_:
 		case _GROUP_:
+		case _HIGHWATER_:
 		case _INIT_:
 		case _LOG_:
 		case _MAKEDBDIR_:
@@ -200,8 +222,10 @@ int main(int ac, char **av)
 		case _OFFLINE_:
 		case _OWNSOCKDIR_:
 		case _OWNDBDIR_:
+		case _SHAREDCACHE_:
 		case _SOCKETDIR_:
 		case _USER_:
+		case _WORKERS_:
 			break;
 		default:
 			error = 1;
@@ -239,18 +263,35 @@ int main(int ac, char **av)
 			break;
 
 		switch(opt) {
+		case _CACHEAGENTS_:
+			settings.cacheagents = 1;
+			break;
 		case _DUMP_:
 			dump = 1;
 			break;
 		case _DBDIR_:
 			settings.dbdir = optarg;
 			break;
+		case _DECISIONS_:
+			settings.decisioncache = isid(optarg);
+			if (settings.decisioncache < 0) {
+				fprintf(stderr, "bad count of decisions '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case _FORCEINIT_:
 			settings.forceinit = 1;
 			break;
 		case _GROUP_:
 			settings.group = optarg;
 			break;
+		case _HIGHWATER_:
+			settings.highwater = isid(optarg);
+			if (settings.highwater < 0) {
+				fprintf(stderr, "bad high water mark '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case _INIT_:
 			settings.init = optarg;
 			break;
@@ -272,12 +313,22 @@ int main(int ac, char **av)
 		case _OWNDBDIR_:
 			settings.owndbdir = 1;
 			break;
+		case _SHAREDCACHE_:
+			settings.sharedcache = 1;
+			break;
 		case _SOCKETDIR_:
 			settings.socketdir = optarg;
 			break;
 		case _USER_:
 			settings.user = optarg;
 			break;
+		case _WORKERS_:
+			settings.workers = isid(optarg);
+			if (settings.workers < 0) {
+				fprintf(stderr, "bad count of workers '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		default:
 			break;
 		}
@@ -435,6 +486,11 @@ int main(int ac, char **av)
 	/* initialize server */
 	setvbuf(stderr, NULL, _IOLBF, 1000);
 	cyn_server_log = (bool)flog;
+	cyn_server_workers = (unsigned)settings.workers;
+	if (settings.highwater >= 0)
+		cyn_server_high_water = (size_t)settings.highwater;
+	cyn_server_shared_cache = (bool)settings.sharedcache;
+	cyn_decision_cache_setup(settings.decisioncache, (bool)settings.cacheagents);
 	signal(SIGPIPE, SIG_IGN); /* avoid SIGPIPE! */
 	rc = cyn_server_create(&server, spec_socket_admin, spec_socket_check, spec_socket_agent);
 	if (rc < 0) {
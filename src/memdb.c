@@ -25,15 +25,18 @@
 #include <stdbool.h>
 #include <time.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <assert.h>
 
 #include "data.h"
 #include "anydb.h"
 #include "memdb.h"
+#include "ruleidx.h"
 
 #define RULE_BLOC_SIZE   20 /**< rule block size */
-#define STRING_BLOC_SIZE 30 /**< string bloc size */
+#define STRING_MIN_ALLOC 32 /**< minimal allocation for strings */
+#define NO_SLOT ((uint32_t)0xffffffffu) /**< empty slot of hash tables */
 
 #define TAG_CLEAN    0 /**< tag for clean */
 #define TAG_DELETED  1 /**< tag for deleted */
@@ -57,6 +60,45 @@ struct rule
 	uint8_t tag;
 };
 
+/**
+ * structure for strings of memory database
+ */
+struct string
+{
+	/** the string or NULL when the entry is free */
+	char *value;
+
+	/** hash of the string */
+	uint32_t hash;
+
+	/** hash of the string ignoring case */
+	uint32_t nchash;
+
+	/**
+	 * count of references by rules of the database when used
+	 * or index of the next free entry when free
+	 */
+	uint32_t refcount;
+
+	/** is the string indexed as permission? */
+	bool permission;
+};
+
+/**
+ * open addressing hash table of string indexes
+ */
+struct htable
+{
+	/** count of slots: zero or a power of 2 */
+	uint32_t size;
+
+	/** count of used slots */
+	uint32_t count;
+
+	/** the slots: index of strings or NO_SLOT */
+	anydb_idx_t *slots;
+};
+
 /**
  * Structure for the memory database
  */
@@ -69,10 +111,16 @@ struct memdb
 	struct {
 		/** allocated count for strings */
 		uint32_t alloc;
-		/** used count for strings */
+		/** used count of entries for strings */
 		uint32_t count;
+		/** head of the list of free entries */
+		uint32_t free;
 		/** array of strings */
-		char **values;
+		struct string *values;
+		/** hash table of the strings */
+		struct htable names;
+		/** hash table of the permissions, ignoring case */
+		struct htable perms;
 	} strings;
 
 	/** rules */
@@ -85,6 +133,9 @@ struct memdb
 		struct rule *values;
 	} rules;
 
+	/** index of the rules */
+	ruleidx_t index;
+
 	/** transaction */
 	struct {
 		/** rule count at the beginning of the transaction */
@@ -95,6 +146,263 @@ struct memdb
 };
 typedef struct memdb memdb_t;
 
+/**
+ * Compute the hash of the string 'name'
+ * @param name the string to hash
+ * @param nocase if true, the case is ignored
+ * @return the hash of the name
+ */
+static
+uint32_t
+hash_name(
+	const char *name,
+	bool nocase
+) {
+	uint32_t h = 0x811c9dc5u;
+	unsigned char c;
+
+	while ((c = (unsigned char)*name++))
+		h = (h ^ (nocase ? (uint32_t)tolower(c) : c)) * 0x01000193u;
+	return h;
+}
+
+/**
+ * Get the hash of the string of index 'idx' for the table
+ * @param memdb the database
+ * @param idx index of the string
+ * @param nocase true for the table of permissions
+ * @return the hash
+ */
+static
+uint32_t
+hash_of(
+	memdb_t *memdb,
+	anydb_idx_t idx,
+	bool nocase
+) {
+	struct string *str = &memdb->strings.values[idx];
+	return nocase ? str->nchash : str->hash;
+}
+
+/**
+ * Search in the hash table 'ht' the 'name' of 'hash'
+ * @param memdb the database
+ * @param ht the hash table
+ * @param name the name to search
+ * @param hash the hash of the name
+ * @param nocase true for the table of permissions
+ * @return the slot of the name if found or the empty slot where to put it
+ */
+static
+uint32_t
+htable_search(
+	memdb_t *memdb,
+	struct htable *ht,
+	const char *name,
+	uint32_t hash,
+	bool nocase
+) {
+	uint32_t mask = ht->size - 1, pos = hash & mask;
+	anydb_idx_t idx;
+	struct string *str;
+
+	while ((idx = ht->slots[pos]) != NO_SLOT) {
+		str = &memdb->strings.values[idx];
+		if ((nocase ? str->nchash : str->hash) == hash
+		 && !(nocase ? strcasecmp : strcmp)(str->value, name))
+			break;
+		pos = (pos + 1) & mask;
+	}
+	return pos;
+}
+
+/**
+ * Ensure that the hash table 'ht' can receive one more item
+ * @param memdb the database
+ * @param ht the hash table
+ * @param nocase true for the table of permissions
+ * @return 0 on success or -ENOMEM
+ */
+static
+int
+htable_grow(
+	memdb_t *memdb,
+	struct htable *ht,
+	bool nocase
+) {
+	uint32_t size, i, pos, mask;
+	anydb_idx_t *slots, idx;
+
+	/* keep the load factor below 1/2 */
+	if (2 * (ht->count + 1) <= ht->size)
+		return 0;
+
+	size = ht->size ? 2 * ht->size : STRING_MIN_ALLOC;
+	slots = malloc(size * sizeof *slots);
+	if (!slots)
+		return -ENOMEM;
+	memset(slots, 0xff, size * sizeof *slots);
+	mask = size - 1;
+	for (i = 0 ; i < ht->size ; i++) {
+		idx = ht->slots[i];
+		if (idx != NO_SLOT) {
+			pos = hash_of(memdb, idx, nocase) & mask;
+			while (slots[pos] != NO_SLOT)
+				pos = (pos + 1) & mask;
+			slots[pos] = idx;
+		}
+	}
+	free(ht->slots);
+	ht->slots = slots;
+	ht->size = size;
+	return 0;
+}
+
+/**
+ * Remove the string of index 'idx' from the hash table 'ht'
+ * @param memdb the database
+ * @param ht the hash table
+ * @param idx index of the string to remove
+ * @param nocase true for the table of permissions
+ */
+static
+void
+htable_remove(
+	memdb_t *memdb,
+	struct htable *ht,
+	anydb_idx_t idx,
+	bool nocase
+) {
+	uint32_t mask = ht->size - 1, i, j, k;
+
+	/* search the slot */
+	i = hash_of(memdb, idx, nocase) & mask;
+	while (ht->slots[i] != idx)
+		i = (i + 1) & mask;
+
+	/* backward shift of the slots following */
+	for (j = (i + 1) & mask ; ht->slots[j] != NO_SLOT ; j = (j + 1) & mask) {
+		k = hash_of(memdb, ht->slots[j], nocase) & mask;
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			ht->slots[i] = ht->slots[j];
+			i = j;
+		}
+	}
+	ht->slots[i] = NO_SLOT;
+	ht->count--;
+}
+
+/**
+ * Increment the reference count of the string 'idx'
+ * @param memdb the database
+ * @param idx index of the string, can be special
+ */
+static
+void
+ref(
+	memdb_t *memdb,
+	anydb_idx_t idx
+) {
+	if (anydb_idx_is_string(idx))
+		memdb->strings.values[idx].refcount++;
+}
+
+/**
+ * Decrement the reference count of the string 'idx'
+ * @param memdb the database
+ * @param idx index of the string, can be special
+ */
+static
+void
+unref(
+	memdb_t *memdb,
+	anydb_idx_t idx
+) {
+	if (anydb_idx_is_string(idx))
+		memdb->strings.values[idx].refcount--;
+}
+
+/**
+ * Increment or decrement the reference counts of the strings of the rule
+ * @param memdb the database
+ * @param rule the rule
+ * @param add true for incrementing or false for decrementing
+ */
+static
+void
+ref_rule(
+	memdb_t *memdb,
+	struct rule *rule,
+	bool add
+) {
+	void (*fun)(memdb_t*, anydb_idx_t) = add ? ref : unref;
+
+	fun(memdb, rule->key.client);
+	fun(memdb, rule->key.session);
+	fun(memdb, rule->key.user);
+	fun(memdb, rule->key.permission);
+	fun(memdb, rule->value.value);
+}
+
+/**
+ * Create a new string entry for 'name' of 'hash'
+ * @param memdb the database
+ * @param idx where to store the index of the created string
+ * @param name the string
+ * @param hash the hash of the string
+ * @return 0 on success or -ENOMEM
+ */
+static
+int
+create_string(
+	memdb_t *memdb,
+	anydb_idx_t *idx,
+	const char *name,
+	uint32_t hash
+) {
+	struct string *strings = memdb->strings.values;
+	uint32_t i, alloc;
+	char *s;
+
+	/* ensure room in the table */
+	if (htable_grow(memdb, &memdb->strings.names, false))
+		return -ENOMEM;
+
+	/* ensure room in the array */
+	if (memdb->strings.free == NO_SLOT
+	 && memdb->strings.count == memdb->strings.alloc) {
+		alloc = memdb->strings.alloc ? 2 * memdb->strings.alloc : STRING_MIN_ALLOC;
+		if (alloc > AnyIdx_Max)
+			return -ENOMEM;
+		strings = realloc(strings, alloc * sizeof *strings);
+		if (!strings)
+			return -ENOMEM;
+		memdb->strings.values = strings;
+		memdb->strings.alloc = alloc;
+	}
+
+	/* create */
+	s = strdup(name);
+	if (s == NULL)
+		return -ENOMEM;
+	i = memdb->strings.free;
+	if (i != NO_SLOT)
+		memdb->strings.free = strings[i].refcount;
+	else
+		i = memdb->strings.count++;
+	strings[i].value = s;
+	strings[i].hash = hash;
+	strings[i].nchash = hash_name(s, true);
+	strings[i].refcount = 0;
+	strings[i].permission = false;
+
+	/* record */
+	memdb->strings.names.slots[htable_search(memdb, &memdb->strings.names, s, hash, false)] = i;
+	memdb->strings.names.count++;
+	*idx = i;
+	return 0;
+}
+
 /** implementation of anydb_itf.index */
 static
 int
@@ -105,17 +413,18 @@ index_itf(
 	bool create
 ) {
 	memdb_t *memdb = clodb;
-	char *s, **strings = memdb->strings.values;
+	uint32_t hash, pos;
 	anydb_idx_t i;
 
 	/* search */
-	i = 0;
-	while (i < memdb->strings.count) {
-		if (!strcmp(name, strings[i])) {
+	hash = hash_name(name, false);
+	if (memdb->strings.names.size) {
+		pos = htable_search(memdb, &memdb->strings.names, name, hash, false);
+		i = memdb->strings.names.slots[pos];
+		if (i != NO_SLOT) {
 			*idx = i;
 			return 0;
 		}
-		i++;
 	}
 
 	/* not found */
@@ -125,24 +434,52 @@ index_itf(
 	}
 
 	/* create */
-	s = strdup(name);
-	if (s == NULL)
-		return -ENOMEM;
-	if (memdb->strings.count == memdb->strings.alloc) {
-		strings = realloc(strings, (memdb->strings.alloc
-					+ STRING_BLOC_SIZE) * sizeof *strings);
-		if (!strings) {
-			free(s);
-			return -ENOMEM;
+	return create_string(memdb, idx, name, hash);
+}
+
+/** implementation of anydb_itf.index_permission */
+static
+int
+index_permission_itf(
+	void *clodb,
+	anydb_idx_t *idx,
+	const char *name,
+	bool create
+) {
+	memdb_t *memdb = clodb;
+	struct htable *ht = &memdb->strings.perms;
+	uint32_t nchash, pos;
+	anydb_idx_t i;
+	int rc;
+
+	/* search */
+	nchash = hash_name(name, true);
+	if (ht->size) {
+		pos = htable_search(memdb, ht, name, nchash, true);
+		i = ht->slots[pos];
+		if (i != NO_SLOT) {
+			*idx = i;
+			return 0;
 		}
-		memdb->strings.values = strings;
-		memdb->strings.alloc += STRING_BLOC_SIZE;
 	}
-	i = memdb->strings.count;
-	*idx = i;
-	strings[i] = s;
-	memdb->strings.count = i + 1;
-	return 0;
+
+	/* not found */
+	if (!create) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* create */
+	if (htable_grow(memdb, ht, true))
+		return -ENOMEM;
+	rc = index_itf(clodb, &i, name, true);
+	if (rc == 0) {
+		memdb->strings.values[i].permission = true;
+		ht->slots[htable_search(memdb, ht, name, nchash, true)] = i;
+		ht->count++;
+		*idx = i;
+	}
+	return rc;
 }
 
 /** implementation of anydb_itf.string */
@@ -154,8 +491,63 @@ string_itf(
 ) {
 	memdb_t *memdb = clodb;
 
-	assert(idx < memdb->strings.count);
-	return memdb->strings.values[idx];
+	assert(idx < memdb->strings.count && memdb->strings.values[idx].value);
+	return memdb->strings.values[idx].value;
+}
+
+/**
+ * Remove the rule at index 'ir' by moving the last rule at its place
+ * @param memdb the database
+ * @param ir index of the rule to remove
+ */
+static
+void
+remove_rule(
+	memdb_t *memdb,
+	uint32_t ir
+) {
+	struct rule *rules = memdb->rules.values;
+
+	ref_rule(memdb, &rules[ir], false);
+	rules[ir] = rules[--memdb->rules.count];
+	ruleidx_remove(&memdb->index, ir);
+}
+
+/**
+ * Perform the action 'a' returned by an apply callback on the rule
+ * at index 'ir'
+ * @param memdb the database
+ * @param ir index of the rule
+ * @param a the action to perform
+ * @param previous the value string of the rule before the callback
+ * @return true if the rule was removed from the array
+ */
+static
+bool
+act(
+	memdb_t *memdb,
+	uint32_t ir,
+	anydb_action_t a,
+	anydb_idx_t previous
+) {
+	struct rule *rules = memdb->rules.values;
+
+	if (a & Anydb_Action_Remove) {
+		if (memdb->transaction.active)
+			rules[ir].tag = TAG_DELETED;
+		else {
+			remove_rule(memdb, ir);
+			return true;
+		}
+	} else if (a & Anydb_Action_Update) {
+		unref(memdb, previous);
+		ref(memdb, rules[ir].value.value);
+		if (memdb->transaction.active)
+			rules[ir].tag = TAG_CHANGED;
+		else
+			rules[ir].saved = rules[ir].value;
+	}
+	return false;
 }
 
 /** implementation of anydb_itf.apply */
@@ -170,27 +562,60 @@ apply_itf(
 	struct rule *rules = memdb->rules.values;
 	uint32_t ir;
 	anydb_action_t a;
+	anydb_idx_t previous;
 
 	ir = 0;
 	while (ir < memdb->rules.count) {
 		if (memdb->transaction.active && rules[ir].tag == TAG_DELETED)
 			ir++;
 		else {
+			previous = rules[ir].value.value;
 			a = oper(closure, &rules[ir].key, &rules[ir].value);
-			if (a & Anydb_Action_Remove) {
-				if (memdb->transaction.active)
-					rules[ir++].tag = TAG_DELETED;
-				else
-					rules[ir] = rules[--memdb->rules.count];
-			} else if (a & Anydb_Action_Update) {
-				if (memdb->transaction.active)
-					rules[ir].tag = TAG_CHANGED;
-				else
-					rules[ir].saved = rules[ir].value;
-			}
+			if (!act(memdb, ir, a, previous))
+				ir++;
 			if (a & Anydb_Action_Stop)
 				return;
-			ir += !(a & Anydb_Action_Remove);
+		}
+	}
+}
+
+/** implementation of anydb_itf.lookup */
+static
+void
+lookup_itf(
+	void *clodb,
+	const anydb_key_t *key,
+	anydb_applycb_t *oper,
+	void *closure
+) {
+	memdb_t *memdb = clodb;
+	struct rule *rules = memdb->rules.values;
+	anydb_key_t keys[RuleIdx_Max_Hashes];
+	uint32_t hashes[RuleIdx_Max_Hashes];
+	unsigned ih, nh;
+	uint32_t ir, next;
+	anydb_action_t a;
+	anydb_idx_t previous;
+
+	nh = ruleidx_search_hashes(key, keys, hashes);
+	for (ih = 0 ; ih < nh ; ih++) {
+		ir = ruleidx_first(&memdb->index, hashes[ih]);
+		while (ir != RuleIdx_End) {
+			next = ruleidx_next(&memdb->index, ir);
+			if (rules[ir].key.client == keys[ih].client
+			 && rules[ir].key.session == keys[ih].session
+			 && rules[ir].key.user == keys[ih].user
+			 && rules[ir].key.permission == keys[ih].permission
+			 && (!memdb->transaction.active || rules[ir].tag != TAG_DELETED)) {
+				previous = rules[ir].value.value;
+				a = oper(closure, &rules[ir].key, &rules[ir].value);
+				/* when removed, the last rule is moved at ir */
+				if (act(memdb, ir, a, previous) && next == memdb->rules.count)
+					next = ir;
+				if (a & Anydb_Action_Stop)
+					return;
+			}
+			ir = next;
 		}
 	}
 }
@@ -218,31 +643,36 @@ transaction_itf(
 		if (!memdb->transaction.active)
 			return -EINVAL;
 		rules = memdb->rules.values;
-		count = memdb->rules.count;
 		ir = 0;
-		while(ir < count) {
+		while(ir < memdb->rules.count) {
 			switch (rules[ir].tag) {
 			case TAG_CLEAN:
 				ir++;
 				break;
 			case TAG_DELETED:
-				rules[ir] = rules[--count];
+				remove_rule(memdb, ir);
 				break;
 			case TAG_CHANGED:
+				rules[ir].saved = rules[ir].value;
 				rules[ir++].tag = TAG_CLEAN;
 				break;
 			}
 		}
-		memdb->rules.count = count;
 		memdb->transaction.active = false;
 		break;
 	case Anydb_Transaction_Cancel:
 		if (!memdb->transaction.active)
 			return -EINVAL;
 		rules = memdb->rules.values;
-		count = memdb->rules.count = memdb->transaction.count;
+		count = memdb->transaction.count;
+		for (ir = count ; ir < memdb->rules.count ; ir++)
+			ref_rule(memdb, &rules[ir], false);
+		memdb->rules.count = count;
+		ruleidx_truncate(&memdb->index, count);
 		for (ir = 0 ; ir < count ; ir++) {
 			if (rules[ir].tag != TAG_CLEAN) {
+				unref(memdb, rules[ir].value.value);
+				ref(memdb, rules[ir].saved.value);
 				rules[ir].value = rules[ir].saved;
 				rules[ir].tag = TAG_CLEAN;
 			}
@@ -265,6 +695,7 @@ add_itf(
 	struct rule *rules;
 	uint32_t count;
 	uint32_t alloc;
+	int rc;
 
 	rules = memdb->rules.values;
 	count = memdb->rules.count;
@@ -281,40 +712,14 @@ add_itf(
 	rules->key = *key;
 	rules->saved = rules->value = *value;
 	rules->tag = TAG_CLEAN;
+	rc = ruleidx_add(&memdb->index, ruleidx_hash(&rules->key));
+	if (rc < 0)
+		return rc;
+	ref_rule(memdb, rules, true);
 	memdb->rules.count = count + 1;
 	return 0;
 }
 
-/**
- * Mark the 'item' as being used
- * @param renum array handling marked items
- * @param item the item to check
- */
-static
-void
-gc_mark(
-	anydb_idx_t *renum,
-	anydb_idx_t item
-) {
-	if (anydb_idx_is_string(item))
-		renum[item] = 1;
-}
-
-/**
- * return the renumring of 'item' within 'renum'
- * @param renum the renumbering array
- * @param item the item to renumber
- * @return the renumbered item
- */
-static
-anydb_idx_t
-gc_renum(
-	anydb_idx_t *renum,
-	anydb_idx_t item
-) {
-	return anydb_idx_is_special(item)? item : renum[item];
-}
-
 /** implementation of anydb_itf.gc */
 static
 void
@@ -322,53 +727,23 @@ gc_itf(
 	void *clodb
 ) {
 	memdb_t *memdb = clodb;
-	uint32_t i, j;
+	uint32_t i;
 	uint32_t rule_count = memdb->rules.count;
-	uint32_t name_count = memdb->strings.count;
-	char **strings = memdb->strings.values;
+	struct string *strings = memdb->strings.values;
 	struct rule *rules = memdb->rules.values;
-	anydb_idx_t *renum = alloca(name_count * sizeof *renum);
-
-	/* mark used strings */
-	memset(renum, 0, name_count * sizeof *renum);
-	for (i = 0 ; i < rule_count ; i++) {
-		gc_mark(renum, rules[i].key.client);
-		gc_mark(renum, rules[i].key.session);
-		gc_mark(renum, rules[i].key.user);
-		gc_mark(renum, rules[i].key.permission);
-		gc_mark(renum, rules[i].value.value);
-	}
 
-	/* pack the used strings */
-	for (i = j = 0 ; i < name_count ; i++) {
-		if (renum[i]) {
-			strings[j] = strings[i];
-			renum[i] = j++;
-		} else {
-			free(strings[i]);
-			renum[i] = AnyIdx_Invalid;
+	/* free the unreferenced strings */
+	for (i = 0 ; i < memdb->strings.count ; i++) {
+		if (strings[i].value && !strings[i].refcount) {
+			htable_remove(memdb, &memdb->strings.names, i, false);
+			if (strings[i].permission)
+				htable_remove(memdb, &memdb->strings.perms, i, true);
+			free(strings[i].value);
+			strings[i].value = NULL;
+			strings[i].refcount = memdb->strings.free;
+			memdb->strings.free = i;
 		}
 	}
-	if (name_count != j) {
-		/* renumber the items of the database */
-		memdb->strings.count = name_count = j;
-		for (i = 0 ; i < rule_count ; i++) {
-			rules[i].key.client = gc_renum(renum, rules[i].key.client);
-			rules[i].key.session = gc_renum(renum, rules[i].key.session);
-			rules[i].key.user = gc_renum(renum, rules[i].key.user);
-			rules[i].key.permission = gc_renum(renum, rules[i].key.permission);
-			rules[i].value.value = gc_renum(renum, rules[i].value.value);
-		}
-	}
-
-	/* decrease size of array for strings */
-	i = memdb->strings.alloc;
-	while (name_count + STRING_BLOC_SIZE < i)
-		i -= STRING_BLOC_SIZE;
-	if (i != memdb->strings.alloc) {
-		memdb->strings.alloc = i;
-		memdb->strings.values = realloc(strings, i * sizeof *strings);
-	}
 
 	/* decrease size of array for rules */
 	i = memdb->rules.alloc;
@@ -387,9 +762,16 @@ destroy_itf(
 	void *clodb
 ) {
 	memdb_t *memdb = clodb;
+	uint32_t i;
+
 	if (memdb) {
+		for (i = 0 ; i < memdb->strings.count ; i++)
+			free(memdb->strings.values[i].value);
 		free(memdb->strings.values);
+		free(memdb->strings.names.slots);
+		free(memdb->strings.perms.slots);
 		free(memdb->rules.values);
+		ruleidx_destroy(&memdb->index);
 		free(memdb);
 	}
 }
@@ -406,22 +788,35 @@ init_memdb(
 	memdb->db.clodb = memdb;
 
 	memdb->db.itf.index = index_itf;
+	memdb->db.itf.index_permission = index_permission_itf;
 	memdb->db.itf.string = string_itf;
 	memdb->db.itf.transaction = transaction_itf;
 	memdb->db.itf.apply = apply_itf;
+	memdb->db.itf.lookup = lookup_itf;
 	memdb->db.itf.add = add_itf;
 	memdb->db.itf.gc = gc_itf;
 	memdb->db.itf.sync = 0;
+	memdb->db.itf.flush = 0;
 	memdb->db.itf.destroy = destroy_itf;
+	memdb->db.next_expire = 0;
 
 	memdb->strings.alloc = 0;
 	memdb->strings.count = 0;
+	memdb->strings.free = NO_SLOT;
 	memdb->strings.values = NULL;
+	memdb->strings.names.size = 0;
+	memdb->strings.names.count = 0;
+	memdb->strings.names.slots = NULL;
+	memdb->strings.perms.size = 0;
+	memdb->strings.perms.count = 0;
+	memdb->strings.perms.slots = NULL;
 
 	memdb->rules.alloc = 0;
 	memdb->rules.count = 0;
 	memdb->rules.values = NULL;
 
+	ruleidx_init(&memdb->index);
+
 	memdb->transaction.count = 0;
 	memdb->transaction.active = false;
 }
@@ -25,6 +25,9 @@
 
 #include "pollitem.h"
 
+/** maximum count of events dispatched by one wait */
+#define MAX_EVENTS 32
+
 /**
  * Wraps the call to epoll_ctl for operation 'op'
  *
@@ -81,14 +84,14 @@ pollitem_wait_dispatch(
 	int pollfd,
 	int timeout
 ) {
-	int rc;
-	struct epoll_event ev;
+	int rc, i;
+	struct epoll_event evs[MAX_EVENTS];
 	pollitem_t *pi;
 
-	rc = epoll_wait(pollfd, &ev, 1, timeout);
-	if (rc == 1) {
-		pi = ev.data.ptr;
-		pi->handler(pi, ev.events, pollfd);
+	rc = epoll_wait(pollfd, evs, MAX_EVENTS, timeout);
+	for (i = 0 ; i < rc ; i++) {
+		pi = evs[i].data.ptr;
+		pi->handler(pi, evs[i].events, pollfd);
 	}
 	return rc;
 }
@@ -86,12 +86,14 @@ pollitem_del(
 );
 
 /**
- * Wait one event on epoll and dispatch it to its pollitem callback
+ * Wait events on epoll and dispatch them to their pollitem callbacks.
+ * Many events can be dispatched by one call, so a pollitem deleted by
+ * a callback must remain valid until this function returns.
  *
  * @param pollfd file descriptor of the epoll
  * @param timeout time to wait
  * @return 0 on timeout
- *         1 if a callback was called
+ *         the count of callbacks called
  *         -1 with errno set accordingly to epoll_wait
  */
 extern
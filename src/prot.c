@@ -27,15 +27,32 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #ifndef PROT_MAX_FIELDS
 #define PROT_MAX_FIELDS 20
 #endif
+#ifndef PROT_MIN_BUFFER_LENGTH
+#define PROT_MIN_BUFFER_LENGTH 1024
+#endif
 #ifndef PROT_MAX_BUFFER_LENGTH
-#define PROT_MAX_BUFFER_LENGTH 2000
+#define PROT_MAX_BUFFER_LENGTH 65536
+#endif
+#ifndef PROT_POOL_LENGTH
+#define PROT_POOL_LENGTH 32
 #endif
 #ifndef PROT_FIELD_SEPARATOR
 #define PROT_FIELD_SEPARATOR ' '
@@ -46,6 +63,28 @@
 #ifndef PROT_ESCAPE
 #define PROT_ESCAPE '\\'
 #endif
+#ifndef PROT_DICT_LENGTH
+#define PROT_DICT_LENGTH 32
+#endif
+#ifndef PROT_INTERN_MAX_LENGTH
+#define PROT_INTERN_MAX_LENGTH 127
+#endif
+
+/*
+ * Tags of the fields of the binary frames, they are the 2 lower bits
+ * of the varint starting the field, the upper bits being the argument
+ */
+/** a string, the argument is its length, its bytes follow */
+#define TAG_LITERAL 0
+/** a string interned in the slot given by the argument, its length and bytes follow */
+#define TAG_DEFINE  1
+/** the string interned in the slot given by the argument */
+#define TAG_REF     2
+/** a decimal number, the argument is its value */
+#define TAG_NUMBER  3
+
+/** maximal length of a varint of 32 bits */
+#define VARINT_MAX_LENGTH 5
 
 /**
  * the structure buf is generic the meaning of pos/count is not fixed
@@ -57,11 +96,30 @@ struct buf {
 	/** a count */
 	unsigned count;
 
-	/** a fixed size content */
-	char content[PROT_MAX_BUFFER_LENGTH];
+	/** the allocated size of the content, 0 when released */
+	unsigned size;
+
+	/** the content, NULL when released */
+	char *content;
 };
 typedef struct buf buf_t;
 
+/**
+ * pool of released contents of PROT_MIN_BUFFER_LENGTH bytes, linked
+ * through their first bytes. The pool is shared by all the threads of
+ * the process so that exiting threads don't leak it.
+ */
+static struct {
+	/** mutex protecting the pool */
+	pthread_mutex_t mutex;
+
+	/** head of the list of free contents */
+	void *head;
+
+	/** count of free contents */
+	unsigned count;
+} pool = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
 /** structure for recording received fields */
 struct fields {
 	/** count of field (negative if invalid) */
@@ -72,6 +130,48 @@ struct fields {
 };
 typedef struct fields fields_t;
 
+/**
+ * dictionaries of the interned strings of the binary framing
+ */
+struct dicts {
+	/** strings interned for output, by slot */
+	char *outstrs[PROT_DICT_LENGTH];
+
+	/** hashes of the strings interned for output */
+	uint32_t outhashes[PROT_DICT_LENGTH];
+
+	/** time of last use of the strings interned for output */
+	uint32_t outuses[PROT_DICT_LENGTH];
+
+	/** clock of the uses */
+	uint32_t outclock;
+
+	/** count of definitions made by the record being put */
+	unsigned undocount;
+
+	/** the previous content of slots defined by the record being put */
+	struct {
+		/** the slot */
+		unsigned slot;
+
+		/** the previous string */
+		char *string;
+
+		/** the previous hash */
+		uint32_t hash;
+	} undo[PROT_MAX_FIELDS];
+
+	/** strings interned by the peer, by slot */
+	char *instrs[PROT_DICT_LENGTH];
+
+	/** decoded text of the received fields */
+	char *text;
+
+	/** allocated size of text */
+	unsigned textsize;
+};
+typedef struct dicts dicts_t;
+
 /**
  * structure for handling the protocol
  */
@@ -103,10 +203,121 @@ struct prot {
 	/** allow empty records */
 	int allow_empty;
 
+	/** descriptor to pass with the next written bytes or -1 */
+	int fdout;
+
+	/** accept the descriptors passed with the read bytes */
+	int accept_fd;
+
+	/** received descriptor not yet taken or -1 */
+	int fdin;
+
+	/** dictionaries of the binary framing, NULL for the text framing */
+	dicts_t *dicts;
+
 	/** the fields */
 	fields_t fields;
 };
 
+/**
+ * Get a content of PROT_MIN_BUFFER_LENGTH bytes from the pool
+ * returns the content or NULL on allocation failure
+ */
+static char *pool_get(void)
+{
+	char *content;
+
+	pthread_mutex_lock(&pool.mutex);
+	content = pool.head;
+	if (content != NULL) {
+		pool.head = *(void**)content;
+		pool.count--;
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	return content ?: malloc(PROT_MIN_BUFFER_LENGTH);
+}
+
+/**
+ * Give back the 'content' of 'size' bytes to the pool
+ */
+static void pool_put(char *content, unsigned size)
+{
+	if (size == PROT_MIN_BUFFER_LENGTH) {
+		pthread_mutex_lock(&pool.mutex);
+		if (pool.count < PROT_POOL_LENGTH) {
+			*(void**)content = pool.head;
+			pool.head = content;
+			pool.count++;
+			content = NULL;
+		}
+		pthread_mutex_unlock(&pool.mutex);
+	}
+	free(content);
+}
+
+/**
+ * Release the content of the empty 'buf'
+ */
+static void buf_release(buf_t *buf)
+{
+	if (buf->content)
+		pool_put(buf->content, buf->size);
+	buf->content = NULL;
+	buf->pos = buf->count = buf->size = 0;
+}
+
+/**
+ * Get the size to which 'buf' can grow
+ * returns the new size or 0 if the buffer is already at its maximal size
+ */
+static unsigned buf_grow_size(buf_t *buf)
+{
+	unsigned size;
+
+	if (buf->size == 0)
+		return PROT_MIN_BUFFER_LENGTH;
+	if (buf->size >= PROT_MAX_BUFFER_LENGTH)
+		return 0;
+	size = buf->size << 1;
+	return size < PROT_MAX_BUFFER_LENGTH ? size : PROT_MAX_BUFFER_LENGTH;
+}
+
+/**
+ * Grow the ring content of the output 'buf', its data
+ * is moved at the start of the new content
+ * returns:
+ *  - 0 on success
+ *  - -ECANCELED if the buffer can not grow
+ */
+static int outbuf_grow(buf_t *buf)
+{
+	unsigned size, head;
+	char *content;
+
+	size = buf_grow_size(buf);
+	if (size == 0)
+		return -ECANCELED;
+	content = buf->size ? malloc(size) : pool_get();
+	if (content == NULL)
+		return -ECANCELED;
+
+	if (buf->count) {
+		head = buf->size - buf->pos;
+		if (buf->count <= head)
+			memcpy(content, buf->content + buf->pos, buf->count);
+		else {
+			memcpy(content, buf->content + buf->pos, head);
+			memcpy(content + head, buf->content, buf->count - head);
+		}
+	}
+	if (buf->content)
+		pool_put(buf->content, buf->size);
+	buf->content = content;
+	buf->size = size;
+	buf->pos = 0;
+	return 0;
+}
+
 /**
  * Put the 'car' into the 'buf'
  * returns:
@@ -118,13 +329,13 @@ static int buf_put_car(buf_t *buf, char car)
 	unsigned pos;
 
 	pos = buf->count;
-	if (pos >= PROT_MAX_BUFFER_LENGTH)
+	if (pos >= buf->size && outbuf_grow(buf) < 0)
 		return -ECANCELED;
 
 	buf->count = pos + 1;
 	pos += buf->pos;
-	if (pos >= PROT_MAX_BUFFER_LENGTH)
-		pos -= PROT_MAX_BUFFER_LENGTH;
+	if (pos >= buf->size)
+		pos -= buf->size;
 	buf->content[pos] = car;
 	return 0;
 }
@@ -137,56 +348,69 @@ static int buf_put_car(buf_t *buf, char car)
  */
 static int buf_put_string(buf_t *buf, const char *string)
 {
-	unsigned pos, remain, escape = 0;
+	unsigned pos, remain, escape;
+	const char *iter;
 	char c;
 
+ retry:
+	iter = string;
+	escape = 0;
 	remain = buf->count;
 	pos = buf->pos + remain;
-	if (pos >= PROT_MAX_BUFFER_LENGTH)
-		pos -= PROT_MAX_BUFFER_LENGTH;
-	remain = PROT_MAX_BUFFER_LENGTH - remain;
+	if (pos >= buf->size)
+		pos -= buf->size;
+	remain = buf->size - remain;
 
 	/* put all chars of the string */
-	while ((c = *string++)) {
+	while ((c = *iter++)) {
 		/* escape special characters */
 		if (c == PROT_FIELD_SEPARATOR || c == PROT_RECORD_SEPARATOR)
 			escape = 1;
 		else if (c == PROT_ESCAPE)
-			escape = *string == 0
-			    || *string == PROT_FIELD_SEPARATOR
-			    || *string == PROT_RECORD_SEPARATOR || *string == PROT_ESCAPE;
+			escape = *iter == 0
+			    || *iter == PROT_FIELD_SEPARATOR
+			    || *iter == PROT_RECORD_SEPARATOR || *iter == PROT_ESCAPE;
 		if (escape) {
 			if (!remain--)
-				goto cancel;
+				goto grow;
 			buf->content[pos++] = PROT_ESCAPE;
-			if (pos == PROT_MAX_BUFFER_LENGTH)
+			if (pos == buf->size)
 				pos = 0;
 			escape = 0;
 		}
 		/* put the char */
 		if (!remain--)
-			goto cancel;
+			goto grow;
 		buf->content[pos++] = c;
-		if (pos == PROT_MAX_BUFFER_LENGTH)
+		if (pos == buf->size)
 			pos = 0;
 	}
 
 	/* record the new values */
-	buf->count = PROT_MAX_BUFFER_LENGTH - remain;
+	buf->count = buf->size - remain;
 	return 0;
 
- cancel:
+ grow:
+	/* the string is rewritten from its start in the grown buffer */
+	if (outbuf_grow(buf) == 0)
+		goto retry;
 	return -ECANCELED;
 }
 
 /**
- * write part of the content of 'buf' to 'fd'
+ * write part of the content of 'buf' to 'fd', passing with it the
+ * descriptor 'fdpass' if not negative
  */
-static int buf_write_length(buf_t *buf, int fd, unsigned count)
+static int buf_write_length(buf_t *buf, int fd, unsigned count, int fdpass)
 {
 	int n;
 	ssize_t rc;
 	struct iovec vec[2];
+	struct msghdr msg;
+	union {
+		struct cmsghdr cmsg;
+		char control[CMSG_SPACE(sizeof(int))];
+	} u;
 
 	/* get the count of byte to write (avoid int overflow) */
 	if (count > buf->count)
@@ -200,19 +424,32 @@ static int buf_write_length(buf_t *buf, int fd, unsigned count)
 
 	/* prepare the iovec */
 	vec[0].iov_base = buf->content + buf->pos;
-	if (buf->pos + count <= PROT_MAX_BUFFER_LENGTH) {
+	if (buf->pos + count <= buf->size) {
 		vec[0].iov_len = count;
 		n = 1;
 	} else {
-		vec[0].iov_len = PROT_MAX_BUFFER_LENGTH - buf->pos;
+		vec[0].iov_len = buf->size - buf->pos;
 		vec[1].iov_base = buf->content;
 		vec[1].iov_len = count - vec[0].iov_len;
 		n = 2;
 	}
 
+	/* prepare the passing of the descriptor */
+	if (fdpass >= 0) {
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = vec;
+		msg.msg_iovlen = (size_t)n;
+		msg.msg_control = u.control;
+		msg.msg_controllen = sizeof u.control;
+		u.cmsg.cmsg_level = SOL_SOCKET;
+		u.cmsg.cmsg_type = SCM_RIGHTS;
+		u.cmsg.cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(&u.cmsg), &fdpass, sizeof(int));
+	}
+
 	/* write the buffers */
 	do {
-		rc = writev(fd, vec, n);
+		rc = fdpass < 0 ? writev(fd, vec, n) : sendmsg(fd, &msg, 0);
 	} while (rc < 0 && errno == EINTR);
 
 	/* check error */
@@ -222,30 +459,108 @@ static int buf_write_length(buf_t *buf, int fd, unsigned count)
 		/* update the state */
 		buf->count -= (unsigned)rc;
 		buf->pos += (unsigned)rc;
-		if (buf->pos >= PROT_MAX_BUFFER_LENGTH)
-			buf->pos -= PROT_MAX_BUFFER_LENGTH;
+		if (buf->pos >= buf->size)
+			buf->pos -= buf->size;
+		/* release the content when nothing remains */
+		if (buf->count == 0)
+			buf_release(buf);
 	}
 
 	return (int)rc;
 }
 
+/**
+ * Is 'car' special? When 'fields' is not zero, the special characters are
+ * the separators and the escape, otherwise only the record separator.
+ */
+static inline int is_special(char car, int fields)
+{
+	return car == PROT_RECORD_SEPARATOR
+	    || (fields && (car == PROT_FIELD_SEPARATOR || car == PROT_ESCAPE));
+}
+
+/**
+ * Get the offset of the first special character (see is_special) of
+ * the 'length' bytes of 'data' or 'length' if there is no special character.
+ * The bytes are compared 32 or 16 at a time when AVX2 or SSE2 is available.
+ */
+static unsigned find_special(const char *data, unsigned length, int fields)
+{
+	unsigned pos = 0;
+#if defined(__AVX2__)
+	const __m256i rs32 = _mm256_set1_epi8(PROT_RECORD_SEPARATOR);
+	const __m256i fs32 = _mm256_set1_epi8(PROT_FIELD_SEPARATOR);
+	const __m256i esc32 = _mm256_set1_epi8(PROT_ESCAPE);
+	__m256i v32, m32;
+#endif
+#if defined(__SSE2__)
+	const __m128i rs16 = _mm_set1_epi8(PROT_RECORD_SEPARATOR);
+	const __m128i fs16 = _mm_set1_epi8(PROT_FIELD_SEPARATOR);
+	const __m128i esc16 = _mm_set1_epi8(PROT_ESCAPE);
+	__m128i v16, m16;
+	unsigned mask;
+#endif
+
+#if defined(__AVX2__)
+	while (pos + 32 <= length) {
+		v32 = _mm256_loadu_si256((const __m256i*)&data[pos]);
+		m32 = _mm256_cmpeq_epi8(v32, rs32);
+		if (fields)
+			m32 = _mm256_or_si256(m32,
+				_mm256_or_si256(_mm256_cmpeq_epi8(v32, fs32),
+				                _mm256_cmpeq_epi8(v32, esc32)));
+		mask = (unsigned)_mm256_movemask_epi8(m32);
+		if (mask)
+			return pos + (unsigned)__builtin_ctz(mask);
+		pos += 32;
+	}
+#endif
+#if defined(__SSE2__)
+	while (pos + 16 <= length) {
+		v16 = _mm_loadu_si128((const __m128i*)&data[pos]);
+		m16 = _mm_cmpeq_epi8(v16, rs16);
+		if (fields)
+			m16 = _mm_or_si128(m16,
+				_mm_or_si128(_mm_cmpeq_epi8(v16, fs16),
+				             _mm_cmpeq_epi8(v16, esc16)));
+		mask = (unsigned)_mm_movemask_epi8(m16);
+		if (mask)
+			return pos + (unsigned)__builtin_ctz(mask);
+		pos += 16;
+	}
+#endif
+	/* scalar scan of the tail */
+	while (pos < length && !is_special(data[pos], fields))
+		pos++;
+	return pos;
+}
+
 /**
  * get the 'fields' from 'buf'
  */
 static void buf_get_fields(buf_t *buf, fields_t *fields)
 {
 	char c;
-	unsigned read, write;
+	unsigned read, write, end, n;
 
 	/* advance the pos after the end */
-	assert(buf->content[buf->pos] == PROT_RECORD_SEPARATOR);
-	buf->pos++;
+	end = buf->pos;
+	assert(buf->content[end] == PROT_RECORD_SEPARATOR);
+	buf->pos = end + 1;
 
 	/* init first field */
 	fields->count = 0;
 	read = write = 0;
 	fields->fields[0] = buf->content;
 	for (;;) {
+		/* skip the run of ordinary characters, moving it if escapes were removed */
+		n = find_special(&buf->content[read], end - read, 1);
+		if (n && write != read)
+			memmove(&buf->content[write], &buf->content[read], n);
+		read += n;
+		write += n;
+
+		/* process the special character */
 		c = buf->content[read++];
 		switch (c) {
 		case PROT_FIELD_SEPARATOR:	/* field separator */
@@ -265,9 +580,6 @@ static void buf_get_fields(buf_t *buf, fields_t *fields)
 				buf->content[write++] = PROT_ESCAPE;
 			buf->content[write++] = c;
 			break;
-		default:	/* other characters */
-			buf->content[write++] = c;
-			break;
 		}
 	}
 }
@@ -282,14 +594,15 @@ static int buf_scan_end_record(buf_t *buf)
 
 	/* search the next RS */
 	while (buf->pos < buf->count) {
-		if (buf->content[buf->pos] == PROT_RECORD_SEPARATOR) {
-			/* check whether RS is escaped */
-			nesc = 0;
-			while (buf->pos > nesc && buf->content[buf->pos - (nesc + 1)] == PROT_ESCAPE)
-				nesc++;
-			if ((nesc & 1) == 0)
-				return 1;	/* not escaped */
-		}
+		buf->pos += find_special(&buf->content[buf->pos], buf->count - buf->pos, 0);
+		if (buf->pos == buf->count)
+			break;
+		/* check whether RS is escaped */
+		nesc = 0;
+		while (buf->pos > nesc && buf->content[buf->pos - (nesc + 1)] == PROT_ESCAPE)
+			nesc++;
+		if ((nesc & 1) == 0)
+			return 1;	/* not escaped */
 		buf->pos++;
 	}
 	return 0;
@@ -303,23 +616,73 @@ static void buf_crop(buf_t *buf)
 	buf->count -= buf->pos;
 	if (buf->count)
 		memmove(buf->content, buf->content + buf->pos, buf->count);
+	else
+		buf_release(buf);
 	buf->pos = 0;
 }
 
 /**
- * read input 'buf' from 'fd'
+ * read input 'buf' from 'fd', storing in 'fdin' the passed descriptors
+ * or discarding them when 'fdin' is NULL
  */
-static int inbuf_read(buf_t *buf, int fd)
+static int inbuf_read(buf_t *buf, int fd, int *fdin)
 {
 	ssize_t szr;
-	int rc;
-
-	if (buf->count == PROT_MAX_BUFFER_LENGTH)
-		return -ENOBUFS;
+	unsigned size;
+	char *content;
+	int rc, *fds, nfds;
+	struct iovec vec;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr cmsg;
+		char control[CMSG_SPACE(sizeof(int))];
+	} u;
+
+	/* grow the linear content when full */
+	if (buf->count == buf->size) {
+		size = buf_grow_size(buf);
+		if (size == 0)
+			return -ENOBUFS;
+		content = buf->size ? realloc(buf->content, size) : pool_get();
+		if (content == NULL)
+			return -ENOMEM;
+		buf->content = content;
+		buf->size = size;
+	}
 
-	do {
-		szr = read(fd, buf->content + buf->count, PROT_MAX_BUFFER_LENGTH - buf->count);
-	} while (szr < 0 && errno == EINTR);
+	/* without reception of descriptors, the ones passed are discarded */
+	if (fdin == NULL) {
+		do {
+			szr = read(fd, buf->content + buf->count, buf->size - buf->count);
+		} while (szr < 0 && errno == EINTR);
+	} else {
+		vec.iov_base = buf->content + buf->count;
+		vec.iov_len = buf->size - buf->count;
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = &vec;
+		msg.msg_iovlen = 1;
+		msg.msg_control = u.control;
+		msg.msg_controllen = sizeof u.control;
+		do {
+			szr = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		} while (szr < 0 && errno == EINTR);
+
+		/* keep the last received descriptor */
+		if (szr >= 0) {
+			for (cmsg = CMSG_FIRSTHDR(&msg) ; cmsg ; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+					continue;
+				fds = (int*)CMSG_DATA(cmsg);
+				nfds = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+				while (nfds-- > 0) {
+					if (*fdin >= 0)
+						close(*fdin);
+					memcpy(fdin, fds++, sizeof(int));
+				}
+			}
+		}
+	}
 	if (szr < 0)
 		rc = -(errno == EWOULDBLOCK ? EAGAIN : errno);
 	else {
@@ -330,6 +693,417 @@ static int inbuf_read(buf_t *buf, int fd)
 	return rc;
 }
 
+/******************************************************************************/
+/******************************************************************************/
+/*** BINARY FRAMING                                                         ***/
+/******************************************************************************/
+/******************************************************************************/
+
+/**
+ * Encode 'value' as a varint in 'data'
+ * returns the count of bytes of the encoding
+ */
+static unsigned varint_encode(unsigned char data[VARINT_MAX_LENGTH], uint32_t value)
+{
+	unsigned n = 0;
+
+	while (value >= 0x80) {
+		data[n++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	data[n++] = (unsigned char)value;
+	return n;
+}
+
+/**
+ * Decode in 'value' the varint of the 'length' bytes of 'data'
+ * returns:
+ *  - the count of bytes of the encoding
+ *  - 0 if the encoding is not complete
+ *  - -EBADMSG if the encoding is invalid
+ */
+static int varint_decode(const unsigned char *data, unsigned length, uint32_t *value)
+{
+	unsigned n = 0, shift = 0;
+	uint32_t v = 0;
+
+	for (;;) {
+		if (n == length)
+			return 0;
+		if (n == VARINT_MAX_LENGTH || (shift == 28 && data[n] > 15))
+			return -EBADMSG;
+		v |= (uint32_t)(data[n] & 0x7f) << shift;
+		if (!(data[n++] & 0x80))
+			break;
+		shift += 7;
+	}
+	*value = v;
+	return (int)n;
+}
+
+/**
+ * Put the 'length' bytes of 'data' into the 'buf'
+ * returns:
+ *  - 0 on success
+ *  - -ECANCELED if there is not enought space in the buffer
+ */
+static int buf_put_bytes(buf_t *buf, const void *data, unsigned length)
+{
+	unsigned pos, head;
+
+	while (buf->size - buf->count < length)
+		if (outbuf_grow(buf) < 0)
+			return -ECANCELED;
+
+	pos = buf->pos + buf->count;
+	if (pos >= buf->size)
+		pos -= buf->size;
+	head = buf->size - pos;
+	if (length <= head)
+		memcpy(&buf->content[pos], data, length);
+	else {
+		memcpy(&buf->content[pos], data, head);
+		memcpy(buf->content, (const char*)data + head, length - head);
+	}
+	buf->count += length;
+	return 0;
+}
+
+/**
+ * Put the varint of 'value' into the 'buf'
+ * returns:
+ *  - 0 on success
+ *  - -ECANCELED if there is not enought space in the buffer
+ */
+static int buf_put_varint(buf_t *buf, uint32_t value)
+{
+	unsigned char data[VARINT_MAX_LENGTH];
+
+	return buf_put_bytes(buf, data, varint_encode(data, value));
+}
+
+/**
+ * Insert the header of the frame starting at offset 'start' of 'buf'
+ * and ending at its end
+ * returns:
+ *  - 0 on success
+ *  - -ECANCELED if there is not enought space in the buffer
+ */
+static int buf_put_frame_header(buf_t *buf, unsigned start)
+{
+	unsigned char head[VARINT_MAX_LENGTH];
+	unsigned length, hlen, from, to, i;
+
+	length = buf->count - start;
+	hlen = varint_encode(head, length);
+	while (buf->size - buf->count < hlen)
+		if (outbuf_grow(buf) < 0)
+			return -ECANCELED;
+
+	/* move the frame of hlen bytes, from its end */
+	from = buf->pos + buf->count;
+	if (from >= buf->size)
+		from -= buf->size;
+	to = from + hlen;
+	if (to >= buf->size)
+		to -= buf->size;
+	for (i = length ; i ; i--) {
+		from = (from ? from : buf->size) - 1;
+		to = (to ? to : buf->size) - 1;
+		buf->content[to] = buf->content[from];
+	}
+
+	/* write the header */
+	to = buf->pos + start;
+	if (to >= buf->size)
+		to -= buf->size;
+	for (i = 0 ; i < hlen ; i++) {
+		buf->content[to++] = (char)head[i];
+		if (to == buf->size)
+			to = 0;
+	}
+	buf->count += hlen;
+	return 0;
+}
+
+/**
+ * Check if 'string' of 'length' is a decimal number in canonical form
+ * that can be sent as TAG_NUMBER and if so stores its value in 'value'
+ * returns 1 if it is a number or 0 otherwise
+ */
+static int is_number(const char *string, unsigned length, uint32_t *value)
+{
+	unsigned i;
+	uint32_t v;
+
+	if (length == 0 || length > 9 || (string[0] == '0' && length > 1))
+		return 0;
+	for (v = 0, i = 0 ; i < length ; i++) {
+		if (string[i] < '0' || string[i] > '9')
+			return 0;
+		v = v * 10 + (uint32_t)(string[i] - '0');
+	}
+	*value = v;
+	return 1;
+}
+
+/**
+ * Compute the hash of 'string' and its length
+ * returns the hash
+ */
+static uint32_t hash_string(const char *string, unsigned *length)
+{
+	const char *iter = string;
+	uint32_t hash = 2166136261u;
+
+	while (*iter)
+		hash = (hash ^ (uint32_t)(unsigned char)*iter++) * 16777619u;
+	*length = (unsigned)(iter - string);
+	return hash;
+}
+
+/**
+ * Put the 'field' into the binary frame being put, interning it at need
+ * returns:
+ *  - 0 on success
+ *  - -ECANCELED if there is not enought space in the buffer
+ */
+static int binary_put_field(prot_t *prot, const char *field)
+{
+	dicts_t *dicts = prot->dicts;
+	buf_t *buf = &prot->outbuf;
+	unsigned length, slot, i;
+	uint32_t hash, value;
+	char *copy;
+	int rc;
+
+	if (field == NULL)
+		field = "";
+	hash = hash_string(field, &length);
+
+	/* numbers are sent as their value */
+	if (is_number(field, length, &value))
+		return buf_put_varint(buf, value << 2 | TAG_NUMBER);
+
+	/* too short or too long strings are not interned */
+	if (length < 2 || length > PROT_INTERN_MAX_LENGTH)
+		goto literal;
+
+	/* search the interned string and the least recently used slot */
+	slot = 0;
+	for (i = 0 ; i < PROT_DICT_LENGTH ; i++) {
+		if (dicts->outhashes[i] == hash
+		 && dicts->outstrs[i] != NULL
+		 && strcmp(dicts->outstrs[i], field) == 0) {
+			dicts->outuses[i] = ++dicts->outclock;
+			return buf_put_varint(buf, (uint32_t)i << 2 | TAG_REF);
+		}
+		if (dicts->outuses[i] < dicts->outuses[slot])
+			slot = i;
+	}
+
+	/* define it in the least recently used slot */
+	if (dicts->undocount >= PROT_MAX_FIELDS)
+		goto literal;
+	copy = malloc(length + 1);
+	if (copy == NULL)
+		goto literal;
+	rc = buf_put_varint(buf, (uint32_t)slot << 2 | TAG_DEFINE);
+	if (rc == 0)
+		rc = buf_put_varint(buf, length);
+	if (rc == 0)
+		rc = buf_put_bytes(buf, field, length);
+	if (rc < 0) {
+		free(copy);
+		return rc;
+	}
+	i = dicts->undocount++;
+	dicts->undo[i].slot = slot;
+	dicts->undo[i].string = dicts->outstrs[slot];
+	dicts->undo[i].hash = dicts->outhashes[slot];
+	dicts->outstrs[slot] = memcpy(copy, field, length + 1);
+	dicts->outhashes[slot] = hash;
+	dicts->outuses[slot] = ++dicts->outclock;
+	return 0;
+
+literal:
+	rc = buf_put_varint(buf, length << 2 | TAG_LITERAL);
+	if (rc == 0)
+		rc = buf_put_bytes(buf, field, length);
+	return rc;
+}
+
+/**
+ * Validate the definitions of the record put in 'dicts'
+ */
+static void binary_put_commit(dicts_t *dicts)
+{
+	while (dicts->undocount)
+		free(dicts->undo[--dicts->undocount].string);
+}
+
+/**
+ * Cancel the definitions of the record put in 'dicts'
+ */
+static void binary_put_cancel(dicts_t *dicts)
+{
+	unsigned slot;
+
+	while (dicts->undocount) {
+		dicts->undocount--;
+		slot = dicts->undo[dicts->undocount].slot;
+		free(dicts->outstrs[slot]);
+		dicts->outstrs[slot] = dicts->undo[dicts->undocount].string;
+		dicts->outhashes[slot] = dicts->undo[dicts->undocount].hash;
+	}
+}
+
+/**
+ * Search the end of the frame starting 'buf' and set pos after it
+ * returns:
+ *  - 1 if found
+ *  - 0 if not found
+ *  - -EMSGSIZE if the frame can not fit in the buffer
+ *  - -EBADMSG if the header of the frame is invalid
+ */
+static int buf_scan_frame(buf_t *buf)
+{
+	uint32_t length;
+	int rc;
+
+	rc = varint_decode((const unsigned char*)buf->content, buf->count, &length);
+	if (rc <= 0)
+		return rc;
+	if (length > PROT_MAX_BUFFER_LENGTH - (unsigned)rc)
+		return -EMSGSIZE;
+	if (length > buf->count - (unsigned)rc)
+		return 0;
+	buf->pos = (unsigned)rc + length;
+	return 1;
+}
+
+/**
+ * Decode the fields of the frame received in 'prot'
+ * returns:
+ *  - 0 on success
+ *  - -EBADMSG if the frame is invalid
+ *  - -ENOMEM on allocation failure
+ */
+static int binary_get_fields(prot_t *prot)
+{
+	dicts_t *dicts = prot->dicts;
+	const unsigned char *data = (const unsigned char*)prot->inbuf.content;
+	unsigned rd, end, length, used, size, offsets[PROT_MAX_FIELDS];
+	uint32_t tag, value;
+	const char *string;
+	char number[12], *copy;
+	int rc, count;
+
+	/* skip the header */
+	end = prot->inbuf.pos;
+	rc = varint_decode(data, end, &tag);
+	rd = (unsigned)rc;
+
+	count = 0;
+	used = 0;
+	while (rd < end) {
+		/* decode the field */
+		rc = varint_decode(&data[rd], end - rd, &tag);
+		if (rc <= 0)
+			return -EBADMSG;
+		rd += (unsigned)rc;
+		value = tag >> 2;
+		switch (tag & 3) {
+		case TAG_LITERAL:
+			if (value > end - rd)
+				return -EBADMSG;
+			string = (const char*)&data[rd];
+			length = value;
+			rd += length;
+			break;
+		case TAG_DEFINE:
+			if (value >= PROT_DICT_LENGTH)
+				return -EBADMSG;
+			rc = varint_decode(&data[rd], end - rd, &length);
+			if (rc <= 0 || length > end - rd - (unsigned)rc)
+				return -EBADMSG;
+			rd += (unsigned)rc;
+			copy = malloc(length + 1);
+			if (copy == NULL)
+				return -ENOMEM;
+			memcpy(copy, &data[rd], length);
+			copy[length] = 0;
+			free(dicts->instrs[value]);
+			dicts->instrs[value] = copy;
+			string = copy;
+			rd += length;
+			break;
+		case TAG_REF:
+			if (value >= PROT_DICT_LENGTH || dicts->instrs[value] == NULL)
+				return -EBADMSG;
+			string = dicts->instrs[value];
+			length = (unsigned)strlen(string);
+			break;
+		default:
+			string = number;
+			length = (unsigned)snprintf(number, sizeof number, "%u", value);
+			break;
+		}
+
+		/* record the field, the ones exceeding PROT_MAX_FIELDS are ignored */
+		if (count < PROT_MAX_FIELDS) {
+			if (used + length + 1 > dicts->textsize) {
+				size = dicts->textsize ? dicts->textsize : 256;
+				while (size < used + length + 1)
+					size <<= 1;
+				copy = realloc(dicts->text, size);
+				if (copy == NULL)
+					return -ENOMEM;
+				dicts->text = copy;
+				dicts->textsize = size;
+			}
+			memcpy(&dicts->text[used], string, length);
+			dicts->text[used + length] = 0;
+			offsets[count++] = used;
+			used += length + 1;
+		}
+	}
+
+	/* set the fields */
+	prot->fields.count = count;
+	while (count) {
+		count--;
+		prot->fields.fields[count] = &dicts->text[offsets[count]];
+	}
+	return 0;
+}
+
+/**
+ * Free the dictionaries of 'prot'
+ */
+static void dicts_free(prot_t *prot)
+{
+	dicts_t *dicts = prot->dicts;
+	unsigned i;
+
+	if (dicts) {
+		binary_put_cancel(dicts);
+		for (i = 0 ; i < PROT_DICT_LENGTH ; i++) {
+			free(dicts->outstrs[i]);
+			free(dicts->instrs[i]);
+		}
+		free(dicts->text);
+		free(dicts);
+		prot->dicts = NULL;
+	}
+}
+
+/******************************************************************************/
+/******************************************************************************/
+/*** PROTOCOL                                                               ***/
+/******************************************************************************/
+/******************************************************************************/
+
 /* see prot.h */
 int prot_create(prot_t **prot)
 {
@@ -341,6 +1115,9 @@ int prot_create(prot_t **prot)
 		return -ENOMEM;
 
 	/* initialisation of the structure */
+	p->inbuf.content = p->outbuf.content = NULL;
+	p->dicts = NULL;
+	p->fdin = -1;
 	prot_reset(p);
 
 	/* terminate */
@@ -350,6 +1127,11 @@ int prot_create(prot_t **prot)
 /* see prot.h */
 void prot_destroy(prot_t *prot)
 {
+	buf_release(&prot->inbuf);
+	buf_release(&prot->outbuf);
+	dicts_free(prot);
+	if (prot->fdin >= 0)
+		close(prot->fdin);
 	free(prot);
 }
 
@@ -357,11 +1139,17 @@ void prot_destroy(prot_t *prot)
 void prot_reset(prot_t *prot)
 {
 	/* initialisation of the structure */
-	prot->inbuf.pos = prot->inbuf.count = 0;
-	prot->outbuf.pos = prot->outbuf.count = 0;
+	buf_release(&prot->inbuf);
+	buf_release(&prot->outbuf);
+	dicts_free(prot);
 	prot->outfields = prot->wrokcnt = 0;
 	prot->fields.count = -1;
 	prot->allow_empty = 0;
+	prot->fdout = -1;
+	prot->accept_fd = 0;
+	if (prot->fdin >= 0)
+		close(prot->fdin);
+	prot->fdin = -1;
 }
 
 /* see prot.h */
@@ -376,12 +1164,35 @@ void prot_set_allow_empty(prot_t *prot, int value)
 	prot->allow_empty = !!value;
 }
 
+/* see prot.h */
+int prot_is_binary(prot_t *prot)
+{
+	return prot->dicts != NULL;
+}
+
+/* see prot.h */
+int prot_set_binary(prot_t *prot, int value)
+{
+	if (!value)
+		dicts_free(prot);
+	else if (prot->dicts == NULL) {
+		prot->dicts = calloc(1, sizeof *prot->dicts);
+		if (prot->dicts == NULL)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
 /* see prot.h */
 void prot_put_cancel(prot_t *prot)
 {
 	if (prot->outfields) {
+		if (prot->dicts)
+			binary_put_cancel(prot->dicts);
 		prot->outbuf.count = prot->wrokcnt;
 		prot->outfields = 0;
+		if (prot->outbuf.count == 0)
+			buf_release(&prot->outbuf);
 	}
 }
 
@@ -391,10 +1202,15 @@ int prot_put_end(prot_t *prot)
 	int rc = 0;
 
 	if (prot->outfields || prot->allow_empty) {
-		rc = buf_put_car(&prot->outbuf, PROT_RECORD_SEPARATOR);
+		if (prot->dicts)
+			rc = buf_put_frame_header(&prot->outbuf, prot->wrokcnt);
+		else
+			rc = buf_put_car(&prot->outbuf, PROT_RECORD_SEPARATOR);
 		if (rc == 0) {
 			prot->wrokcnt = prot->outbuf.count;
 			prot->outfields = 0;
+			if (prot->dicts)
+				binary_put_commit(prot->dicts);
 		}
 	}
 	return rc;
@@ -405,6 +1221,10 @@ int prot_put_field(prot_t *prot, const char *field)
 {
 	int rc = 0;
 
+	if (prot->dicts) {
+		prot->outfields++;
+		return binary_put_field(prot, field);
+	}
 	if (prot->outfields++)
 		rc = buf_put_car(&prot->outbuf, PROT_FIELD_SEPARATOR);
 	if (rc >= 0 && field)
@@ -470,9 +1290,11 @@ int prot_should_write(prot_t *prot)
 /* see prot.h */
 int prot_write(prot_t *prot, int fdout)
 {
-	int result = buf_write_length(&prot->outbuf, fdout, prot->wrokcnt);
-	if (result > 0)
+	int result = buf_write_length(&prot->outbuf, fdout, prot->wrokcnt, prot->fdout);
+	if (result > 0) {
 		prot->wrokcnt -= (unsigned)result;
+		prot->fdout = -1;
+	}
 	return result;
 }
 
@@ -485,17 +1307,48 @@ int prot_can_read(prot_t *prot)
 /* see prot.h */
 int prot_read(prot_t *prot, int fdin)
 {
-	return inbuf_read(&prot->inbuf, fdin);
+	return inbuf_read(&prot->inbuf, fdin, prot->accept_fd ? &prot->fdin : NULL);
+}
+
+/* see prot.h */
+void prot_put_fd(prot_t *prot, int fd)
+{
+	prot->fdout = fd;
+}
+
+/* see prot.h */
+void prot_set_accept_fd(prot_t *prot, int value)
+{
+	prot->accept_fd = !!value;
+}
+
+/* see prot.h */
+int prot_take_fd(prot_t *prot)
+{
+	int fd = prot->fdin;
+	prot->fdin = -1;
+	return fd;
 }
 
 /* see prot.h */
 int prot_get(prot_t *prot, const char ***fields)
 {
+	int rc;
+
 	for (;;) {
 		if (prot->fields.count < 0) {
-			if (!buf_scan_end_record(&prot->inbuf))
-				return prot_can_read(prot) ? -EAGAIN : -EMSGSIZE;
-			buf_get_fields(&prot->inbuf, &prot->fields);
+			if (prot->dicts) {
+				rc = buf_scan_frame(&prot->inbuf);
+				if (rc <= 0)
+					return rc < 0 ? rc : prot_can_read(prot) ? -EAGAIN : -EMSGSIZE;
+				rc = binary_get_fields(prot);
+				if (rc < 0)
+					return rc;
+			} else {
+				if (!buf_scan_end_record(&prot->inbuf))
+					return prot_can_read(prot) ? -EAGAIN : -EMSGSIZE;
+				buf_get_fields(&prot->inbuf, &prot->fields);
+			}
 		}
 		if (prot->fields.count == 0 && !prot->allow_empty)
 			prot_next(prot);
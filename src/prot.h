@@ -58,6 +58,27 @@ extern int prot_is_empty_allowed(prot_t * prot);
  */
 extern void prot_set_allow_empty(prot_t * prot, int value);
 
+/**
+ * @brief Get whether the protocol handler 'prot' uses the binary framing
+ * of the version 2 of the protocol or the text records of the version 1
+ *
+ * @param prot the protocol handler
+ * @return 1 for the binary framing or 0 for the text records
+ */
+extern int prot_is_binary(prot_t * prot);
+
+/**
+ * @brief Set whether the protocol handler 'prot' uses the binary framing
+ * of the version 2 of the protocol (not the default) or the text records
+ * of the version 1. The switch applies to the records put and to the records
+ * got after the current one.
+ *
+ * @param prot the protocol handler
+ * @param value 0 for text records or not zero for binary framing
+ * @return 0 on success or -ENOMEM in case of error
+ */
+extern int prot_set_binary(prot_t * prot, int value);
+
 /**
  * @brief Reset the protocol handler 'prot'
  *
@@ -162,6 +183,37 @@ extern int prot_can_read(prot_t * prot);
  */
 extern int prot_read(prot_t * prot, int fdin);
 
+/**
+ * @brief Pass the descriptor 'fd' with the bytes of the next write.
+ * The descriptor is not owned by the protocol handler and must remain
+ * valid until the next call to prot_write. Only unix sockets can
+ * pass descriptors.
+ *
+ * @param prot the protocol handler
+ * @param fd the descriptor to pass or -1 for none
+ */
+extern void prot_put_fd(prot_t * prot, int fd);
+
+/**
+ * @brief Set whether protocol handler 'prot' accepts or not the
+ * descriptors passed with the read bytes. When not accepted (the
+ * default), the passed descriptors are discarded.
+ *
+ * @param prot the protocol handler
+ * @param value 0 for discarding or not zero for accepting
+ */
+extern void prot_set_accept_fd(prot_t * prot, int value);
+
+/**
+ * @brief Take the last descriptor received by protocol handler 'prot'.
+ * The caller becomes its owner. A descriptor passed with the bytes of
+ * a record is received at the latest when that record is got.
+ *
+ * @param prot the protocol handler
+ * @return the received descriptor or -1 if none
+ */
+extern int prot_take_fd(prot_t * prot);
+
 /**
  * @brief Get the currently received fields and its count
  *
@@ -169,6 +221,7 @@ extern int prot_read(prot_t * prot, int fdin);
  * @param fields where to store the array of received fields (can be NULL)
  * @return the count of fields or -EAGAIN if no field is available
  *         or -EMSGSIZE when buffer is full but record didn't end
+ *         or -EBADMSG when a binary frame is invalid
  */
 extern int prot_get(prot_t * prot, const char ***fields);
 
@@ -179,4 +232,3 @@ extern int prot_get(prot_t * prot, const char ***fields);
  * @param prot the protocol handler
  */
 extern void prot_next(prot_t * prot);
-
@@ -24,6 +24,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 
 #include "data.h"
@@ -54,6 +55,22 @@ typedef struct queue queue_t;
 /** the queue */
 static queue_t queue;
 
+/**
+ * An operation of the queue, compiled for playing
+ */
+struct op
+{
+	/** the key of the operation */
+	data_key_t key;
+
+	/** the value to set or a NULL value for dropping */
+	data_value_t value;
+
+	/** position of the operation in the queue */
+	uint32_t rank;
+};
+typedef struct op op_t;
+
 /**
  * Read data from the queue
  *
@@ -213,32 +230,195 @@ queue_clear(
 }
 
 /* see queue.h */
+uint32_t
+queue_size(
+) {
+	return queue.write;
+}
+
+/**
+ * Check whether the 'text' fit String_Any, NULL or ""
+ * @param text the text to check
+ * @return true if text matches ANY possible values
+ */
+static
+bool
+is_any(
+	const char *text
+) {
+	return text == NULL || text[0] == 0 || (!text[1] && text[0] == Data_Any_Char);
+}
+
+/**
+ * Get the text of the field of a key that selects only one item.
+ * For such keys, the texts matching ANY or WIDE select WIDE.
+ * @param text the text of the field
+ * @return the text or String_Wide
+ */
+static
+const char *
+exact(
+	const char *text
+) {
+	return is_any(text) || (!text[1] && text[0] == Data_Wide_Char)
+			? Data_Wide_String : text;
+}
+
+/**
+ * Is the operation dropping the items matching a pattern?
+ * @param op the operation
+ * @return true if the key has ANY fields
+ */
+static
+bool
+is_pattern(
+	const op_t *op
+) {
+	return !op->value.value
+		&& (is_any(op->key.client) || is_any(op->key.session)
+		 || is_any(op->key.user) || is_any(op->key.permission));
+}
+
+/**
+ * Compare the keys of operations not being patterns
+ * @param a first operation
+ * @param b second operation
+ * @return the comparison result like strcmp
+ */
+static
 int
-queue_play(
+cmpkey(
+	const op_t *a,
+	const op_t *b
 ) {
-	int rc, rc2;
-	data_key_t key;
-	data_value_t value;
+	return strcmp(exact(a->key.client), exact(b->key.client))
+		?: strcmp(exact(a->key.session), exact(b->key.session))
+		?: strcmp(exact(a->key.user), exact(b->key.user))
+		?: strcasecmp(exact(a->key.permission), exact(b->key.permission));
+}
+
+/**
+ * Compare operations not being patterns by key and then by rank
+ * @param a first operation
+ * @param b second operation
+ * @return the comparison result like strcmp
+ */
+static
+int
+cmpop(
+	const void *a,
+	const void *b
+) {
+	const op_t *x = a, *y = b;
+	return cmpkey(x, y) ?: x->rank < y->rank ? -1 : x->rank > y->rank;
+}
+
+/**
+ * Compile the content of the queue to an array of operations
+ *
+ * @param ops where to store the allocated array of operations
+ * @param count where to store the count of operations
+ * @return 0 in case of success, -EINVAL if the queue is corrupted after
+ * the compiled operations or -ENOMEM
+ */
+static
+int
+compile(
+	op_t **ops,
+	uint32_t *count
+) {
+	op_t *array, *op;
+	uint32_t n, alloc;
+	int rc;
 
 	rc = 0;
+	n = alloc = 0;
+	array = NULL;
 	queue.read = 0;
 	while (queue.read < queue.write) {
-		rc2 = -EINVAL;
-		if (qget_string(&key.client)
-		 && qget_string(&key.session)
-		 && qget_string(&key.user)
-		 && qget_string(&key.permission)
-		 && qget_string(&value.value)) {
-			if (!value.value[0])
-				rc2 = db_drop(&key);
-			else {
-				if (qget_time(&value.expire))
-					rc2 = db_set(&key, &value);
+		/* get the memory of the operation */
+		if (n == alloc) {
+			alloc = alloc ? 2 * alloc : 64;
+			op = realloc(array, alloc * sizeof *op);
+			if (!op) {
+				rc = -ENOMEM;
+				break;
 			}
+			array = op;
 		}
-		if (rc2 != 0 && rc == 0)
-			rc = rc2;
+		op = &array[n];
+
+		/* read the operation */
+		if (!qget_string(&op->key.client)
+		 || !qget_string(&op->key.session)
+		 || !qget_string(&op->key.user)
+		 || !qget_string(&op->key.permission)
+		 || !qget_string(&op->value.value)) {
+			rc = -EINVAL;
+			break;
+		}
+		if (!op->value.value[0])
+			op->value.value = NULL;
+		else if (!qget_time(&op->value.expire)) {
+			rc = -EINVAL;
+			break;
+		}
+		op->rank = n++;
 	}
+	*ops = array;
+	*count = n;
 	return rc;
 }
 
+/* see queue.h */
+int
+queue_play(
+) {
+	int rc, rc2;
+	op_t *ops;
+	data_key_t *keys;
+	uint32_t count, i, j, k;
+
+	rc = compile(&ops, &count);
+	if (rc == -ENOMEM) {
+		free(ops);
+		return rc;
+	}
+
+	keys = NULL;
+	for (i = 0 ; i < count ; i = j) {
+		if (is_pattern(&ops[i])) {
+			/* drop in one pass the items of successive patterns */
+			for (j = i + 1 ; j < count && is_pattern(&ops[j]) ; j++);
+			if (!keys)
+				keys = malloc(count * sizeof *keys);
+			if (!keys)
+				rc2 = -ENOMEM;
+			else {
+				for (k = i ; k < j ; k++)
+					keys[k - i] = ops[k].key;
+				rc2 = db_drop_batch(keys, j - i);
+			}
+			if (rc2 != 0 && rc == 0)
+				rc = rc2;
+		} else {
+			/* successive operations of single keys are sorted by key
+			 * so that only the last operation of a key is applied */
+			for (j = i + 1 ; j < count && !is_pattern(&ops[j]) ; j++);
+			qsort(&ops[i], j - i, sizeof *ops, cmpop);
+			for (k = i ; k < j ; k++) {
+				if (k + 1 < j && !cmpkey(&ops[k], &ops[k + 1]))
+					continue; /* superseded */
+				if (ops[k].value.value)
+					rc2 = db_set(&ops[k].key, &ops[k].value);
+				else
+					rc2 = db_drop(&ops[k].key);
+				if (rc2 != 0 && rc == 0)
+					rc = rc2;
+			}
+		}
+	}
+	free(keys);
+	free(ops);
+	return rc;
+}
@@ -55,6 +55,16 @@ void
 queue_clear(
 );
 
+/**
+ * Get the size of the content of the queue
+ *
+ * @return the count of bytes queued
+ */
+extern
+uint32_t
+queue_size(
+);
+
 /**
  * Play the content of the queue to alter the database accordingly to what
  * is recorded
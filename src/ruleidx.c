@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/******************************************************************************/
+/******************************************************************************/
+/* INDEX OF RULES BY KEY FOR DATABASE BACKENDS                                */
+/******************************************************************************/
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "data.h"
+#include "anydb.h"
+#include "ruleidx.h"
+
+/** minimal count of buckets */
+#define MIN_BUCKETS  64
+
+/**
+ * Mix the value 'v' in the hash 'h'
+ * @param h the current hash
+ * @param v the value to mix
+ * @return the new hash
+ */
+static
+uint32_t
+mix(
+	uint32_t h,
+	uint32_t v
+) {
+	h = (h ^ v) * 0x9e3779b1u;
+	return h ^ (h >> 15);
+}
+
+/**
+ * Get the address of the reference to 'pos' in its chain
+ * @param ridx the index
+ * @param pos the position to search, must be indexed
+ * @return the address of the reference to pos
+ */
+static
+uint32_t *
+refof(
+	ruleidx_t *ridx,
+	uint32_t pos
+) {
+	uint32_t *ref;
+
+	ref = &ridx->heads[ridx->hashes[pos] & (ridx->nbuckets - 1)];
+	while (*ref != pos)
+		ref = &ridx->links[*ref];
+	return ref;
+}
+
+/**
+ * Set the count of buckets and rebuild the chains
+ * @param ridx the index
+ * @param nbuckets the new count of buckets, a power of 2
+ * @return 0 on success or -ENOMEM
+ */
+static
+int
+rehash(
+	ruleidx_t *ridx,
+	uint32_t nbuckets
+) {
+	uint32_t *heads, pos, *ref;
+
+	heads = realloc(ridx->heads, nbuckets * sizeof *heads);
+	if (!heads)
+		return -ENOMEM;
+	ridx->heads = heads;
+	ridx->nbuckets = nbuckets;
+	memset(heads, 0xff, nbuckets * sizeof *heads);
+
+	/* link in reverse order to preserve order of positions in chains */
+	pos = ridx->count;
+	while (pos) {
+		pos--;
+		ref = &heads[ridx->hashes[pos] & (nbuckets - 1)];
+		ridx->links[pos] = *ref;
+		*ref = pos;
+	}
+	return 0;
+}
+
+/* see ruleidx.h */
+void
+ruleidx_init(
+	ruleidx_t *ridx
+) {
+	memset(ridx, 0, sizeof *ridx);
+}
+
+/* see ruleidx.h */
+void
+ruleidx_destroy(
+	ruleidx_t *ridx
+) {
+	free(ridx->heads);
+	free(ridx->links);
+	free(ridx->hashes);
+	ruleidx_init(ridx);
+}
+
+/* see ruleidx.h */
+void
+ruleidx_clear(
+	ruleidx_t *ridx
+) {
+	ridx->count = 0;
+	if (ridx->nbuckets)
+		memset(ridx->heads, 0xff, ridx->nbuckets * sizeof *ridx->heads);
+}
+
+/* see ruleidx.h */
+int
+ruleidx_add(
+	ruleidx_t *ridx,
+	uint32_t hash
+) {
+	uint32_t pos, alloc, *links, *hashes, *ref;
+
+	/* grow arrays of positions */
+	pos = ridx->count;
+	if (pos == ridx->alloc) {
+		alloc = pos ? pos << 1 : MIN_BUCKETS;
+		links = realloc(ridx->links, alloc * sizeof *links);
+		if (!links)
+			return -ENOMEM;
+		ridx->links = links;
+		hashes = realloc(ridx->hashes, alloc * sizeof *hashes);
+		if (!hashes)
+			return -ENOMEM;
+		ridx->hashes = hashes;
+		ridx->alloc = alloc;
+	}
+
+	/* grow buckets: keep the load factor below 1 */
+	if (pos >= ridx->nbuckets
+	 && rehash(ridx, ridx->nbuckets ? ridx->nbuckets << 1 : MIN_BUCKETS))
+		return -ENOMEM;
+
+	/* link at head of its chain */
+	ref = &ridx->heads[hash & (ridx->nbuckets - 1)];
+	ridx->hashes[pos] = hash;
+	ridx->links[pos] = *ref;
+	*ref = pos;
+	ridx->count = pos + 1;
+	return 0;
+}
+
+/* see ruleidx.h */
+void
+ruleidx_remove(
+	ruleidx_t *ridx,
+	uint32_t pos
+) {
+	uint32_t last, *ref;
+
+	/* unlink pos */
+	ref = refof(ridx, pos);
+	*ref = ridx->links[pos];
+
+	/* move last at pos */
+	last = --ridx->count;
+	if (pos != last) {
+		ref = refof(ridx, last);
+		*ref = pos;
+		ridx->links[pos] = ridx->links[last];
+		ridx->hashes[pos] = ridx->hashes[last];
+	}
+}
+
+/* see ruleidx.h */
+void
+ruleidx_truncate(
+	ruleidx_t *ridx,
+	uint32_t count
+) {
+	uint32_t *ref;
+
+	while (ridx->count > count) {
+		ref = refof(ridx, --ridx->count);
+		*ref = ridx->links[ridx->count];
+	}
+}
+
+/* see ruleidx.h */
+uint32_t
+ruleidx_first(
+	const ruleidx_t *ridx,
+	uint32_t hash
+) {
+	uint32_t pos;
+
+	if (!ridx->nbuckets)
+		return RuleIdx_End;
+	pos = ridx->heads[hash & (ridx->nbuckets - 1)];
+	while (pos != RuleIdx_End && ridx->hashes[pos] != hash)
+		pos = ridx->links[pos];
+	return pos;
+}
+
+/* see ruleidx.h */
+uint32_t
+ruleidx_next(
+	const ruleidx_t *ridx,
+	uint32_t pos
+) {
+	uint32_t hash = ridx->hashes[pos];
+
+	do {
+		pos = ridx->links[pos];
+	} while (pos != RuleIdx_End && ridx->hashes[pos] != hash);
+	return pos;
+}
+
+/* see ruleidx.h */
+uint32_t
+ruleidx_hash(
+	const anydb_key_t *key
+) {
+	uint32_t h;
+
+	h = mix(key->permission, key->client);
+	h = mix(h, key->session);
+	h = mix(h, key->user);
+	return h;
+}
+
+/**
+ * Check if the field of a searched key can only match WIDE
+ * @param idx the index of the field
+ * @return true if only WIDE can match
+ */
+static
+bool
+only_wide(
+	anydb_idx_t idx
+) {
+	return idx == AnyIdx_Wide || idx == AnyIdx_None;
+}
+
+/* see ruleidx.h */
+unsigned
+ruleidx_search_hashes(
+	const anydb_key_t *key,
+	anydb_key_t keys[RuleIdx_Max_Hashes],
+	uint32_t hashes[RuleIdx_Max_Hashes]
+) {
+	/* combinations of WIDE fields from the most specific to the least */
+	static const uint8_t wides[RuleIdx_Max_Hashes] = {
+		0, 8, 1, 4, 2, 9, 12, 5, 10, 3, 6, 13, 11, 14, 7, 15
+	};
+	unsigned mask, i, w, n;
+	anydb_key_t *k;
+
+	/* bit 0 is client, 1 is session, 2 is user, 3 is permission */
+	mask = (unsigned)only_wide(key->client)
+	     | (unsigned)only_wide(key->session) << 1
+	     | (unsigned)only_wide(key->user) << 2
+	     | (unsigned)only_wide(key->permission) << 3;
+
+	/* iterate over combinations of WIDE */
+	n = 0;
+	for (i = 0 ; i < RuleIdx_Max_Hashes ; i++) {
+		w = wides[i];
+		if ((w & mask) != mask)
+			continue; /* fields not having a key value must be WIDE */
+		k = &keys[n];
+		k->client = w & 1 ? AnyIdx_Wide : key->client;
+		k->session = w & 2 ? AnyIdx_Wide : key->session;
+		k->user = w & 4 ? AnyIdx_Wide : key->user;
+		k->permission = w & 8 ? AnyIdx_Wide : key->permission;
+		hashes[n++] = ruleidx_hash(k);
+	}
+	return n;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+/******************************************************************************/
+/******************************************************************************/
+/* INDEX OF RULES BY KEY FOR DATABASE BACKENDS                                */
+/******************************************************************************/
+/******************************************************************************/
+
+/**
+ * The rule index is a hash table of chained positions. It is intended to
+ * be used by the database backends that record their rules in an array.
+ * The index records, for each position of the array, the hash of the key
+ * of the rule at that position.
+ *
+ * The backend is responsible of keeping the index synchronized with its
+ * array of rules: rules are added at end and removed by moving the last
+ * rule in place of the removed one.
+ */
+
+/** The value returned when iteration ends */
+#define RuleIdx_End ((uint32_t)0xffffffffu)
+
+/** Maximum count of hashes for searching a key */
+#define RuleIdx_Max_Hashes 16
+
+/**
+ * Structure of the index
+ */
+struct ruleidx
+{
+	/** count of buckets (a power of 2 or zero) */
+	uint32_t nbuckets;
+
+	/** count of indexed positions */
+	uint32_t count;
+
+	/** allocated count of positions */
+	uint32_t alloc;
+
+	/** heads of the chains of buckets */
+	uint32_t *heads;
+
+	/** for each position, the next position in the chain */
+	uint32_t *links;
+
+	/** for each position, the hash of its key */
+	uint32_t *hashes;
+};
+typedef struct ruleidx ruleidx_t;
+
+/**
+ * Initialize the index as empty
+ * @param ridx the index to initialize
+ */
+extern
+void
+ruleidx_init(
+	ruleidx_t *ridx
+);
+
+/**
+ * Release the memory used by the index
+ * @param ridx the index to release
+ */
+extern
+void
+ruleidx_destroy(
+	ruleidx_t *ridx
+);
+
+/**
+ * Remove all the positions of the index
+ * @param ridx the index to clear
+ */
+extern
+void
+ruleidx_clear(
+	ruleidx_t *ridx
+);
+
+/**
+ * Add the position 'ridx->count' with the given 'hash'
+ * @param ridx the index
+ * @param hash hash of the key of the added rule
+ * @return 0 on success or -ENOMEM
+ */
+extern
+int
+ruleidx_add(
+	ruleidx_t *ridx,
+	uint32_t hash
+);
+
+/**
+ * Remove the position 'pos' and move the last position at 'pos'
+ * @param ridx the index
+ * @param pos position to remove
+ */
+extern
+void
+ruleidx_remove(
+	ruleidx_t *ridx,
+	uint32_t pos
+);
+
+/**
+ * Remove the positions from 'count' to the end
+ * @param ridx the index
+ * @param count the new count of positions
+ */
+extern
+void
+ruleidx_truncate(
+	ruleidx_t *ridx,
+	uint32_t count
+);
+
+/**
+ * Get the first position having the 'hash'
+ * @param ridx the index
+ * @param hash the hash to search
+ * @return the first position found or RuleIdx_End
+ */
+extern
+uint32_t
+ruleidx_first(
+	const ruleidx_t *ridx,
+	uint32_t hash
+);
+
+/**
+ * Get the position following 'pos' having the same hash
+ * @param ridx the index
+ * @param pos the current position
+ * @return the next position found or RuleIdx_End
+ */
+extern
+uint32_t
+ruleidx_next(
+	const ruleidx_t *ridx,
+	uint32_t pos
+);
+
+/**
+ * Compute the hash of the key
+ * @param key the key
+ * @return the hash of the key
+ */
+extern
+uint32_t
+ruleidx_hash(
+	const anydb_key_t *key
+);
+
+/**
+ * Compute the keys of rules that can match the searched 'key' and their
+ * hashes. The computed keys are the keys where each field is either
+ * the field of the searched key or WIDE. They are sorted from the most
+ * specific to the least specific: the keys having less WIDE fields
+ * first and, for a same count of WIDE fields, a WIDE permission first,
+ * then a WIDE client, then a WIDE user and last a WIDE session.
+ * Chains of distinct keys can share a hash, so the rules of a chain
+ * must be compared to the key.
+ * @param key the searched key
+ * @param keys array receiving the keys
+ * @param hashes array receiving the hashes of the keys
+ * @return the count of keys stored in 'keys' and 'hashes'
+ */
+extern
+unsigned
+ruleidx_search_hashes(
+	const anydb_key_t *key,
+	anydb_key_t keys[RuleIdx_Max_Hashes],
+	uint32_t hashes[RuleIdx_Max_Hashes]
+);
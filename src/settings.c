@@ -29,6 +29,8 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -41,7 +43,7 @@ typedef struct desc_setting_s desc_setting_t;
 
 struct desc_setting_s {
 	const char *key;
-	enum { STRING, BOOLEAN } type;
+	enum { STRING, BOOLEAN, INTEGER } type;
 	unsigned offset;
 };
 
@@ -57,7 +59,12 @@ static const desc_setting_t dscset[] = {
 	{ "make-db-dir",     BOOLEAN, OFFSET(makedbdir) },
 	{ "make-socket-dir", BOOLEAN, OFFSET(makesockdir) },
 	{ "own-db-dir",      BOOLEAN, OFFSET(owndbdir) },
-	{ "own-socket-dir",  BOOLEAN, OFFSET(ownsockdir) }
+	{ "own-socket-dir",  BOOLEAN, OFFSET(ownsockdir) },
+	{ "cache-agents",    BOOLEAN, OFFSET(cacheagents) },
+	{ "shared-cache",    BOOLEAN, OFFSET(sharedcache) },
+	{ "workers",         INTEGER, OFFSET(workers) },
+	{ "high-water",      INTEGER, OFFSET(highwater) },
+	{ "decision-cache",  INTEGER, OFFSET(decisioncache) }
 #undef OFFSET
 };
 
@@ -79,7 +86,8 @@ static int read_settings(settings_t *settings, FILE *file)
 	char cmt = 0;
 	const desc_setting_t *dskey;
 	size_t lkey, lval, lsp;
-	char *str, *key, *val;
+	char *str, *key, *val, *end;
+	long num;
 	void *pfld;
 	char buffer[SIZE_BUFFER_SETTINGS];
 
@@ -134,6 +142,14 @@ static int read_settings(settings_t *settings, FILE *file)
 						return -1;
 					}
 					break;
+				case INTEGER:
+					num = strtol(val, &end, 10);
+					if (end != &val[lval] || num < 0 || num > INT_MAX) {
+						fprintf(stderr, "bad key value %.*s (expected: number)\n", (int)lval, val);
+						return -1;
+					}
+					*(int*)pfld = (int)num;
+					break;
 				}
 			}
 		}
@@ -150,6 +166,11 @@ void initialize_default_settings(settings_t *settings)
 	settings->owndbdir = 0;
 	settings->ownsockdir = 0;
 	settings->forceinit = 0;
+	settings->workers = 0;
+	settings->highwater = -1;
+	settings->decisioncache = -1;
+	settings->cacheagents = 0;
+	settings->sharedcache = 0;
 	settings->init = DEFAULT_INIT_DIR;
 	settings->dbdir = DEFAULT_DB_DIR;
 	settings->socketdir = cyn_default_socket_dir;
@@ -43,6 +43,11 @@ struct settings_s {
 	int owndbdir;
 	int ownsockdir;
 	int forceinit;
+	int workers;
+	int highwater;
+	int decisioncache;
+	int cacheagents;
+	int sharedcache;
 	const char *init;
 	const char *dbdir;
 	const char *socketdir;
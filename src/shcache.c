@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/******************************************************************************/
+/******************************************************************************/
+/* IMPLEMENTATION OF CACHE SHARED BY THE SERVER WITH ITS CLIENTS              */
+/******************************************************************************/
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shcache.h"
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+/** magic number of the file: "CYSC" */
+#define SHCACHE_MAGIC      0x43535943u
+
+/** version of the layout of the file */
+#define SHCACHE_VERSION    1
+
+/** count of slots, a power of 2 */
+#define SHCACHE_COUNT      4096
+
+/** count of the slots where a key can be recorded */
+#define SHCACHE_WAYS       4
+
+/** size of a slot */
+#define SHCACHE_SLOT_SIZE  256
+
+/** size reserved for the head */
+#define SHCACHE_HEAD_SIZE  64
+
+/** head of the file */
+struct head
+{
+	/** magic number */
+	uint32_t magic;
+
+	/** version of the layout */
+	uint32_t version;
+
+	/** count of slots */
+	uint32_t count;
+
+	/** current changeid, 0 when the server is gone */
+	uint32_t changeid;
+};
+
+/** slot of the file recording one decision */
+struct slot
+{
+	/** sequence number, odd while the slot is being written */
+	uint32_t sequence;
+
+	/** changeid of the decision */
+	uint32_t changeid;
+
+	/** hash of the key */
+	uint32_t hash;
+
+	/** length of the strings */
+	uint16_t length;
+
+	/** value of the decision */
+	int8_t value;
+
+	/** unused */
+	uint8_t unused;
+
+	/** expiration of the decision, 0 for never */
+	int64_t expire;
+
+	/** strings of the key, zero terminated, permission in lower case */
+	char strings[SHCACHE_SLOT_SIZE - 24];
+};
+
+/** handler of the shared cache */
+struct shcache
+{
+	/** the mapped head */
+	struct head *head;
+
+	/** the mapped slots */
+	struct slot *slots;
+
+	/** size of the mapping */
+	size_t size;
+
+	/** mutex of the writers */
+	pthread_mutex_t mutex;
+
+	/** index of the next way to replace when all are used */
+	unsigned victim;
+
+	/** the memory file given to the clients by the server, -1 for the clients */
+	int fd;
+};
+
+/**
+ * Compute the hash of the key and its length as stored in slots
+ * @param client the client of the key
+ * @param session the session of the key
+ * @param user the user of the key
+ * @param permission the permission of the key
+ * @param length where to store the length
+ * @return the hash
+ */
+static
+uint32_t
+hashkey(
+	const char *client,
+	const char *session,
+	const char *user,
+	const char *permission,
+	size_t *length
+) {
+	const char *strs[4] = { client, session, user, permission };
+	const unsigned char *s;
+	uint32_t h;
+	size_t l;
+	unsigned i, c;
+
+	h = 2166136261u;
+	l = 0;
+	for (i = 0 ; i < 4 ; i++) {
+		s = (const unsigned char*)strs[i];
+		do {
+			c = *s++;
+			if (i == 3)
+				c = (unsigned)tolower((int)c);
+			h = (h ^ c) * 16777619u;
+			l++;
+		} while (c);
+	}
+	*length = l;
+	return h ^ (h >> 15);
+}
+
+/**
+ * Compare the head with a string and either return NULL if it doesn't match or
+ * otherwise return the pointer to the next string for heading.
+ * @param head head of scan
+ * @param other string to compare
+ * @param lower compare with lower case of other
+ * @return NULL if no match or pointer to the strings that follows head if match
+ */
+static
+const char*
+cmp(
+	const char *head,
+	const char *other,
+	bool lower
+) {
+	char c, o;
+
+	do {
+		c = *head++;
+		o = *other++;
+		if (lower)
+			o = (char)tolower(o);
+		if (c != o)
+			return NULL;
+	} while (c);
+	return head;
+}
+
+/**
+ * Check if the strings of a slot are the key
+ * @param strings the strings of the slot, of the length of the key
+ * @param client the client of the key
+ * @param session the session of the key
+ * @param user the user of the key
+ * @param permission the permission of the key
+ * @return true if matching
+ */
+static
+bool
+match(
+	const char *strings,
+	const char *client,
+	const char *session,
+	const char *user,
+	const char *permission
+) {
+	return (strings = cmp(strings, client, false))
+	    && (strings = cmp(strings, session, false))
+	    && (strings = cmp(strings, user, false))
+	    && cmp(strings, permission, true);
+}
+
+/**
+ * Allocate the handler and map the file
+ * @param shcache where to store the handler
+ * @param fd the file descriptor of the file
+ * @param writable map it writable?
+ * @return 0 on success or a negative -errno value
+ */
+static
+int
+map(
+	shcache_t **shcache,
+	int fd,
+	bool writable
+) {
+	shcache_t *shc;
+	void *addr;
+	size_t size;
+
+	size = SHCACHE_HEAD_SIZE + SHCACHE_COUNT * sizeof(struct slot);
+	shc = malloc(sizeof *shc);
+	if (!shc)
+		return -ENOMEM;
+	addr = mmap(NULL, size, writable ? PROT_READ|PROT_WRITE : PROT_READ,
+			MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		free(shc);
+		return -errno;
+	}
+	shc->head = addr;
+	shc->slots = (struct slot*)((char*)addr + SHCACHE_HEAD_SIZE);
+	shc->size = size;
+	shc->victim = 0;
+	shc->fd = -1;
+	pthread_mutex_init(&shc->mutex, NULL);
+	*shcache = shc;
+	return 0;
+}
+
+/* see shcache.h */
+int
+shcache_create(
+	shcache_t **shcache
+) {
+	int fd, rc;
+
+	/* the file is only reachable through its descriptor */
+	*shcache = NULL;
+	fd = memfd_create("cynagora-cache", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+	if (ftruncate(fd, SHCACHE_HEAD_SIZE + SHCACHE_COUNT * sizeof(struct slot)) < 0)
+		rc = -errno;
+	else
+		rc = map(shcache, fd, true);
+	if (rc == 0) {
+		(*shcache)->head->magic = SHCACHE_MAGIC;
+		(*shcache)->head->version = SHCACHE_VERSION;
+		(*shcache)->head->count = SHCACHE_COUNT;
+		/* the clients can neither write it nor resize it */
+		if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW
+					|F_SEAL_FUTURE_WRITE|F_SEAL_SEAL) < 0) {
+			rc = -errno;
+			shcache_close(*shcache);
+			*shcache = NULL;
+		}
+		else
+			(*shcache)->fd = fd;
+	}
+	if (rc < 0)
+		close(fd);
+	return rc;
+}
+
+/* see shcache.h */
+int
+shcache_fd(
+	shcache_t *shcache
+) {
+	return shcache->fd;
+}
+
+/* see shcache.h */
+void
+shcache_destroy(
+	shcache_t *shcache
+) {
+	if (shcache) {
+		__atomic_store_n(&shcache->head->changeid, 0, __ATOMIC_RELEASE);
+		shcache_close(shcache);
+	}
+}
+
+/* see shcache.h */
+void
+shcache_clear(
+	shcache_t *shcache,
+	uint32_t changeid
+) {
+	__atomic_store_n(&shcache->head->changeid, changeid, __ATOMIC_RELEASE);
+}
+
+/* see shcache.h */
+void
+shcache_put(
+	shcache_t *shcache,
+	uint32_t changeid,
+	const char *client,
+	const char *session,
+	const char *user,
+	const char *permission,
+	int value,
+	time_t expire
+) {
+	struct slot *slot, *target, *avail;
+	uint32_t hash, sequence;
+	size_t length;
+	unsigned i;
+	char *p;
+	time_t now;
+
+	/* only keys fitting in slots are recorded */
+	hash = hashkey(client, session, user, permission, &length);
+	if (length > sizeof slot->strings)
+		return;
+
+	pthread_mutex_lock(&shcache->mutex);
+	if (changeid == shcache->head->changeid) {
+		/* search the slot of the key or a free one */
+		now = time(NULL);
+		target = avail = NULL;
+		for (i = 0 ; i < SHCACHE_WAYS && !target ; i++) {
+			slot = &shcache->slots[(hash + i) & (SHCACHE_COUNT - 1)];
+			if (slot->changeid != changeid
+			 || (slot->expire && slot->expire < now)) {
+				if (!avail)
+					avail = slot;
+			}
+			else if (slot->hash == hash
+			      && slot->length == length
+			      && match(slot->strings, client, session, user, permission))
+				target = slot;
+		}
+		if (!target)
+			target = avail;
+		if (!target) {
+			i = shcache->victim++ % SHCACHE_WAYS;
+			target = &shcache->slots[(hash + i) & (SHCACHE_COUNT - 1)];
+		}
+
+		/* write it, the odd sequence tells readers to skip it */
+		sequence = target->sequence;
+		__atomic_store_n(&target->sequence, sequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		target->changeid = changeid;
+		target->hash = hash;
+		target->length = (uint16_t)length;
+		target->value = (int8_t)value;
+		target->expire = (int64_t)expire;
+		p = stpcpy(target->strings, client) + 1;
+		p = stpcpy(p, session) + 1;
+		p = stpcpy(p, user) + 1;
+		do { *p = (char)tolower(*permission++); } while (*p++);
+		__atomic_store_n(&target->sequence, sequence + 2, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&shcache->mutex);
+}
+
+/* see shcache.h */
+int
+shcache_open(
+	shcache_t **shcache,
+	int fd
+) {
+	const struct head *head;
+	struct stat st;
+	int rc;
+
+	*shcache = NULL;
+	if (fstat(fd, &st) < 0)
+		rc = -errno;
+	else if (st.st_size != SHCACHE_HEAD_SIZE + SHCACHE_COUNT * sizeof(struct slot))
+		rc = -EINVAL;
+	else
+		rc = map(shcache, fd, false);
+	if (rc == 0) {
+		/* check the layout */
+		head = (*shcache)->head;
+		if (head->magic != SHCACHE_MAGIC
+		 || head->version != SHCACHE_VERSION
+		 || head->count != SHCACHE_COUNT) {
+			shcache_close(*shcache);
+			*shcache = NULL;
+			rc = -EINVAL;
+		}
+	}
+	return rc;
+}
+
+/* see shcache.h */
+void
+shcache_close(
+	shcache_t *shcache
+) {
+	if (shcache) {
+		munmap(shcache->head, shcache->size);
+		if (shcache->fd >= 0)
+			close(shcache->fd);
+		pthread_mutex_destroy(&shcache->mutex);
+		free(shcache);
+	}
+}
+
+/* see shcache.h */
+int
+shcache_search(
+	shcache_t *shcache,
+	uint32_t changeid,
+	const char *client,
+	const char *session,
+	const char *user,
+	const char *permission
+) {
+	const struct slot *slot;
+	struct slot copy;
+	uint32_t hash, sequence;
+	size_t length;
+	unsigned i;
+
+	/* is the cache valid for the client? */
+	if (!changeid
+	 || changeid != __atomic_load_n(&shcache->head->changeid, __ATOMIC_ACQUIRE))
+		return -ENOENT;
+
+	hash = hashkey(client, session, user, permission, &length);
+	if (length > sizeof slot->strings)
+		return -ENOENT;
+
+	for (i = 0 ; i < SHCACHE_WAYS ; i++) {
+		slot = &shcache->slots[(hash + i) & (SHCACHE_COUNT - 1)];
+
+		/* copy the slot, a slot being written is a miss */
+		sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (sequence & 1)
+			continue;
+		memcpy(&copy, slot, offsetof(struct slot, strings));
+		if (copy.hash != hash
+		 || copy.changeid != changeid
+		 || copy.length != length)
+			continue;
+		memcpy(copy.strings, slot->strings, length);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (sequence != __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED))
+			continue;
+
+		/* check the copy */
+		if ((!copy.expire || copy.expire >= time(NULL))
+		 && match(copy.strings, client, session, user, permission))
+			return (int)copy.value;
+	}
+	return -ENOENT;
+}
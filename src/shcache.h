@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+/******************************************************************************/
+/******************************************************************************/
+/* IMPLEMENTATION OF CACHE SHARED BY THE SERVER WITH ITS CLIENTS              */
+/******************************************************************************/
+/******************************************************************************/
+
+/**
+ * The shared cache is a memory file mapped in memory. The server writes in
+ * it the decisions of the checks it made using the database. The file has
+ * no path: the server passes its descriptor to its clients through their
+ * socket. The file is sealed so that the clients can only map it read only
+ * and search in it the decisions before asking the server.
+ *
+ * The decisions are recorded with the changeid of the database they
+ * were computed from. Only the decisions whose changeid is the current
+ * changeid of the cache are valid. So changing the changeid of the cache
+ * clears it.
+ */
+typedef struct shcache shcache_t;
+
+/**
+ * Create the shared cache for writing (server side)
+ *
+ * @param shcache where to store the handler of the created cache
+ *
+ * @return 0 on success or a negative -errno value
+ *
+ * @see shcache_fd
+ */
+extern
+int
+shcache_create(
+	shcache_t **shcache
+);
+
+/**
+ * Get the descriptor of the file of the shared cache to pass to clients.
+ * The descriptor remains owned by the shared cache.
+ *
+ * @param shcache the shared cache created by shcache_create
+ *
+ * @return the file descriptor
+ */
+extern
+int
+shcache_fd(
+	shcache_t *shcache
+);
+
+/**
+ * Destroy the shared cache created by shcache_create.
+ * Invalidate it for the clients and release its file.
+ *
+ * @param shcache the shared cache
+ */
+extern
+void
+shcache_destroy(
+	shcache_t *shcache
+);
+
+/**
+ * Clear the shared cache by setting its current changeid
+ *
+ * @param shcache the shared cache
+ * @param changeid the new changeid of valid decisions, not 0
+ */
+extern
+void
+shcache_clear(
+	shcache_t *shcache,
+	uint32_t changeid
+);
+
+/**
+ * Record a decision in the shared cache. The decision is not recorded
+ * if 'changeid' is not the current changeid of the cache.
+ *
+ * @param shcache the shared cache
+ * @param changeid the changeid of the database used for the decision
+ * @param client the client of the key
+ * @param session the session of the key
+ * @param user the user of the key
+ * @param permission the permission of the key
+ * @param value the value of the decision: 1 for yes, 0 for no
+ * @param expire the absolute expiration of the decision, 0 for never
+ */
+extern
+void
+shcache_put(
+	shcache_t *shcache,
+	uint32_t changeid,
+	const char *client,
+	const char *session,
+	const char *user,
+	const char *permission,
+	int value,
+	time_t expire
+);
+
+/**
+ * Open the shared cache of the file 'fd' for reading (client side).
+ * The descriptor is not kept and can be closed after the call.
+ *
+ * @param shcache where to store the handler of the opened cache
+ * @param fd the descriptor of the file of the cache given by the server
+ *
+ * @return 0 on success or a negative -errno value
+ */
+extern
+int
+shcache_open(
+	shcache_t **shcache,
+	int fd
+);
+
+/**
+ * Close the shared cache opened by shcache_open
+ *
+ * @param shcache the shared cache
+ */
+extern
+void
+shcache_close(
+	shcache_t *shcache
+);
+
+/**
+ * Search the decision of a key in the shared cache
+ *
+ * @param shcache the shared cache
+ * @param changeid the changeid known by the client
+ * @param client the client of the key
+ * @param session the session of the key
+ * @param user the user of the key
+ * @param permission the permission of the key
+ *
+ * @return the value of the decision (1 for yes, 0 for no) or -ENOENT
+ * when not found or when changeid isn't the current changeid of the cache
+ */
+extern
+int
+shcache_search(
+	shcache_t *shcache,
+	uint32_t changeid,
+	const char *client,
+	const char *session,
+	const char *user,
+	const char *permission
+);
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/******************************************************************************/
+/******************************************************************************/
+/* INDEX OF ITEMS SORTED IN RUNS                                              */
+/******************************************************************************/
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sortidx.h"
+
+/** minimal allocation of items */
+#define MIN_ALLOC  1024
+
+/**
+ * Merge the sorted runs [begin, middle) and [middle, end) of the index
+ * @param sidx the index
+ * @param begin start of the first run
+ * @param middle end of the first run and start of the second run
+ * @param end end of the second run
+ */
+static
+void
+merge(
+	sortidx_t *sidx,
+	uint32_t begin,
+	uint32_t middle,
+	uint32_t end
+) {
+	uint32_t *items = sidx->items, *left = sidx->scratch;
+	uint32_t i, n, j, k;
+
+	n = middle - begin;
+	if (!n || middle == end
+	 || sidx->cmp(sidx->closure, items[middle - 1], items[middle]) <= 0)
+		return; /* already sorted */
+
+	memcpy(left, &items[begin], n * sizeof *left);
+	i = 0;
+	j = middle;
+	k = begin;
+	while (i < n && j < end) {
+		if (sidx->cmp(sidx->closure, items[j], left[i]) < 0)
+			items[k++] = items[j++];
+		else
+			items[k++] = left[i++];
+	}
+	memcpy(&items[k], &left[i], (n - i) * sizeof *left);
+}
+
+/**
+ * Search dichotomically the 'key' in the run [begin, end)
+ * @param sidx the index
+ * @param cmpkey the comparison function
+ * @param key the key to search
+ * @param begin start of the run
+ * @param end end of the run
+ * @param found where to store if found
+ * @return the index of the found item or of the first item after the key
+ */
+static
+uint32_t
+dig(
+	const sortidx_t *sidx,
+	sortidx_cmpkey_t *cmpkey,
+	const void *key,
+	uint32_t begin,
+	uint32_t end,
+	bool *found
+) {
+	uint32_t m;
+	int c;
+
+	while (begin < end) {
+		m = (begin + end) >> 1;
+		c = cmpkey(sidx->closure, key, sidx->items[m]);
+		if (c == 0) {
+			*found = true;
+			return m;
+		}
+		if (c < 0)
+			end = m;
+		else
+			begin = m + 1;
+	}
+	*found = false;
+	return begin;
+}
+
+/* see sortidx.h */
+void
+sortidx_init(
+	sortidx_t *sidx,
+	sortidx_cmp_t *cmp,
+	sortidx_cmpkey_t *cmpkey,
+	void *closure
+) {
+	memset(sidx, 0, sizeof *sidx);
+	sidx->cmp = cmp;
+	sidx->cmpkey = cmpkey;
+	sidx->closure = closure;
+}
+
+/* see sortidx.h */
+void
+sortidx_destroy(
+	sortidx_t *sidx
+) {
+	free(sidx->items);
+	free(sidx->scratch);
+	sortidx_init(sidx, sidx->cmp, sidx->cmpkey, sidx->closure);
+}
+
+/* see sortidx.h */
+void
+sortidx_clear(
+	sortidx_t *sidx
+) {
+	sidx->count = sidx->merged = 0;
+}
+
+/* see sortidx.h */
+int
+sortidx_add(
+	sortidx_t *sidx,
+	uint32_t item
+) {
+	uint32_t alloc, *items, tail, size, end;
+
+	/* ensure allocation */
+	if (sidx->count == sidx->alloc) {
+		alloc = sidx->alloc ? 2 * sidx->alloc : MIN_ALLOC;
+		items = realloc(sidx->items, alloc * sizeof *items);
+		if (!items)
+			return -ENOMEM;
+		sidx->items = items;
+		items = realloc(sidx->scratch, alloc * sizeof *items);
+		if (!items)
+			return -ENOMEM;
+		sidx->scratch = items;
+		sidx->alloc = alloc;
+	}
+
+	/* append the item as a run of size 1 */
+	tail = sidx->count - sidx->merged;
+	end = ++sidx->count;
+	sidx->items[end - 1] = item;
+
+	/* merge the runs of equal sizes */
+	for (size = 1 ; tail & size ; size <<= 1)
+		merge(sidx, end - 2 * size, end - size, end);
+
+	/* merge all when the tail is as big as the merged run */
+	if (tail >= sidx->merged)
+		sortidx_compact(sidx);
+	return 0;
+}
+
+/* see sortidx.h */
+void
+sortidx_compact(
+	sortidx_t *sidx
+) {
+	uint32_t tail, size, end, begin;
+
+	/* merge the tail runs, from the smallest to the biggest */
+	tail = sidx->count - sidx->merged;
+	end = sidx->count;
+	for (size = 1 ; size && size <= tail ; size <<= 1) {
+		if (tail & size) {
+			begin = end - (tail & (size - 1)) - size;
+			merge(sidx, begin, end - (tail & (size - 1)), end);
+		}
+	}
+
+	/* merge the tail with the merged run */
+	merge(sidx, 0, sidx->merged, end);
+	sidx->merged = end;
+}
+
+/* see sortidx.h */
+bool
+sortidx_search(
+	const sortidx_t *sidx,
+	const void *key,
+	uint32_t *item
+) {
+	uint32_t tail, size, begin, i;
+	bool found;
+
+	/* search the merged run */
+	i = dig(sidx, sidx->cmpkey, key, 0, sidx->merged, &found);
+
+	/* search the tail runs, from the biggest to the smallest */
+	tail = sidx->count - sidx->merged;
+	begin = sidx->merged;
+	for (size = 0x80000000u ; !found && size ; size >>= 1) {
+		if (tail & size) {
+			i = dig(sidx, sidx->cmpkey, key, begin, begin + size, &found);
+			begin += size;
+		}
+	}
+	if (found)
+		*item = sidx->items[i];
+	return found;
+}
+
+/* see sortidx.h */
+void
+sortidx_scan(
+	sortidx_t *sidx,
+	sortidx_cmpkey_t *cmprange,
+	const void *key,
+	void (*callback)(void *closure, uint32_t item),
+	void *closure
+) {
+	uint32_t lo, up, m;
+
+	sortidx_compact(sidx);
+
+	/* search the first item of the range */
+	lo = 0;
+	up = sidx->merged;
+	while (lo < up) {
+		m = (lo + up) >> 1;
+		if (cmprange(sidx->closure, key, sidx->items[m]) > 0)
+			lo = m + 1;
+		else
+			up = m;
+	}
+
+	/* iterate the range */
+	while (lo < sidx->merged && !cmprange(sidx->closure, key, sidx->items[lo]))
+		callback(closure, sidx->items[lo++]);
+}
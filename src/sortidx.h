@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+/******************************************************************************/
+/******************************************************************************/
+/* INDEX OF ITEMS SORTED IN RUNS                                              */
+/******************************************************************************/
+/******************************************************************************/
+
+/**
+ * A sorted index records 32 bits items, sorted using a comparison function.
+ *
+ * The items are stored in sorted runs: a first run, the merged run, and
+ * a tail of runs whose sizes are the powers of 2 of the binary
+ * decomposition of the count of items of the tail. Adding an item is
+ * merging runs of equal sizes, like when incrementing a binary number,
+ * so the cost of adding an item is O(log n) amortized.
+ *
+ * When the tail becomes as big as the merged run, or on request, all the
+ * runs are merged in the merged run.
+ */
+
+/**
+ * Comparison of the items 'a' and 'b'
+ * returns a negative value if a < b, 0 if a == b or a positive value if a > b
+ */
+typedef int sortidx_cmp_t(void *closure, uint32_t a, uint32_t b);
+
+/**
+ * Comparison of the 'key' and the 'item'
+ * returns a negative value if key < item, 0 if key == item or
+ * a positive value if key > item
+ */
+typedef int sortidx_cmpkey_t(void *closure, const void *key, uint32_t item);
+
+/**
+ * Structure of the sorted index
+ */
+struct sortidx
+{
+	/** count of items */
+	uint32_t count;
+
+	/** count of items of the merged run */
+	uint32_t merged;
+
+	/** allocated count of items */
+	uint32_t alloc;
+
+	/** the items: the merged run followed by the tail runs */
+	uint32_t *items;
+
+	/** buffer for merging runs */
+	uint32_t *scratch;
+
+	/** comparison of items */
+	sortidx_cmp_t *cmp;
+
+	/** comparison of keys and items */
+	sortidx_cmpkey_t *cmpkey;
+
+	/** closure of the comparison functions */
+	void *closure;
+};
+typedef struct sortidx sortidx_t;
+
+/**
+ * Initialize the index as empty
+ * @param sidx the index to initialize
+ * @param cmp the comparison of items
+ * @param cmpkey the comparison of keys and items
+ * @param closure closure of the comparison functions
+ */
+extern
+void
+sortidx_init(
+	sortidx_t *sidx,
+	sortidx_cmp_t *cmp,
+	sortidx_cmpkey_t *cmpkey,
+	void *closure
+);
+
+/**
+ * Release the memory used by the index
+ * @param sidx the index to release
+ */
+extern
+void
+sortidx_destroy(
+	sortidx_t *sidx
+);
+
+/**
+ * Remove all the items of the index
+ * @param sidx the index to clear
+ */
+extern
+void
+sortidx_clear(
+	sortidx_t *sidx
+);
+
+/**
+ * Add the 'item' to the index
+ * @param sidx the index
+ * @param item the item to add
+ * @return 0 on success or -ENOMEM
+ */
+extern
+int
+sortidx_add(
+	sortidx_t *sidx,
+	uint32_t item
+);
+
+/**
+ * Merge all the runs of the index in one
+ * @param sidx the index
+ */
+extern
+void
+sortidx_compact(
+	sortidx_t *sidx
+);
+
+/**
+ * Search the item matching 'key'
+ * @param sidx the index
+ * @param key the key to search
+ * @param item where to store the found item
+ * @return true if found or false otherwise
+ */
+extern
+bool
+sortidx_search(
+	const sortidx_t *sidx,
+	const void *key,
+	uint32_t *item
+);
+
+/**
+ * Call 'callback' in order for each item in the range of 'key' as
+ * defined by the comparison 'cmprange'. The comparison must return
+ * 0 for the items of the range, a negative value for the items after
+ * the range and a positive value for the items before the range.
+ * This is typically used for scanning items starting with a prefix.
+ * The runs are merged before the scan.
+ * @param sidx the index
+ * @param cmprange the comparison defining the range
+ * @param key the key of the range
+ * @param callback the function to call for each item
+ * @param closure the closure of the callback
+ */
+extern
+void
+sortidx_scan(
+	sortidx_t *sidx,
+	sortidx_cmpkey_t *cmprange,
+	const void *key,
+	void (*callback)(void *closure, uint32_t item),
+	void *closure
+);
@@ -0,0 +1,465 @@
+/*
+ * Copyright (C) 2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/******************************************************************************/
+/******************************************************************************/
+/* WRITE-AHEAD LOG OF BUFFERED FILES                                          */
+/******************************************************************************/
+/******************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "wal.h"
+
+/**
+ * Header of a frame, followed by one entry for each fbuf
+ */
+struct frame
+{
+	/** length of the entries */
+	uint32_t length;
+
+	/** checksum of the entries */
+	uint32_t checksum;
+};
+
+/**
+ * Header of the entry of a fbuf, followed by its 'count' ranges
+ */
+struct entry
+{
+	/** size used after the frame */
+	uint32_t used;
+
+	/** count of ranges */
+	uint32_t count;
+};
+
+/**
+ * Header of a range of bytes, followed by the 'count' bytes to put
+ */
+struct range
+{
+	/** offset of the bytes */
+	uint32_t offset;
+
+	/** count of bytes */
+	uint32_t count;
+};
+
+/** initial value of checksums */
+#define CHECKSUM_INIT 2166136261u
+
+/**
+ * Compute the checksum (FNV-1a) of 'length' bytes of 'data'
+ * @param sum the current checksum or CHECKSUM_INIT to start
+ * @param data the data to sum
+ * @param length length of the data
+ * @return the new checksum
+ */
+static
+uint32_t
+checksum(
+	uint32_t sum,
+	const void *data,
+	size_t length
+) {
+	const unsigned char *p = data;
+
+	while (length--)
+		sum = (sum ^ *p++) * 16777619u;
+	return sum;
+}
+
+/**
+ * Get the next range of bytes of 'fb' to log: the ranges of pages
+ * modified in place and then the bytes not logged
+ * @param fb the fbuf
+ * @param offset in: offset of the search, out: offset of the found range
+ * @return the count of bytes of the range or 0 if none
+ */
+static
+uint32_t
+next_range(
+	fbuf_t *fb,
+	uint32_t *offset
+) {
+	uint32_t count;
+
+	if (*offset < fb->logged) {
+		count = fbuf_pages_next(&fb->unlogged, fb->logged, offset);
+		if (count)
+			return count;
+	}
+	else if (*offset > fb->logged)
+		return 0;
+	*offset = fb->logged;
+	return fb->used - fb->logged;
+}
+
+/* see wal.h */
+int
+wal_open(
+	wal_t *wal,
+	const char *name,
+	const char *id,
+	uint32_t idlen
+) {
+	int rc;
+	struct stat st;
+	char *buffer;
+
+	/* reset */
+	memset(wal, 0, sizeof *wal);
+	wal->fd = -1;
+	wal->idlen = idlen;
+
+	/* save name */
+	wal->name = strdup(name);
+	if (wal->name == NULL) {
+		rc = -ENOMEM;
+		goto error;
+	}
+
+	/* open the file */
+	wal->fd = open(name, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	if (wal->fd < 0 || fstat(wal->fd, &st) < 0) {
+		rc = -errno;
+		goto error;
+	}
+	if ((off_t)INT32_MAX < st.st_size) {
+		rc = -EFBIG;
+		goto error;
+	}
+	wal->size = (uint32_t)st.st_size;
+
+	/* init if empty */
+	if (wal->size == 0) {
+		errno = 0;
+		if (pwrite(wal->fd, id, idlen, 0) != (ssize_t)idlen
+		 || fdatasync(wal->fd) < 0) {
+			rc = errno ? -errno : -EIO;
+			goto error;
+		}
+		wal->size = idlen;
+		return 0;
+	}
+
+	/* check identification */
+	buffer = alloca(idlen);
+	if (wal->size < idlen
+	 || pread(wal->fd, buffer, idlen, 0) != (ssize_t)idlen
+	 || memcmp(buffer, id, idlen)) {
+		fprintf(stderr, "identification of file %s failed\n", name);
+		rc = -ENOKEY;
+		goto error2;
+	}
+	return 0;
+
+error:
+	fprintf(stderr, "can't open file %s: %s\n", name, strerror(-rc));
+error2:
+	wal_close(wal);
+	return rc;
+}
+
+/* see wal.h */
+void
+wal_close(
+	wal_t *wal
+) {
+	if (wal->fd >= 0)
+		close(wal->fd);
+	free(wal->name);
+	memset(wal, 0, sizeof *wal);
+	wal->fd = -1;
+}
+
+/**
+ * Apply to the 'count' fbufs the entries of the frame 'data' of 'length'
+ * @param data the entries of the frame
+ * @param length the length of the entries
+ * @param fbufs the fbufs in the order of the log
+ * @param count count of fbufs
+ * @return 0 in case of success
+ *         -EBADMSG if the frame doesn't match the fbufs
+ *         -ENOMEM if out of memory
+ */
+static
+int
+apply(
+	const char *data,
+	uint32_t length,
+	fbuf_t *fbufs[],
+	unsigned count
+) {
+	struct entry entry;
+	struct range range;
+	uint32_t pos, r;
+	unsigned i;
+	fbuf_t *fb;
+	int rc;
+
+	for (pos = i = 0 ; i < count ; i++) {
+		/* get the entry */
+		if (length - pos < (uint32_t)sizeof entry)
+			return -EBADMSG;
+		memcpy(&entry, data + pos, sizeof entry);
+		pos += (uint32_t)sizeof entry;
+		fb = fbufs[i];
+
+		/* grow to the size of the entry: the files may have shrunk
+		 * after the frame if a checkpoint was interrupted before the
+		 * reset of the log */
+		if (entry.used > fb->used) {
+			rc = fbuf_ensure_capacity(fb, entry.used);
+			if (rc < 0)
+				return rc;
+			memset(fb->buffer + fb->used, 0, entry.used - fb->used);
+			fbuf_touch(fb, fb->used);
+			fb->used = entry.used;
+		}
+
+		/* put its ranges */
+		for (r = 0 ; r < entry.count ; r++) {
+			if (length - pos < (uint32_t)sizeof range)
+				return -EBADMSG;
+			memcpy(&range, data + pos, sizeof range);
+			pos += (uint32_t)sizeof range;
+			if (range.offset > entry.used
+			 || range.count > entry.used - range.offset
+			 || range.count > length - pos)
+				return -EBADMSG;
+			if (range.count) {
+				rc = fbuf_put(fb, data + pos, range.count, range.offset);
+				if (rc < 0)
+					return rc;
+				pos += range.count;
+			}
+		}
+
+		/* set its size */
+		fb->used = entry.used;
+		fbuf_touch(fb, entry.used);
+	}
+	return pos == length ? 0 : -EBADMSG;
+}
+
+/* see wal.h */
+int
+wal_replay(
+	wal_t *wal,
+	fbuf_t *fbufs[],
+	unsigned count
+) {
+	int rc;
+	char *data;
+	uint32_t length, pos;
+	struct frame frame;
+	unsigned i;
+
+	/* read the frames */
+	length = wal->size - wal->idlen;
+	if (length == 0)
+		return 0;
+	data = malloc(length);
+	if (data == NULL)
+		return -ENOMEM;
+	errno = 0;
+	if (pread(wal->fd, data, length, wal->idlen) != (ssize_t)length) {
+		rc = errno ? -errno : -EIO;
+		goto end;
+	}
+
+	/* apply the complete frames */
+	rc = 0;
+	pos = 0;
+	while (rc == 0 && length - pos >= (uint32_t)sizeof frame) {
+		memcpy(&frame, data + pos, sizeof frame);
+		if (frame.length > length - pos - (uint32_t)sizeof frame
+		 || frame.checksum != checksum(CHECKSUM_INIT, data + pos + sizeof frame, frame.length))
+			break;
+		pos += (uint32_t)sizeof frame;
+		rc = apply(data + pos, frame.length, fbufs, count);
+		pos += frame.length;
+	}
+	if (rc < 0)
+		goto end;
+
+	/* the replayed data is logged */
+	for (i = 0 ; i < count ; i++)
+		fbuf_logged(fbufs[i]);
+
+	/* drop an incomplete frame */
+	if (pos != length) {
+		fprintf(stderr, "dropping incomplete frame of %s\n", wal->name);
+		if (ftruncate(wal->fd, (off_t)(wal->idlen + pos)) < 0) {
+			rc = -errno;
+			goto end;
+		}
+		wal->size = wal->idlen + pos;
+	}
+end:
+	if (rc < 0)
+		fprintf(stderr, "can't replay file %s: %s\n", wal->name, strerror(-rc));
+	free(data);
+	return rc;
+}
+
+/* see wal.h */
+uint32_t
+wal_frame_size(
+	fbuf_t *fbufs[],
+	unsigned count
+) {
+	uint32_t size, off, n;
+	unsigned i;
+
+	size = (uint32_t)sizeof(struct frame);
+	for (i = 0 ; i < count ; i++) {
+		size += (uint32_t)sizeof(struct entry);
+		for (off = 0 ; (n = next_range(fbufs[i], &off)) ; off += n)
+			size += (uint32_t)sizeof(struct range) + n;
+	}
+	return size;
+}
+
+/* see wal.h */
+int
+wal_append(
+	wal_t *wal,
+	fbuf_t *fbufs[],
+	unsigned count
+) {
+	struct frame frame;
+	struct entry *entries;
+	struct range *ranges;
+	struct iovec *iov;
+	unsigned i, n, r, nv, nranges;
+	uint32_t off, cnt, len, pos;
+	ssize_t rcs;
+	int rc;
+
+	/* count the ranges */
+	entries = alloca(count * sizeof *entries);
+	for (i = 0, nranges = 0 ; i < count ; i++) {
+		entries[i].used = fbufs[i]->used;
+		entries[i].count = 0;
+		for (off = 0 ; (cnt = next_range(fbufs[i], &off)) ; off += cnt)
+			entries[i].count++;
+		nranges += entries[i].count;
+	}
+
+	/* prepare the frame */
+	ranges = alloca(nranges * sizeof *ranges);
+	iov = alloca((1 + count + 2 * nranges) * sizeof *iov);
+	iov[0].iov_base = &frame;
+	iov[0].iov_len = sizeof frame;
+	frame.length = wal_frame_size(fbufs, count) - (uint32_t)sizeof frame;
+	frame.checksum = CHECKSUM_INIT;
+	for (i = 0, n = 1, r = 0 ; i < count ; i++) {
+		iov[n].iov_base = &entries[i];
+		iov[n++].iov_len = sizeof entries[i];
+		frame.checksum = checksum(frame.checksum, &entries[i], sizeof entries[i]);
+		for (off = 0 ; (cnt = next_range(fbufs[i], &off)) ; off += cnt, r++) {
+			ranges[r].offset = off;
+			ranges[r].count = cnt;
+			iov[n].iov_base = &ranges[r];
+			iov[n++].iov_len = sizeof ranges[r];
+			iov[n].iov_base = fbufs[i]->buffer + off;
+			iov[n++].iov_len = cnt;
+			frame.checksum = checksum(frame.checksum, &ranges[r], sizeof ranges[r]);
+			frame.checksum = checksum(frame.checksum, fbufs[i]->buffer + off, cnt);
+		}
+	}
+
+	/* write it by chunks of at most IOV_MAX vectors */
+	for (i = 0, pos = wal->size ; i < n ; i += nv, pos += (uint32_t)rcs) {
+		nv = n - i < IOV_MAX ? n - i : IOV_MAX;
+		for (r = 0, len = 0 ; r < nv ; r++)
+			len += (uint32_t)iov[i + r].iov_len;
+		do {
+			rcs = pwritev(wal->fd, &iov[i], (int)nv, (off_t)pos);
+		} while (rcs < 0 && errno == EINTR);
+		if (rcs < 0) {
+			rc = -errno;
+			goto error;
+		}
+		if ((uint32_t)rcs != len) {
+			rc = -EIO;
+			goto error;
+		}
+	}
+
+	/* done */
+	wal->size = pos;
+	wal->unflushed = true;
+	for (i = 0 ; i < count ; i++)
+		fbuf_logged(fbufs[i]);
+	return 0;
+
+error:
+	fprintf(stderr, "write of file %s failed: %s\n", wal->name, strerror(-rc));
+	return rc;
+}
+
+/* see wal.h */
+int
+wal_flush(
+	wal_t *wal
+) {
+	int rc;
+
+	if (!wal->unflushed)
+		return 0;
+	if (fdatasync(wal->fd) < 0) {
+		rc = -errno;
+		fprintf(stderr, "flush of file %s failed: %s\n", wal->name, strerror(-rc));
+		return rc;
+	}
+	wal->unflushed = false;
+	return 0;
+}
+
+/* see wal.h */
+int
+wal_reset(
+	wal_t *wal
+) {
+	int rc;
+
+	if (wal->size == wal->idlen)
+		return 0;
+	if (ftruncate(wal->fd, (off_t)wal->idlen) < 0 || fdatasync(wal->fd) < 0) {
+		rc = -errno;
+		fprintf(stderr, "reset of file %s failed: %s\n", wal->name, strerror(-rc));
+		return rc;
+	}
+	wal->size = wal->idlen;
+	wal->unflushed = false;
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+/******************************************************************************/
+/******************************************************************************/
+/* WRITE-AHEAD LOG OF BUFFERED FILES                                          */
+/******************************************************************************/
+/******************************************************************************/
+
+#include "fbuf.h"
+
+/**
+ * The write-ahead log records the modifications of a set of fbuf.
+ *
+ * The log starts with an identification prefix followed by frames. Each
+ * frame records atomically the modifications of the fbufs: for each fbuf,
+ * the pages modified in place below 'logged', the bytes from 'logged' to
+ * 'used' and the value of 'used'. A frame
+ * is checked by a checksum so that a partially written frame is ignored.
+ */
+struct wal
+{
+	/** filename */
+	char *name;
+
+	/** file descriptor */
+	int fd;
+
+	/** size of the log */
+	uint32_t size;
+
+	/** size of the identification prefix */
+	uint32_t idlen;
+
+	/** is there appended frames not flushed to the disk? */
+	bool unflushed;
+};
+
+/** short type */
+typedef struct wal wal_t;
+
+/**
+ * Open the write-ahead log 'wal' of 'name' and check that it has the
+ * prefix identifier 'id' of length 'idlen'. The log is created if it
+ * doesn't exist.
+ * @param wal the log to open
+ * @param name file name of the log
+ * @param id identifier prefix value
+ * @param idlen length of the identifier prefix
+ * @return 0 in case of success
+ *         -ENOMEM if out of memory
+ *         -ENOKEY if identification failed
+ *         a negative -errno code
+ */
+extern
+int
+wal_open(
+	wal_t *wal,
+	const char *name,
+	const char *id,
+	uint32_t idlen
+);
+
+/**
+ * Close the write-ahead log 'wal'
+ * @param wal the log to close
+ */
+extern
+void
+wal_close(
+	wal_t *wal
+);
+
+/**
+ * Apply to the 'count' fbufs of 'fbufs' the frames recorded in the log.
+ * A trailing partially written frame is removed from the log.
+ * @param wal the log
+ * @param fbufs the fbufs in the order of the log
+ * @param count count of fbufs
+ * @return 0 in case of success
+ *         -EBADMSG if the log doesn't match the fbufs
+ *         a negative -errno code
+ */
+extern
+int
+wal_replay(
+	wal_t *wal,
+	fbuf_t *fbufs[],
+	unsigned count
+);
+
+/**
+ * Compute the size of the frame that would record the 'count' fbufs
+ * @param fbufs the fbufs in the order of the log
+ * @param count count of fbufs
+ * @return the size of the frame
+ */
+extern
+uint32_t
+wal_frame_size(
+	fbuf_t *fbufs[],
+	unsigned count
+);
+
+/**
+ * Append to the log a frame recording the modifications of the 'count'
+ * fbufs of 'fbufs'. The frame is durable after the call to 'wal_flush'.
+ * @param wal the log
+ * @param fbufs the fbufs in the order of the log
+ * @param count count of fbufs
+ * @return 0 in case of success
+ *         a negative -errno code
+ */
+extern
+int
+wal_append(
+	wal_t *wal,
+	fbuf_t *fbufs[],
+	unsigned count
+);
+
+/**
+ * Flush to the disk the appended frames of the log
+ * @param wal the log
+ * @return 0 in case of success
+ *         a negative -errno code
+ */
+extern
+int
+wal_flush(
+	wal_t *wal
+);
+
+/**
+ * Remove the frames of the log. To be called when the fbufs
+ * are synchronized.
+ * @param wal the log
+ * @return 0 in case of success
+ *         a negative -errno code
+ */
+extern
+int
+wal_reset(
+	wal_t *wal
+);
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "../../src/data.h"
+#include "../../src/db.h"
+#include "../../src/db-import.h"
+#include "../../src/cyn.h"
+#include "../../src/cyn-server.h"
+#include "../../src/cynagora.h"
+#include "../test.h"
+
+#define COUNT 40
+
+static char dir[] = "/tmp/test-checkm.XXXXXX";
+
+/* the permissions perm.N are granted to the client C when N is even */
+static const char rules[] =
+	"C * U perm.0 yes forever\n"
+	"C * U perm.2 yes forever\n"
+	"C * U perm.4 yes forever\n"
+	"C * U perm.6 yes forever\n"
+	"C * U perm.8 yes forever\n"
+	"C * U perm.10 yes forever\n"
+	"C * U perm.12 yes forever\n"
+	"C * U perm.14 yes forever\n"
+	"C * U perm.16 yes forever\n"
+	"C * U perm.18 yes forever\n"
+	"D * U * yes forever\n"
+	"D * U perm.3 no forever\n";
+
+static void *serve(void *closure)
+{
+	cyn_server_serve(closure);
+	return NULL;
+}
+
+/* the key i is for the client C or D, alternatively by 3 */
+static void make_keys(cynagora_key_t *keys, char names[][12])
+{
+	unsigned i;
+
+	for (i = 0 ; i < COUNT ; i++) {
+		snprintf(names[i], sizeof names[i], "perm.%u", i % 20);
+		keys[i].client = (i / 3) & 1 ? "D" : "C";
+		keys[i].session = "S";
+		keys[i].user = "U";
+		keys[i].permission = names[i];
+	}
+}
+
+static int expected(const cynagora_key_t *key, unsigned i)
+{
+	if (*key->client == 'C')
+		return !(i % 20 & 1);
+	return i % 20 != 3;
+}
+
+int main(int ac, char **av)
+{
+	static char names[COUNT][12];
+	cynagora_key_t keys[COUNT];
+	int results[COUNT];
+	char admin[64], check[64], agent[64];
+	cyn_server_t *server;
+	cynagora_t *client;
+	pthread_t thread;
+	FILE *file;
+	unsigned i, n;
+	int rc;
+
+	/* the server */
+	mkdtemp(dir);
+	snprintf(admin, sizeof admin, "unix:%s/admin", dir);
+	snprintf(check, sizeof check, "unix:%s/check", dir);
+	snprintf(agent, sizeof agent, "unix:%s/agent", dir);
+	signal(SIGPIPE, SIG_IGN);
+	expect(db_open(dir) == 0, "database");
+	file = fmemopen((void*)rules, sizeof rules - 1, "r");
+	expect(file && db_import_file(file, "rules") == 0, "rules");
+	fclose(file);
+	cyn_changeid_reset();
+	rc = cyn_server_create(&server, admin, check, agent);
+	expect(rc == 0, "server");
+	if (rc < 0)
+		return report();
+	pthread_create(&thread, NULL, serve, server);
+
+	/* the keys are checked in batches of the same subject */
+	make_keys(keys, names);
+	rc = cynagora_create(&client, cynagora_Check, 0, check);
+	expect(rc == 0, "client");
+	rc = cynagora_check_many(client, keys, results, COUNT, 1);
+	for (n = i = 0 ; i < COUNT ; i++)
+		n += results[i] == expected(&keys[i], i);
+	expect(rc == 0 && n == COUNT, "check many");
+
+	/* the same results as the checks one by one */
+	for (n = i = 0 ; i < COUNT ; i++)
+		n += cynagora_check(client, &keys[i], 1) == results[i];
+	expect(n == COUNT, "same as check");
+
+	/* the results are cached */
+	cynagora_destroy(client);
+	cynagora_create(&client, cynagora_Check, 1000, check);
+	cynagora_check_many(client, keys, results, COUNT, 0);
+	memset(results, 0xff, sizeof results);
+	rc = cynagora_check_many(client, keys, results, COUNT, 0);
+	for (n = i = 0 ; i < COUNT ; i++)
+		n += results[i] == expected(&keys[i], i);
+	expect(rc == 0 && n == COUNT, "cached");
+
+	/* empty batches */
+	expect(cynagora_check_many(client, keys, results, 0, 1) == 0, "empty");
+	cynagora_destroy(client);
+
+	return report();
+}
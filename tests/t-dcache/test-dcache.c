@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../../src/data.h"
+#include "../../src/dcache.h"
+#include "../test.h"
+
+#define THREADS 8
+#define LOOPS   20000
+
+static void put(const char *client, const char *perm, bool resolved, const char *value, time_t expire)
+{
+	data_key_t key = { .client = client, .session = "session", .user = "user", .permission = perm };
+	data_value_t val = { .value = value, .expire = expire };
+	dcache_put(dcache_generation(), &key, resolved, &val);
+}
+
+static const char *get(const char *client, const char *perm, bool resolved, char *buffer)
+{
+	data_key_t key = { .client = client, .session = "session", .user = "user", .permission = perm };
+	data_value_t val;
+	return dcache_get(&key, resolved, &val, buffer) ? val.value : NULL;
+}
+
+static bool is(const char *client, const char *perm, bool resolved, const char *value)
+{
+	char buffer[DCACHE_VALUE_SIZE];
+	const char *v = get(client, perm, resolved, buffer);
+	return value ? v && !strcmp(v, value) : !v;
+}
+
+static void *run(void *arg)
+{
+	char client[20], value[20], buffer[DCACHE_VALUE_SIZE];
+	const char *v;
+	long i, n = (long)arg, bad = 0;
+
+	for (i = 0 ; i < LOOPS ; i++) {
+		snprintf(client, sizeof client, "c%ld", (i * 7 + n) % 1000);
+		snprintf(value, sizeof value, "v%ld", (i * 7 + n) % 1000);
+		v = get(client, "perm", false, buffer);
+		if (!v)
+			put(client, "perm", false, value, 0);
+		else if (strcmp(v, value))
+			bad++;
+		if (n == 0 && i % 1000 == 0)
+			dcache_clear();
+	}
+	return (void*)bad;
+}
+
+int main(int ac, char **av)
+{
+	char client[20];
+	unsigned long hits, misses;
+	unsigned count, size;
+	uint32_t gen;
+	pthread_t tids[THREADS];
+	void *bad;
+	long i, total;
+
+	dcache_set_size(64);
+
+	/* put and get */
+	put("A", "perm", false, "yes", 0);
+	expect(is("A", "perm", false, "yes"), "get");
+	expect(is("A", "PERM", false, "yes"), "permission ignoring case");
+	expect(is("A", "perm", true, NULL), "not resolved");
+	put("A", "perm", true, "no", 0);
+	expect(is("A", "perm", true, "no") && is("A", "perm", false, "yes"), "resolved");
+	put("A", "perm", false, "no", 0);
+	expect(is("A", "perm", false, "no"), "replace");
+
+	/* expiration */
+	put("B", "perm", false, "yes", time(NULL) - 1);
+	expect(is("B", "perm", false, NULL), "expired not recorded");
+	put("B", "perm", false, "yes", -1);
+	expect(is("B", "perm", false, "yes"), "never expiring recorded");
+
+	/* generation */
+	gen = dcache_generation();
+	dcache_clear();
+	expect(is("A", "perm", false, NULL), "clear");
+	expect(dcache_generation() != gen, "generation changed");
+	{
+		data_key_t key = { .client = "C", .session = "session", .user = "user", .permission = "perm" };
+		data_value_t val = { .value = "yes", .expire = 0 };
+		dcache_put(gen, &key, false, &val);
+	}
+	expect(is("C", "perm", false, NULL), "stale put ignored");
+
+	/* eviction keeps the size and the used entries */
+	put("hot", "perm", false, "yes", 0);
+	for (i = 0 ; i < 10000 ; i++) {
+		snprintf(client, sizeof client, "cold%ld", i);
+		put(client, "perm", false, "no", 0);
+		is("hot", "perm", false, "yes");
+	}
+	dcache_stats(&hits, &misses, &count, &size);
+	printf("  hits %lu misses %lu count %u size %u\n", hits, misses, count, size);
+	expect(count <= size + size / 2, "size kept");
+	expect(is("hot", "perm", false, "yes"), "used entry kept");
+
+	/* disabled */
+	dcache_set_size(0);
+	put("A", "perm", false, "yes", 0);
+	expect(is("A", "perm", false, NULL), "disabled");
+
+	/* concurrent use */
+	dcache_set_size(256);
+	for (i = 0 ; i < THREADS ; i++)
+		pthread_create(&tids[i], NULL, run, (void*)i);
+	for (total = i = 0 ; i < THREADS ; i++) {
+		pthread_join(tids[i], &bad);
+		total += (long)bad;
+	}
+	expect(total == 0, "concurrent use");
+
+	return report();
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../../src/data.h"
+#include "../../src/anydb.h"
+#include "../../src/memdb.h"
+#include "../test.h"
+
+static void set(anydb_t *db, const char *client, time_t expire)
+{
+	data_key_t key = { .client = client, .session = "*", .user = "user", .permission = "perm" };
+	data_value_t value = { "yes", expire };
+	anydb_set(db, &key, &value);
+}
+
+static bool has(anydb_t *db, const char *client)
+{
+	data_key_t key = { .client = client, .session = "session", .user = "user", .permission = "perm" };
+	data_value_t value;
+	return anydb_test(db, &key, &value) != 0;
+}
+
+static void check(anydb_t *db, const char *name, bool expired)
+{
+	char what[100];
+
+	snprintf(what, sizeof what, "%s: forever", name);
+	expect(has(db, "forever"), what);
+	snprintf(what, sizeof what, "%s: -forever", name);
+	expect(has(db, "noforever"), what);
+	snprintf(what, sizeof what, "%s: soon", name);
+	expect(has(db, "soon") != expired, what);
+	snprintf(what, sizeof what, "%s: -soon", name);
+	expect(has(db, "nosoon") != expired, what);
+	snprintf(what, sizeof what, "%s: past", name);
+	expect(!has(db, "past"), what);
+}
+
+/* set the expirations of the rules soon and nosoon to now, as if the time passed */
+static void pass(anydb_t *db, time_t now)
+{
+	set(db, "soon", now);
+	set(db, "nosoon", -now - 1);
+}
+
+int main(int ac, char **av)
+{
+	anydb_t *db, *copy;
+	time_t now = time(NULL);
+
+	memdb_create(&db);
+	set(db, "forever", 0);
+	set(db, "noforever", -1);
+	set(db, "soon", now + 100);
+	set(db, "nosoon", -(now + 100) - 1);
+	set(db, "past", now - 5);
+
+	check(db, "initial", false);
+	memdb_create(&copy);
+	anydb_copy(copy, db);
+	check(copy, "copy", false);
+	expect(anydb_expire(db) == now + 100, "next expiration");
+
+	pass(db, now);
+	pass(copy, now);
+	check(db, "after expiration", true);
+	check(copy, "copy after expiration", true);
+	expect(anydb_expire(db) == 0, "no next expiration");
+	anydb_destroy(copy);
+	memdb_create(&copy);
+	anydb_copy(copy, db);
+	check(copy, "copy of expired", true);
+
+	anydb_destroy(copy);
+	anydb_destroy(db);
+	return report();
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../../src/fbuf.h"
+#include "../test.h"
+
+#define ID "test-fbuf\n"
+#define SIZE 20000
+
+static char dir[] = "/tmp/test-fbuf.XXXXXX";
+static char path[64];
+static fbuf_t fb;
+static char expected[4 * SIZE];
+
+static void put(char c, uint32_t count, uint32_t offset)
+{
+	memset(&expected[offset], c, count);
+	fbuf_put(&fb, &expected[offset], count, offset);
+}
+
+static void shrink(uint32_t used)
+{
+	fbuf_touch(&fb, used);
+	fb.used = used;
+}
+
+static bool same(uint32_t used)
+{
+	return fb.used == used && !memcmp(fb.buffer, expected, used);
+}
+
+static bool same_file(uint32_t used)
+{
+	static char buffer[sizeof expected];
+	ssize_t rcs;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	rcs = read(fd, buffer, sizeof buffer);
+	close(fd);
+	return rcs == (ssize_t)used && !memcmp(buffer, expected, used);
+}
+
+static bool reopen(uint32_t used)
+{
+	fbuf_close(&fb);
+	return fbuf_open_identify(&fb, fbuf_type_Rules, path, NULL, ID, sizeof ID - 1) == 0
+		&& same(used);
+}
+
+int main(int ac, char **av)
+{
+	int rc;
+
+	mkdtemp(dir);
+	snprintf(path, sizeof path, "%s/file", dir);
+
+	/* creation */
+	rc = fbuf_open_identify(&fb, fbuf_type_Rules, path, NULL, ID, sizeof ID - 1);
+	memcpy(expected, ID, sizeof ID - 1);
+	expect(rc == 0 && same(sizeof ID - 1), "create");
+	put('a', SIZE, sizeof ID - 1);
+	rc = fbuf_sync(&fb);
+	expect(rc == 0 && same_file(SIZE + sizeof ID - 1), "sync");
+	expect(reopen(SIZE + sizeof ID - 1), "reopen");
+
+	/* modification in place then growth */
+	put('b', 10, 5000);
+	put('c', 10, 15000);
+	rc = fbuf_ensure_capacity(&fb, 4 * SIZE);
+	expect(rc == 0 && same(SIZE + sizeof ID - 1), "grow keeps the modifications");
+	put('d', 2 * SIZE, SIZE);
+	rc = fbuf_sync(&fb);
+	expect(rc == 0 && same_file(3 * SIZE), "sync of the modifications");
+	expect(reopen(3 * SIZE), "reopen of the modifications");
+
+	/* reload discards the unsaved bytes */
+	fbuf_put(&fb, "XXXXXXXXXX", 10, 2 * SIZE);
+	fbuf_append(&fb, "YYYYYYYYYY", 10);
+	rc = fbuf_reload(&fb);
+	expect(rc == 0 && same(3 * SIZE), "reload");
+
+	/* shrink then append */
+	shrink(SIZE);
+	rc = fbuf_sync(&fb);
+	expect(rc == 0 && same(SIZE) && same_file(SIZE), "shrink");
+	put('e', SIZE, SIZE);
+	rc = fbuf_sync(&fb);
+	expect(rc == 0 && same(2 * SIZE) && same_file(2 * SIZE), "append after shrink");
+	expect(reopen(2 * SIZE), "reopen after shrink");
+
+	/* backup and recover */
+	rc = fbuf_backup(&fb);
+	expect(rc == 0, "backup");
+	fbuf_put(&fb, "ZZZZZZZZZZ", 10, 100);
+	fbuf_append(&fb, "ZZZZZZZZZZ", 10);
+	fbuf_sync(&fb);
+	rc = fbuf_recover(&fb);
+	expect(rc == 0 && same(2 * SIZE), "recover");
+	rc = fbuf_sync(&fb);
+	expect(rc == 0 && same_file(2 * SIZE), "sync of the recovered content");
+	expect(reopen(2 * SIZE), "reopen of the recovered content");
+
+	/* identification */
+	fbuf_close(&fb);
+	rc = fbuf_open_identify(&fb, fbuf_type_Rules, path, NULL, "bad-id\n", 7);
+	expect(rc == -ENOKEY, "bad identification");
+
+	unlink(path);
+	strcat(path, "~");
+	unlink(path);
+	rmdir(dir);
+	return report();
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../src/data.h"
+#include "../../src/anydb.h"
+#include "../../src/filedb.h"
+#include "../test.h"
+
+static char dir[] = "/tmp/test-filedb.XXXXXX";
+
+static void path_of(char *path, size_t size, const char *name)
+{
+	snprintf(path, size, "%s/cynagora.%s", dir, name);
+}
+
+static void set(anydb_t *db, const char *client, const char *permission, const char *value)
+{
+	data_key_t key = { .client = client, .session = "*", .user = "user", .permission = permission };
+	data_value_t val = { value, 0 };
+	anydb_set(db, &key, &val);
+}
+
+static const char *get(anydb_t *db, const char *client, const char *permission)
+{
+	data_key_t key = { .client = client, .session = "session", .user = "user", .permission = permission };
+	data_value_t value;
+	return anydb_test(db, &key, &value) ? value.value : "";
+}
+
+static void count_cb(void *closure, const data_key_t *key, const data_value_t *value)
+{
+	(*(int*)closure)++;
+}
+
+static int count(anydb_t *db)
+{
+	data_key_t key = { .client = "#", .session = "#", .user = "#", .permission = "#" };
+	int n = 0;
+	anydb_for_all(db, count_cb, &n, &key);
+	return n;
+}
+
+/* replace in the file of names 'from' with 'to' of the same length */
+static bool patch_names(const char *from, const char *to)
+{
+	char path[100], *map, *found;
+	struct stat st;
+	int fd;
+
+	path_of(path, sizeof path, "names");
+	fd = open(path, O_RDWR);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return false;
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	found = memmem(map, (size_t)st.st_size, from, strlen(from) + 1);
+	if (found)
+		memcpy(found, to, strlen(to));
+	munmap(map, (size_t)st.st_size);
+	return found != NULL;
+}
+
+int main(int ac, char **av)
+{
+	anydb_t *db;
+	char path[100];
+
+	mkdtemp(dir);
+
+	/* database whose names are patched to have permissions only differing by case */
+	expect(filedb_create(&db, dir, "cynagora") == 0, "creation");
+	anydb_transaction(db, Anydb_Transaction_Start);
+	set(db, "A", "perm.x", "first");
+	set(db, "A", "qerm.x", "second");
+	set(db, "B", "qerm.x", "third");
+	set(db, "A", "perm.y", "fourth");
+	anydb_transaction(db, Anydb_Transaction_Commit);
+	anydb_sync(db);
+	expect(count(db) == 4, "rules");
+	anydb_destroy(db);
+	expect(patch_names("qerm.x", "PERM.X"), "patch");
+
+	/* open normalizes the permissions and removes the duplicates */
+	expect(filedb_create(&db, dir, "cynagora") == 0, "open");
+	expect(count(db) == 3, "duplicate removed");
+	expect(!strcmp(get(db, "A", "perm.x"), "first"), "first rule kept");
+	expect(!strcmp(get(db, "B", "PERM.x"), "third"), "rule normalized");
+	expect(!strcmp(get(db, "A", "perm.y"), "fourth"), "other rule kept");
+	anydb_sync(db);
+	anydb_destroy(db);
+
+	/* the normalization is saved */
+	expect(filedb_create(&db, dir, "cynagora") == 0, "reopen");
+	expect(count(db) == 3, "normalization saved");
+	expect(!strcmp(get(db, "B", "perm.X"), "third"), "normalized rule saved");
+	anydb_destroy(db);
+
+	path_of(path, sizeof path, "names");
+	unlink(path);
+	path_of(path, sizeof path, "rules");
+	unlink(path);
+	path_of(path, sizeof path, "wal");
+	unlink(path);
+	rmdir(dir);
+	return report();
+}
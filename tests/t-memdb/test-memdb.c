@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/data.h"
+#include "../../src/anydb.h"
+#include "../../src/memdb.h"
+#include "../test.h"
+
+static void set(anydb_t *db, const char *client, const char *value)
+{
+	data_key_t key = { .client = client, .session = "*", .user = "user", .permission = "perm" };
+	data_value_t val = { value, 0 };
+	anydb_set(db, &key, &val);
+}
+
+static const char *get(anydb_t *db, const char *client)
+{
+	data_key_t key = { .client = client, .session = "session", .user = "user", .permission = "perm" };
+	data_value_t value;
+	return anydb_test(db, &key, &value) ? value.value : "";
+}
+
+static void check(anydb_t *db, const char *client, const char *value, const char *what)
+{
+	const char *v = get(db, client);
+	printf("  %s: %s\n", client, v ?: "NULL");
+	expect(v && !strcmp(v, value), what);
+}
+
+int main(int ac, char **av)
+{
+	anydb_t *db;
+
+	memdb_create(&db);
+
+	/* commit a value, then change it in a committed transaction */
+	anydb_transaction(db, Anydb_Transaction_Start);
+	set(db, "A", "first");
+	anydb_transaction(db, Anydb_Transaction_Commit);
+	anydb_transaction(db, Anydb_Transaction_Start);
+	set(db, "A", "second");
+	anydb_transaction(db, Anydb_Transaction_Commit);
+	check(db, "A", "second", "commit of change");
+
+	/* free the string of the first value */
+	anydb_cleanup(db);
+
+	/* change and cancel, the new strings reuse the freed one */
+	anydb_transaction(db, Anydb_Transaction_Start);
+	set(db, "A", "third");
+	set(db, "B", "fourth");
+	check(db, "A", "third", "change in transaction");
+	anydb_transaction(db, Anydb_Transaction_Cancel);
+	check(db, "A", "second", "cancel of change after commit and gc");
+	check(db, "B", "", "cancel of addition");
+
+	/* the strings are still consistent */
+	anydb_cleanup(db);
+	anydb_transaction(db, Anydb_Transaction_Start);
+	set(db, "B", "fifth");
+	anydb_transaction(db, Anydb_Transaction_Commit);
+	check(db, "A", "second", "value after gc");
+	check(db, "B", "fifth", "addition after gc");
+
+	/* change and drop cancelled */
+	anydb_transaction(db, Anydb_Transaction_Start);
+	set(db, "A", "sixth");
+	set(db, "A", "seventh");
+	anydb_transaction(db, Anydb_Transaction_Commit);
+	anydb_cleanup(db);
+	anydb_transaction(db, Anydb_Transaction_Start);
+	set(db, "A", "eighth");
+	{
+		data_key_t key = { .client = "A", .session = "*", .user = "user", .permission = "perm" };
+		anydb_drop(db, &key);
+	}
+	anydb_transaction(db, Anydb_Transaction_Cancel);
+	check(db, "A", "seventh", "cancel of change and drop");
+
+	anydb_destroy(db);
+	return report();
+}
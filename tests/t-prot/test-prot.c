@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../../src/prot.h"
+#include "../test.h"
+
+static int sv[2];
+static unsigned char raw[100];
+
+/* write the records put in 'prot' and read their raw bytes */
+static ssize_t sent(prot_t *prot)
+{
+	if (prot_write(prot, sv[0]) < 0)
+		return -1;
+	return read(sv[1], raw, sizeof raw);
+}
+
+/* receive in 'prot' the 'length' bytes of 'data' */
+static void receive(prot_t *prot, const void *data, size_t length)
+{
+	if (write(sv[0], data, length) == (ssize_t)length)
+		prot_read(prot, sv[1]);
+}
+
+/* get the record received by 'prot' and compare it to 'count' 'expected' fields */
+static bool got(prot_t *prot, unsigned count, const char **expected)
+{
+	const char **fields;
+	unsigned i;
+	int rc;
+
+	rc = prot_get(prot, &fields);
+	if (rc != (int)count)
+		return false;
+	for (i = 0 ; i < count ; i++)
+		if (strcmp(fields[i], expected[i]))
+			return false;
+	prot_next(prot);
+	return true;
+}
+
+int main(int ac, char **av)
+{
+	static const unsigned char frame1[] = {
+		12,
+		0x01, 5, 'h', 'e', 'l', 'l', 'o',	/* DEFINE slot 0 */
+		0x02,					/* REF slot 0 */
+		0xab, 0x01,				/* NUMBER 42 */
+		0x04, 'x'				/* LITERAL */
+	};
+	static const unsigned char frame2[] = { 1, 0x02 };
+	static const unsigned char badref[] = { 1, 0x06 };
+	static const unsigned char baddefine[] = { 3, 0x81, 0x01, 0 };
+	static const unsigned char toolong[] = { 0x80, 0x80, 0x08 };
+	const char *record1[] = { "hello", "hello", "42", "x" };
+	const char *record2[] = { "hello" };
+	const char *many[25];
+	prot_t *a, *b;
+	ssize_t n;
+	unsigned i;
+
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	prot_create(&a);
+	prot_create(&b);
+
+	/* text records */
+	prot_putx(a, "hello", "x y", NULL);
+	n = sent(a);
+	expect(n == 11 && !memcmp(raw, "hello x\\ y\n", 11), "text put");
+	receive(b, raw, (size_t)n);
+	expect(got(b, 2, (const char*[]){ "hello", "x y" }), "text get");
+
+	/* binary frames, interned strings are defined then referenced */
+	expect(prot_set_binary(a, 1) == 0 && prot_set_binary(b, 1) == 0 && prot_is_binary(a), "binary");
+	prot_put(a, 4, record1);
+	n = sent(a);
+	expect(n == sizeof frame1 && !memcmp(raw, frame1, sizeof frame1), "define");
+	prot_put(a, 1, record2);
+	n = sent(a);
+	expect(n == sizeof frame2 && !memcmp(raw, frame2, sizeof frame2), "reference");
+	receive(b, frame1, sizeof frame1);
+	expect(got(b, 4, record1), "get define");
+	receive(b, frame2, sizeof frame2);
+	expect(got(b, 1, record2), "get reference");
+
+	/* cancelled definitions are forgotten */
+	prot_put_field(a, "world");
+	prot_put_cancel(a);
+	prot_putx(a, "world", NULL);
+	n = sent(a);
+	expect(n == 8 && (raw[1] & 3) == 1, "cancelled define");
+
+	/* frames are received in parts */
+	receive(b, frame1, 5);
+	expect(prot_get(b, NULL) == -EAGAIN, "partial frame");
+	receive(b, frame1 + 5, sizeof frame1 - 5);
+	expect(got(b, 4, record1), "get of parts");
+
+	/* the fields exceeding the maximum are ignored */
+	for (i = 0 ; i < 25 ; i++)
+		many[i] = "x";
+	prot_put(a, 25, many);
+	n = sent(a);
+	receive(b, raw, (size_t)n);
+	expect(got(b, 20, many), "maximum of fields");
+
+	/* invalid frames */
+	receive(b, badref, sizeof badref);
+	expect(prot_get(b, NULL) == -EBADMSG, "bad reference");
+	prot_reset(b);
+	prot_set_binary(b, 1);
+	receive(b, baddefine, sizeof baddefine);
+	expect(prot_get(b, NULL) == -EBADMSG, "bad define");
+	prot_reset(b);
+	prot_set_binary(b, 1);
+	receive(b, toolong, sizeof toolong);
+	expect(prot_get(b, NULL) == -EMSGSIZE, "frame too long");
+
+	prot_destroy(a);
+	prot_destroy(b);
+	close(sv[0]);
+	close(sv[1]);
+	return report();
+}
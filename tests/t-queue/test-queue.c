@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../src/data.h"
+#include "../../src/db.h"
+#include "../../src/queue.h"
+#include "../test.h"
+
+static char dir[] = "/tmp/test-queue.XXXXXX";
+
+static void remove_file(const char *name)
+{
+	char path[100];
+
+	snprintf(path, sizeof path, "%s/cynagora.%s", dir, name);
+	unlink(path);
+}
+
+static void set(const char *client, const char *permission, const char *value)
+{
+	data_key_t key = { .client = client, .session = "*", .user = "user", .permission = permission };
+	data_value_t val = { .value = value, .expire = 0 };
+	queue_set(&key, &val);
+}
+
+static void drop(const char *client, const char *permission)
+{
+	data_key_t key = { .client = client, .session = "*", .user = "user", .permission = permission };
+	queue_drop(&key);
+}
+
+static void count_cb(void *closure, const data_key_t *key, const data_value_t *value)
+{
+	(*(int*)closure)++;
+}
+
+/* count of the rules of the database */
+static int count()
+{
+	data_key_t key = { .client = "#", .session = "#", .user = "#", .permission = "#" };
+	int n = 0;
+	db_for_all(count_cb, &n, &key);
+	return n;
+}
+
+/* value of the rule of the database for client and permission */
+static const char *get(const char *client, const char *permission)
+{
+	data_key_t key = { .client = client, .session = "session", .user = "user", .permission = permission };
+	data_value_t value;
+	return db_test(&key, &value) ? value.value : "";
+}
+
+static int play()
+{
+	int rc;
+
+	db_transaction_begin();
+	rc = queue_play();
+	db_transaction_end(rc == 0);
+	queue_clear();
+	return rc;
+}
+
+int main(int ac, char **av)
+{
+	int rc;
+
+	mkdtemp(dir);
+	expect(db_open(dir) == 0, "database");
+	expect(queue_size() == 0, "empty queue");
+
+	/* only the last operation of a key is applied */
+	set("A", "perm", "first");
+	set("B", "perm", "first");
+	set("A", "perm", "second");
+	drop("B", "perm");
+	set("C", "perm", "first");
+	drop("C", "perm");
+	set("C", "perm", "second");
+	expect(queue_size() > 0, "queued");
+	rc = play();
+	expect(rc == 0 && count() == 2, "superseded");
+	expect(!strcmp(get("A", "perm"), "second"), "last set");
+	expect(!strcmp(get("B", "perm"), ""), "last drop");
+	expect(!strcmp(get("C", "perm"), "second"), "set after drop");
+
+	/* the permissions of the keys ignore the case */
+	set("D", "Perm.X", "first");
+	set("D", "perm.x", "second");
+	rc = play();
+	expect(rc == 0 && count() == 3, "case of permission");
+	expect(!strcmp(get("D", "PERM.X"), "second"), "last of case");
+
+	/* runs of patterns are applied in order with the other operations */
+	set("E", "perm.1", "first");
+	set("E", "perm.2", "first");
+	drop("E", "#");
+	drop("D", "#");
+	set("E", "perm.3", "first");
+	drop("A", "#");
+	set("A", "perm", "third");
+	rc = play();
+	expect(rc == 0 && count() == 3, "patterns");
+	expect(!strcmp(get("E", "perm.1"), "") && !strcmp(get("E", "perm.2"), ""), "dropped by pattern");
+	expect(!strcmp(get("D", "perm.x"), ""), "dropped by run of patterns");
+	expect(!strcmp(get("E", "perm.3"), "first"), "set after pattern");
+	expect(!strcmp(get("A", "perm"), "third"), "set after pattern of same key");
+
+	/* a cleared queue plays nothing */
+	set("F", "perm", "first");
+	queue_clear();
+	rc = play();
+	expect(rc == 0 && count() == 3 && !strcmp(get("F", "perm"), ""), "cleared");
+
+	db_close();
+	remove_file("names");
+	remove_file("names~");
+	remove_file("rules");
+	remove_file("rules~");
+	rmdir(dir);
+	return report();
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/data.h"
+#include "../../src/anydb.h"
+#include "../../src/memdb.h"
+#include "../../src/ruleidx.h"
+#include "../test.h"
+
+/* the score of the rules of 'key' as computed by the database */
+static unsigned score(const anydb_key_t *key)
+{
+	return (key->session != AnyIdx_Wide ? 0x18u : 0u)
+	     + (key->user != AnyIdx_Wide ? 0x14u : 0u)
+	     + (key->client != AnyIdx_Wide ? 0x12u : 0u)
+	     + (key->permission != AnyIdx_Wide ? 0x11u : 0u);
+}
+
+/* the keys are sorted from the most specific and have their hashes */
+static bool sorted(const anydb_key_t *keys, const uint32_t *hashes, unsigned n)
+{
+	unsigned i;
+
+	for (i = 0 ; i < n ; i++)
+		if (hashes[i] != ruleidx_hash(&keys[i])
+		 || (i && score(&keys[i - 1]) <= score(&keys[i])))
+			return false;
+	return true;
+}
+
+static void set(anydb_t *db, const char *client, const char *session,
+		const char *user, const char *permission)
+{
+	data_key_t key = { .client = client, .session = session, .user = user, .permission = permission };
+	data_value_t value = { .value = NULL, .expire = 0 };
+	char name[5];
+
+	/* the value tells the fields that are not WIDE */
+	name[0] = *client == '*' ? '-' : 'c';
+	name[1] = *session == '*' ? '-' : 's';
+	name[2] = *user == '*' ? '-' : 'u';
+	name[3] = *permission == '*' ? '-' : 'p';
+	name[4] = 0;
+	value.value = name;
+	anydb_set(db, &key, &value);
+}
+
+int main(int ac, char **av)
+{
+	anydb_key_t key, keys[RuleIdx_Max_Hashes];
+	uint32_t hashes[RuleIdx_Max_Hashes], pos;
+	ruleidx_t ridx;
+	anydb_t *db;
+	data_key_t dkey;
+	data_value_t value;
+	const char *expected[] = {
+		"csup", "csu-", "-sup", "cs-p", "c-up", "-su-", "cs--", "-s-p",
+		"c-u-", "--up", "c--p", "-s--", "--u-", "c---", "---p", "----"
+	};
+	unsigned i, n, w;
+
+	/* a full key has the 16 combinations of WIDE */
+	key.client = 1;
+	key.session = 2;
+	key.user = 3;
+	key.permission = 4;
+	n = ruleidx_search_hashes(&key, keys, hashes);
+	expect(n == 16 && sorted(keys, hashes, n), "full key");
+
+	/* fields that can't match have only WIDE */
+	key.session = AnyIdx_None;
+	n = ruleidx_search_hashes(&key, keys, hashes);
+	for (i = 0 ; i < n && keys[i].session == AnyIdx_Wide ; i++);
+	expect(n == 8 && i == n && sorted(keys, hashes, n), "no session");
+	key.client = AnyIdx_Wide;
+	key.permission = AnyIdx_None;
+	n = ruleidx_search_hashes(&key, keys, hashes);
+	expect(n == 2 && sorted(keys, hashes, n), "only user");
+
+	/* chains of positions */
+	ruleidx_init(&ridx);
+	for (i = 0 ; i < 100 ; i++)
+		ruleidx_add(&ridx, i % 10);
+	for (n = 0, pos = ruleidx_first(&ridx, 3) ; pos != RuleIdx_End ; pos = ruleidx_next(&ridx, pos))
+		n += pos % 10 == 3;
+	expect(n == 10, "chain");
+	ruleidx_remove(&ridx, 3);
+	for (w = n = 0, pos = ruleidx_first(&ridx, 9) ; pos != RuleIdx_End ; pos = ruleidx_next(&ridx, pos))
+		w += pos == 3, n++;
+	expect(n == 10 && w == 1 && ridx.count == 99, "remove moves the last");
+	ruleidx_truncate(&ridx, 50);
+	for (w = n = 0, pos = ruleidx_first(&ridx, 9) ; pos != RuleIdx_End ; pos = ruleidx_next(&ridx, pos))
+		w += pos >= 50, n++;
+	expect(n == 6 && w == 0 && ridx.count == 50, "truncate");
+	ruleidx_destroy(&ridx);
+
+	/* the database finds the rules in order of specificity */
+	memdb_create(&db);
+	for (w = 0 ; w < 16 ; w++)
+		set(db, w & 1 ? "*" : "C", w & 2 ? "*" : "S", w & 4 ? "*" : "U", w & 8 ? "*" : "P");
+	dkey.client = "C";
+	dkey.session = "S";
+	dkey.user = "U";
+	dkey.permission = "P";
+	for (i = 0 ; i < 16 ; i++) {
+		if (!anydb_test(db, &dkey, &value) || strcmp(value.value, expected[i]))
+			break;
+		dkey.client = value.value[0] == 'c' ? "C" : "*";
+		dkey.session = value.value[1] == 's' ? "S" : "*";
+		dkey.user = value.value[2] == 'u' ? "U" : "*";
+		dkey.permission = value.value[3] == 'p' ? "P" : "*";
+		anydb_drop(db, &dkey);
+		dkey.client = "C";
+		dkey.session = "S";
+		dkey.user = "U";
+		dkey.permission = "P";
+	}
+	expect(i == 16 && !anydb_test(db, &dkey, &value), "order of the database");
+	anydb_destroy(db);
+
+	return report();
+}
@@ -26,6 +26,11 @@ int main (int ac, char **av)
 		printf("socketdir   %s\n", s.socketdir ?: "NULL");
 		printf("user        %s\n", s.user ?: "NULL");
 		printf("group       %s\n", s.group ?: "NULL");
+		printf("workers     %d\n", s.workers);
+		printf("highwater   %d\n", s.highwater);
+		printf("decisions   %d\n", s.decisioncache);
+		printf("cacheagents %s\n", s.cacheagents ? "yes" : "no");
+		printf("sharedcache %s\n", s.sharedcache ? "yes" : "no");
 		printf("\n");
 		i++;
 	}
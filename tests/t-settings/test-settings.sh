@@ -47,6 +47,14 @@ q() {
 		q "${front}" set "  $val" "xxx" "$@"
 		q "${front}" set "$val" "" "$@"
 		;;
+	int)
+		val="$1"
+		shift
+		q "${front}" set "$val" "4" "$@"
+		q "${front}" set "  $val" "-1" "$@"
+		q "${front}" set "$val" "z" "$@"
+		q "${front}" set "$val" "" "$@"
+		;;
 	esac
 }
 
@@ -65,6 +73,11 @@ b bool make-socket-dir
 b bool make-db-dir
 b bool own-db-dir
 b bool own-socket-dir
+b bool cache-agents
+b bool shared-cache
+b int workers
+b int high-water
+b int decision-cache
 
 if false; then
 b str dbdir \
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../../src/shcache.h"
+#include "../test.h"
+
+int main(int ac, char **av)
+{
+	shcache_t *server, *client;
+	char text[300], name[20];
+	time_t now;
+	int rc, i, n, m, fd;
+
+	now = time(NULL);
+
+	/* creation by the server and opening by the client */
+	rc = shcache_create(&server);
+	expect(rc == 0, "create");
+	fd = shcache_fd(server);
+	rc = shcache_open(&client, fd);
+	expect(rc == 0, "open");
+
+	/* the clients can't alter the file */
+	expect(write(fd, "x", 1) < 0, "not writable");
+	expect(mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) == MAP_FAILED, "not mappable for writing");
+	expect(ftruncate(fd, 4096) < 0, "not resizable");
+	expect(shcache_search(client, 1, "c", "s", "u", "p") == -ENOENT, "empty");
+
+	/* decisions */
+	shcache_clear(server, 1);
+	shcache_put(server, 1, "c", "s", "u", "p.yes", 1, 0);
+	shcache_put(server, 1, "c", "s", "u", "P.No", 0, 0);
+	shcache_put(server, 1, "c", "s", "u", "p.soon", 1, now + 100);
+	shcache_put(server, 1, "c", "s", "u", "p.past", 1, now - 100);
+	expect(shcache_search(client, 1, "c", "s", "u", "p.yes") == 1, "yes");
+	expect(shcache_search(client, 1, "c", "s", "u", "p.no") == 0, "no whatever the case");
+	expect(shcache_search(client, 1, "c", "s", "u", "p.soon") == 1, "not expired");
+	expect(shcache_search(client, 1, "c", "s", "u", "p.past") == -ENOENT, "expired");
+	expect(shcache_search(client, 1, "C", "s", "u", "p.yes") == -ENOENT, "client is case sensitive");
+	expect(shcache_search(client, 1, "c", "s", "u", "p.unknown") == -ENOENT, "unknown");
+	expect(shcache_search(client, 0, "c", "s", "u", "p.yes") == -ENOENT, "no changeid");
+
+	/* replacement */
+	shcache_put(server, 1, "c", "s", "u", "p.yes", 0, 0);
+	expect(shcache_search(client, 1, "c", "s", "u", "p.yes") == 0, "replace");
+
+	/* keys too long are not recorded */
+	memset(text, 'x', sizeof text - 1);
+	text[sizeof text - 1] = 0;
+	shcache_put(server, 1, "c", "s", "u", text, 1, 0);
+	expect(shcache_search(client, 1, "c", "s", "u", text) == -ENOENT, "too long");
+
+	/* many decisions, some can be replaced but none can be wrong */
+	for (i = 0 ; i < 1000 ; i++) {
+		snprintf(name, sizeof name, "p.%d", i);
+		shcache_put(server, 1, "c", "s", "u", name, i & 1, 0);
+	}
+	for (n = m = i = 0 ; i < 1000 ; i++) {
+		snprintf(name, sizeof name, "p.%d", i);
+		rc = shcache_search(client, 1, "c", "s", "u", name);
+		n += rc == (i & 1);
+		m += rc != (i & 1) && rc != -ENOENT;
+	}
+	expect(n > 900 && m == 0, "many");
+
+	/* changing the changeid clears */
+	shcache_clear(server, 2);
+	expect(shcache_search(client, 1, "c", "s", "u", "p.no") == -ENOENT, "old changeid");
+	expect(shcache_search(client, 2, "c", "s", "u", "p.no") == -ENOENT, "cleared");
+	shcache_put(server, 1, "c", "s", "u", "p.no", 0, 0);
+	expect(shcache_search(client, 2, "c", "s", "u", "p.no") == -ENOENT, "stale put");
+	shcache_put(server, 2, "c", "s", "u", "p.no", 0, 0);
+	expect(shcache_search(client, 2, "c", "s", "u", "p.no") == 0, "put after clear");
+
+	/* destruction invalidates for clients */
+	shcache_destroy(server);
+	expect(shcache_search(client, 2, "c", "s", "u", "p.no") == -ENOENT, "destroyed");
+	shcache_close(client);
+
+	/* only valid files are opened */
+	fd = memfd_create("test", 0);
+	expect(shcache_open(&client, fd) == -EINVAL, "invalid file");
+	close(fd);
+	expect(shcache_open(&client, -1) < 0, "not a file");
+
+	return report();
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "../../src/sortidx.h"
+#include "../test.h"
+
+#define COUNT 5000
+#define PRIME 5003
+
+static sortidx_t sidx;
+
+/* the items are compared by value */
+static int cmp(void *closure, uint32_t a, uint32_t b)
+{
+	return a < b ? -1 : a > b;
+}
+
+static int cmpkey(void *closure, const void *key, uint32_t item)
+{
+	return cmp(closure, *(const uint32_t*)key, item);
+}
+
+/* the range [key[0], key[1]) */
+static int cmprange(void *closure, const void *key, uint32_t item)
+{
+	const uint32_t *range = key;
+	return item < range[0] ? 1 : -(item >= range[1]);
+}
+
+/* the i-th item added, a permutation of [0, COUNT) */
+static uint32_t nth(uint32_t i)
+{
+	uint32_t v = i;
+	do
+		v = (v * 1021) % PRIME;
+	while (v >= COUNT);
+	return v;
+}
+
+static bool has(uint32_t value)
+{
+	uint32_t item;
+	return sortidx_search(&sidx, &value, &item) && item == value;
+}
+
+/* are the 'n' first items found and the next ones not found? */
+static bool has_first(uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < COUNT ; i++)
+		if (has(nth(i)) != (i < n))
+			return false;
+	return true;
+}
+
+static uint32_t scanned, previous;
+static bool ordered;
+
+static void scan_cb(void *closure, uint32_t item)
+{
+	ordered = ordered && (!scanned || previous < item);
+	previous = item;
+	scanned++;
+}
+
+int main(int ac, char **av)
+{
+	uint32_t i, n, range[2];
+	bool ok;
+
+	sortidx_init(&sidx, cmp, cmpkey, NULL);
+	expect(!has(0), "empty");
+
+	/* search while the runs are built */
+	for (ok = true, n = 0 ; n < 70 ; n++) {
+		ok = ok && sortidx_add(&sidx, nth(n)) == 0;
+		ok = ok && has_first(n + 1);
+	}
+	expect(ok, "search in runs");
+
+	/* many items then compaction */
+	for (ok = true ; n < COUNT ; n++)
+		ok = ok && sortidx_add(&sidx, nth(n)) == 0;
+	expect(ok && has_first(COUNT), "search many");
+	sortidx_compact(&sidx);
+	expect(sidx.merged == COUNT && has_first(COUNT), "search compacted");
+	for (ok = true, i = 1 ; i < COUNT ; i++)
+		ok = ok && sidx.items[i - 1] < sidx.items[i];
+	expect(ok, "compacted is sorted");
+
+	/* scan of ranges */
+	range[0] = 1000;
+	range[1] = 1100;
+	scanned = 0;
+	ordered = true;
+	sortidx_scan(&sidx, cmprange, range, scan_cb, NULL);
+	expect(scanned == 100 && ordered && previous == 1099, "scan");
+	range[0] = range[1] = COUNT;
+	scanned = 0;
+	sortidx_scan(&sidx, cmprange, range, scan_cb, NULL);
+	expect(scanned == 0, "scan of empty range");
+
+	/* scan merges the runs */
+	for (n = COUNT ; n < COUNT + 10 ; n++)
+		sortidx_add(&sidx, n);
+	range[0] = COUNT - 5;
+	range[1] = COUNT + 5;
+	scanned = 0;
+	ordered = true;
+	sortidx_scan(&sidx, cmprange, range, scan_cb, NULL);
+	expect(scanned == 10 && ordered, "scan of runs");
+
+	/* clear */
+	sortidx_clear(&sidx);
+	expect(!has(nth(0)), "cleared");
+	sortidx_add(&sidx, 7);
+	expect(has(7) && !has(nth(0)), "add after clear");
+
+	sortidx_destroy(&sidx);
+	return report();
+}
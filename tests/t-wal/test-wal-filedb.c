@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../../src/data.h"
+#include "../../src/anydb.h"
+#include "../../src/filedb.h"
+#include "../test.h"
+
+static char dir[] = "/tmp/test-wal-filedb.XXXXXX";
+
+static off_t size_of(const char *name)
+{
+	char path[100];
+	struct stat st;
+
+	snprintf(path, sizeof path, "%s/cynagora.%s", dir, name);
+	return stat(path, &st) < 0 ? -1 : st.st_size;
+}
+
+static void remove_file(const char *name)
+{
+	char path[100];
+
+	snprintf(path, sizeof path, "%s/cynagora.%s", dir, name);
+	unlink(path);
+}
+
+static void commit(anydb_t *db, const char *client, bool add)
+{
+	data_key_t key = { .client = client, .session = "*", .user = "user", .permission = "perm" };
+	data_value_t value = { "yes", 0 };
+
+	anydb_transaction(db, Anydb_Transaction_Start);
+	if (add)
+		anydb_set(db, &key, &value);
+	else
+		anydb_drop(db, &key);
+	anydb_transaction(db, Anydb_Transaction_Commit);
+	anydb_sync(db);
+	anydb_flush(db);
+}
+
+static bool has(anydb_t *db, const char *client)
+{
+	data_key_t key = { .client = client, .session = "session", .user = "user", .permission = "perm" };
+	data_value_t value;
+	return anydb_test(db, &key, &value) != 0;
+}
+
+int main(int ac, char **av)
+{
+	anydb_t *db;
+	off_t idlen;
+	char name[20];
+	int i, status;
+
+	mkdtemp(dir);
+
+	/* create the database */
+	expect(filedb_create(&db, dir, "cynagora") == 0, "creation");
+	anydb_destroy(db);
+	idlen = size_of("wal");
+
+	/* commits of a process exiting without closing the database */
+	if (fork() == 0) {
+		filedb_create(&db, dir, "cynagora");
+		for (i = 0 ; i < 100 ; i++) {
+			snprintf(name, sizeof name, "client%d", i);
+			commit(db, name, true);
+		}
+		for (i = 0 ; i < 100 ; i += 2) {
+			snprintf(name, sizeof name, "client%d", i);
+			commit(db, name, false);
+		}
+		_exit(0);
+	}
+	wait(&status);
+	expect(size_of("wal") > idlen, "commits are logged");
+
+	/* open replays the log and checkpoints */
+	expect(filedb_create(&db, dir, "cynagora") == 0, "open with log");
+	expect(size_of("wal") == idlen, "checkpoint after replay");
+	for (i = 0 ; i < 100 ; i++) {
+		snprintf(name, sizeof name, "client%d", i);
+		if (has(db, name) != (i & 1))
+			break;
+	}
+	expect(i == 100, "replayed rules");
+	anydb_destroy(db);
+
+	/* the checkpointed files hold the rules */
+	expect(filedb_create(&db, dir, "cynagora") == 0, "open after checkpoint");
+	expect(has(db, "client1") && !has(db, "client2"), "checkpointed rules");
+	anydb_destroy(db);
+
+	remove_file("names");
+	remove_file("rules");
+	remove_file("wal");
+	rmdir(dir);
+	return report();
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../../src/fbuf.h"
+#include "../../src/wal.h"
+#include "../test.h"
+
+#define ID "test-wal\n"
+
+static char dir[] = "/tmp/test-wal.XXXXXX";
+static char path[3][64];
+static fbuf_t fbufs[2];
+static fbuf_t *pfbufs[2] = { &fbufs[0], &fbufs[1] };
+static wal_t wal;
+
+static int open_all(bool replay)
+{
+	int rc = fbuf_open(&fbufs[0], fbuf_type_Names, path[0], NULL)
+		?: fbuf_open(&fbufs[1], fbuf_type_Rules, path[1], NULL)
+		?: wal_open(&wal, path[2], ID, sizeof ID - 1);
+	return rc ?: replay ? wal_replay(&wal, pfbufs, 2) : 0;
+}
+
+static void close_all()
+{
+	wal_close(&wal);
+	fbuf_close(&fbufs[0]);
+	fbuf_close(&fbufs[1]);
+}
+
+static void reset_all()
+{
+	close_all();
+	unlink(path[0]);
+	unlink(path[1]);
+	unlink(path[2]);
+}
+
+static void put(int i, char c, uint32_t count, uint32_t offset)
+{
+	char *buffer = malloc(count);
+	memset(buffer, c, count);
+	fbuf_put(&fbufs[i], buffer, count, offset);
+	free(buffer);
+}
+
+static void shrink(int i, uint32_t used)
+{
+	fbuf_touch(&fbufs[i], used);
+	fbufs[i].used = used;
+}
+
+static void commit()
+{
+	wal_append(&wal, pfbufs, 2);
+	wal_flush(&wal);
+}
+
+static bool same(int i, const char *expected, uint32_t used)
+{
+	return fbufs[i].used == used && !memcmp(fbufs[i].buffer, expected, used);
+}
+
+int main(int ac, char **av)
+{
+	char *exp0, *exp1;
+	uint32_t size;
+	int rc, fd;
+
+	mkdtemp(dir);
+	snprintf(path[0], sizeof path[0], "%s/names", dir);
+	snprintf(path[1], sizeof path[1], "%s/rules", dir);
+	snprintf(path[2], sizeof path[2], "%s/wal", dir);
+	exp0 = malloc(10000);
+	exp1 = malloc(10000);
+
+	/* replay of the frames */
+	open_all(false);
+	put(0, 'a', 6000, 0);
+	put(1, 'b', 100, 0);
+	commit();
+	put(0, 'c', 10, 5000);
+	put(1, 'd', 50, 100);
+	commit();
+	memcpy(exp0, fbufs[0].buffer, fbufs[0].used);
+	memcpy(exp1, fbufs[1].buffer, fbufs[1].used);
+	close_all();
+	rc = open_all(true);
+	expect(rc == 0, "replay");
+	expect(same(0, exp0, 6000) && same(1, exp1, 150), "replayed content");
+
+	/* a frame with a bad checksum is ignored and removed */
+	size = wal.size;
+	put(0, 'e', 10, 0);
+	commit();
+	close_all();
+	fd = open(path[2], O_WRONLY);
+	expect(pwrite(fd, "!", 1, size + 20) == 1, "corruption of the frame");
+	close(fd);
+	rc = open_all(true);
+	expect(rc == 0, "replay with bad checksum");
+	expect(same(0, exp0, 6000) && same(1, exp1, 150), "bad frame ignored");
+	expect(wal.size == size, "bad frame removed");
+	reset_all();
+
+	/* checkpoint interrupted before the reset of the log, the files
+	 * having shrunk since the first frames */
+	open_all(false);
+	put(0, 'a', 4000, 0);
+	put(1, 'b', 2000, 0);
+	commit();
+	fbuf_sync(&fbufs[0]);
+	fbuf_sync(&fbufs[1]);
+	wal_reset(&wal);
+	put(0, 'x', 4000, 4000);
+	put(1, 'z', 1000, 2000);
+	commit();
+	put(0, 'x', 10, 10);
+	commit();
+	shrink(0, 3000);
+	shrink(1, 1000);
+	put(0, 'y', 5, 12);
+	/* checkpoint as filedb does, without resetting the log */
+	commit();
+	fbuf_sync(&fbufs[0]);
+	fbuf_sync(&fbufs[1]);
+	memcpy(exp0, fbufs[0].buffer, fbufs[0].used);
+	memcpy(exp1, fbufs[1].buffer, fbufs[1].used);
+	close_all();
+	rc = open_all(true);
+	expect(rc == 0, "replay after interrupted checkpoint");
+	expect(same(0, exp0, 3000) && same(1, exp1, 1000), "content after interrupted checkpoint");
+	reset_all();
+
+	rmdir(dir);
+	free(exp0);
+	free(exp1);
+	return report();
+}
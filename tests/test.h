@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2018-2026 IoT.bzh Company
+ * Author: José Bollo <jose.bollo@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+/******************************************************************************/
+/******************************************************************************/
+/* HELPERS OF THE TESTS                                                       */
+/******************************************************************************/
+/******************************************************************************/
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/** count of the failed expectations */
+static int errors;
+
+/**
+ * Print the result of the expectation 'what' and count it when failed
+ *
+ * @param cond the condition expected to be true
+ * @param what the description of the expectation
+ */
+static inline void expect(bool cond, const char *what)
+{
+	printf("%s %s\n", cond ? "OK  " : "FAIL", what);
+	errors += !cond;
+}
+
+/**
+ * Print the count of failed expectations
+ *
+ * @return the exit status of the test: 0 when no expectation failed
+ */
+static inline int report(void)
+{
+	printf("%d error(s)\n", errors);
+	return !!errors;
+}